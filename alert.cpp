@@ -0,0 +1,365 @@
+/*
+ *   alert - evaluate sweeps against a per-frequency limit mask
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "alert.hpp"
+#include "trace.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+void alert_load_mask(alertengine_t &engine, const string &filename)
+{
+	fstream mask(filename, ios::in);
+	if_error(!mask.is_open(), "Error: cannot open mask file " + filename);
+
+	string line;
+	size_t line_count = 0;
+	engine.ranges.clear();
+	engine.steps = 0; // nothing is evaluated until alert_plan()
+	while(getline(mask, line))
+	{
+		line_count++;
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		alertrange_t r = {};
+		r.min_duration = 0;
+		r.hysteresis = ALERT_DEFAULT_HYSTERESIS;
+		const int ret = sscanf(line.c_str(), "%lf,%lf,%f,%f,%f",
+			&r.start_freq, &r.stop_freq, &r.limit, &r.min_duration, &r.hysteresis);
+		if_error(ret < 3, format("Error: invalid mask at {}:{}", filename, line_count));
+		if_error(r.start_freq > r.stop_freq, format("Error: start > stop at {}:{}", filename, line_count));
+		if_error(r.min_duration < 0 || r.hysteresis < 0,
+			format("Error: negative duration or hysteresis at {}:{}", filename, line_count));
+
+		engine.ranges.emplace_back(r);
+	}
+	if_error(engine.ranges.empty(), "Error: no range in mask file " + filename);
+}
+
+// map every range onto bins of current frequency plan
+void alert_plan(alertengine_t &engine, const logheader_t &h)
+{
+	engine.steps = h.steps;
+	engine.start_freq = h.start_freq;
+	engine.step_freq = h.steps > 1 ? (h.stop_freq - h.start_freq) / (h.steps - 1) : 0;
+
+	for(auto &r : engine.ranges)
+	{
+		if(engine.step_freq > 0)
+		{
+			const double first = std::ceil((r.start_freq - h.start_freq) / engine.step_freq);
+			const double last = std::floor((r.stop_freq - h.start_freq) / engine.step_freq) + 1;
+			r.first_bin = std::clamp(first, 0.0, (double)h.steps);
+			r.last_bin = std::clamp(last, 0.0, (double)h.steps);
+		}
+		else
+		{
+			const bool inside = r.start_freq <= h.start_freq && h.start_freq <= r.stop_freq;
+			r.first_bin = 0;
+			r.last_bin = inside ? h.steps : 0;
+		}
+
+		// state of a previous plan doesn't carry over
+		r.pending = false;
+		r.active = false;
+		r.planned = r.first_bin < r.last_bin;
+		if(!r.planned)
+			cerr << format("Warning: mask range {:.6f}~{:.6f}MHz is outside of sweep\n", r.start_freq, r.stop_freq);
+	}
+}
+
+static void enqueue(alertengine_t &engine, const alertrange_t &r, bool raised,
+	const vector<float> &sweep, time_point<steady_clock> sweep_end, const string &time)
+{
+	if(!r.planned)
+		return;
+	// peak is only needed when there's an event, so it's not in the hot loop
+	const auto peak = std::max_element(sweep.begin() + r.first_bin, sweep.begin() + r.last_bin);
+	const alertevent_t event =
+	{
+		raised,
+		time,
+		r.start_freq,
+		r.stop_freq,
+		r.limit,
+		*peak,
+		engine.start_freq + (peak - sweep.begin()) * engine.step_freq,
+		sweep_end
+	};
+
+	std::lock_guard<std::mutex> guard(engine.lock);
+	if(engine.queue.size() >= ALERT_QUEUE_SIZE)
+	{
+		engine.dropped++;
+		return;
+	}
+	engine.queue.emplace_back(event);
+	engine.wakeup.notify_one();
+}
+
+// count bins in [first, last) above limit & above clear limit
+SIMD_CLONES
+static void count_over(const float *power, float limit, float clear_limit,
+	size_t first, size_t last, size_t &over, size_t &not_clear)
+{
+	size_t o = 0;
+	size_t n = 0;
+	#pragma omp simd reduction(+:o, n)
+	for(size_t i = first; i < last; i++)
+	{
+		o += power[i] > limit;
+		n += power[i] > clear_limit;
+	}
+	over = o;
+	not_clear = n;
+}
+
+// returns number of events generated by this sweep
+size_t alert_evaluate(alertengine_t &engine, const vector<float> &sweep, time_point<steady_clock> sweep_end)
+{
+	return alert_evaluate(engine, sweep, sweep_end, sweep_end, time_str());
+}
+
+// sweep_time drives debouncing & time is put in events, sweep_end is only for latency
+size_t alert_evaluate(alertengine_t &engine, const vector<float> &sweep, time_point<steady_clock> sweep_end,
+	time_point<steady_clock> sweep_time, const string &time)
+{
+	if(sweep.size() != engine.steps)
+		return 0;
+
+	trace_begin("alert evaluate");
+	const float *power = sweep.data();
+	size_t events = 0;
+
+	for(auto &r : engine.ranges)
+	{
+		if(!r.planned)
+			continue;
+		size_t over = 0; // bins above limit
+		size_t not_clear = 0; // bins above limit - hysteresis
+		count_over(power, r.limit, r.limit - r.hysteresis, r.first_bin, r.last_bin, over, not_clear);
+
+		if(!r.active)
+		{
+			if(over == 0)
+			{
+				r.pending = false;
+				continue;
+			}
+			if(!r.pending)
+			{
+				r.pending = true;
+				r.pending_since = sweep_time;
+			}
+			// debouncing: it has to stay above limit for min_duration
+			const std::chrono::duration<float> pending_for = sweep_time - r.pending_since;
+			if(pending_for.count() >= r.min_duration)
+			{
+				r.pending = false;
+				r.active = true;
+				enqueue(engine, r, true, sweep, sweep_end, time);
+				events++;
+			}
+		}
+		else if(not_clear == 0)
+		{
+			r.active = false;
+			enqueue(engine, r, false, sweep, sweep_end, time);
+			events++;
+		}
+	}
+	trace_end("alert evaluate");
+
+	return events;
+}
+
+static void deliver(alertengine_t &engine, const alertevent_t &e)
+{
+	const string line = format("{},{},{:.6f},{:.6f},{:.1f},{:.1f},{:.6f}\n",
+		e.raised ? "raised" : "cleared", e.time, e.start_freq, e.stop_freq, e.limit, e.peak_power, e.peak_freq);
+
+	switch(engine.sink)
+	{
+		case alertsink_t::none:
+			break;
+		case alertsink_t::unix_socket:
+		{
+			sockaddr_un addr = {};
+			addr.sun_family = AF_UNIX;
+			strncpy(addr.sun_path, engine.target.c_str(), sizeof(addr.sun_path) - 1);
+			if(sendto(engine.fd, line.c_str(), line.size(), MSG_DONTWAIT,
+				reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+				cerr << format("Warning: alert not delivered to {}: {}\n", engine.target, strerror(errno));
+			break;
+		}
+		case alertsink_t::fifo:
+		{
+			// FIFO can only be opened when there's a reader, so retry on every event
+			if(engine.fd < 0)
+				engine.fd = open(engine.target.c_str(), O_WRONLY | O_NONBLOCK);
+			if(engine.fd < 0 || write(engine.fd, line.c_str(), line.size()) < 0)
+			{
+				cerr << format("Warning: alert not delivered to {}: {}\n", engine.target, strerror(errno));
+				if(engine.fd >= 0)
+					close(engine.fd);
+				engine.fd = -1;
+			}
+			break;
+		}
+		case alertsink_t::exec:
+		{
+			// hook <raised|cleared> <time> <start MHz> <stop MHz> <limit dBm> <peak dBm> <peak MHz>
+			vector<string> args =
+			{
+				engine.target, e.raised ? "raised" : "cleared", e.time,
+				format("{:.6f}", e.start_freq), format("{:.6f}", e.stop_freq),
+				format("{:.1f}", e.limit), format("{:.1f}", e.peak_power), format("{:.6f}", e.peak_freq)
+			};
+			vector<char *> argv;
+			for(auto &arg : args)
+				argv.emplace_back(arg.data());
+			argv.emplace_back(nullptr);
+
+			// the hook gets default SIGPIPE / SIGINT / SIGTERM & an empty mask, not what we ignore or block
+			sigset_t mask, defaults;
+			sigemptyset(&mask);
+			sigemptyset(&defaults);
+			sigaddset(&defaults, SIGPIPE);
+			sigaddset(&defaults, SIGINT);
+			sigaddset(&defaults, SIGTERM);
+			posix_spawnattr_t attr;
+			posix_spawnattr_init(&attr);
+			posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+			posix_spawnattr_setsigmask(&attr, &mask);
+			posix_spawnattr_setsigdefault(&attr, &defaults);
+
+			pid_t pid;
+			const int ret = posix_spawn(&pid, engine.target.c_str(), nullptr, &attr, argv.data(), environ);
+			posix_spawnattr_destroy(&attr);
+			if(ret != 0)
+				cerr << format("Warning: failed to run alert hook {}: {}\n", engine.target, strerror(ret));
+			// reap finished hooks without waiting for the one just started
+			while(waitpid(-1, nullptr, WNOHANG) > 0)
+				;
+			break;
+		}
+	}
+}
+
+// runs on its own thread, so a slow consumer never delays sweeping
+static void sender(alertengine_t &engine)
+{
+	trace_thread_name("alert sender");
+	std::unique_lock<std::mutex> guard(engine.lock);
+	while(true)
+	{
+		engine.wakeup.wait(guard, [&engine] { return engine.stopping || !engine.queue.empty(); });
+		if(engine.queue.empty())
+			break; // stopping
+
+		const alertevent_t event = engine.queue.front();
+		engine.queue.pop_front();
+
+		guard.unlock();
+		trace_begin("alert deliver");
+		deliver(engine, event);
+		trace_end("alert deliver");
+		const auto latency = std::chrono::duration<double, std::micro>(steady_clock::now() - event.sweep_end);
+		print("\nAlert {}: {:.6f}~{:.6f}MHz, peak {:.1f}dBm at {:.6f}MHz, limit {:.1f}dBm, {:.0f}us after end of sweep\n",
+			event.raised ? "raised" : "cleared", event.start_freq, event.stop_freq,
+			event.peak_power, event.peak_freq, event.limit, latency.count());
+		guard.lock();
+
+		engine.delivered++;
+		engine.total_latency_us += latency.count();
+		engine.max_latency_us = std::max(engine.max_latency_us, latency.count());
+	}
+}
+
+// target: "unix:<socket path>", "fifo:<path>", "exec:<program>" or empty for printing only
+void alert_start(alertengine_t &engine, const string &target)
+{
+	engine.fd = -1;
+	engine.stopping = false;
+	engine.delivered = 0;
+	engine.dropped = 0;
+	engine.total_latency_us = 0;
+	engine.max_latency_us = 0;
+
+	const auto colon = target.find(':');
+	const string type = target.substr(0, colon);
+	engine.target = colon == string::npos ? "" : target.substr(colon + 1);
+
+	if(target.empty())
+	{
+		engine.sink = alertsink_t::none;
+	}
+	else if(type == "unix")
+	{
+		engine.sink = alertsink_t::unix_socket;
+		engine.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if_error(engine.fd < 0, "Error: cannot create alert socket");
+	}
+	else if(type == "fifo")
+	{
+		engine.sink = alertsink_t::fifo;
+	}
+	else if(type == "exec")
+	{
+		engine.sink = alertsink_t::exec;
+	}
+	else
+	{
+		if_error(true, "Error: unknown alert target " + target);
+	}
+	if_error(engine.sink != alertsink_t::none && engine.target.empty(), "Error: empty alert target " + target);
+
+	// a FIFO reader going away must not kill us
+	signal(SIGPIPE, SIG_IGN);
+	engine.sender = std::thread(sender, std::ref(engine));
+}
+
+// deliver what's left in queue & print latency statistics
+void alert_stop(alertengine_t &engine)
+{
+	{
+		std::lock_guard<std::mutex> guard(engine.lock);
+		engine.stopping = true;
+		engine.wakeup.notify_one();
+	}
+	engine.sender.join();
+	if(engine.fd >= 0)
+		close(engine.fd);
+	engine.fd = -1;
+
+	print("Alerts: {} delivered, {} dropped, latency avg {:.0f}us, max {:.0f}us\n",
+		engine.delivered, engine.dropped,
+		engine.delivered ? engine.total_latency_us / engine.delivered : 0, engine.max_latency_us);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+/* alert.hpp: per-frequency limit mask & alert delivery */
+
+using std::chrono::steady_clock;
+
+// one line of mask file:
+//	<start MHz>,<stop MHz>,<limit dBm>[,<min duration sec>[,<hysteresis dB>]]
+typedef struct
+{
+	double start_freq;
+	double stop_freq;
+	float limit;
+	float min_duration;
+	float hysteresis;
+
+	// bins covered in current frequency plan, [first_bin, last_bin)
+	bool planned; // false: outside of sweep, never evaluated
+	size_t first_bin;
+	size_t last_bin;
+
+	// debouncing state
+	bool pending;
+	bool active;
+	time_point<steady_clock> pending_since;
+} alertrange_t;
+
+typedef struct
+{
+	bool raised; // false: cleared
+	string time;
+	double start_freq;
+	double stop_freq;
+	float limit;
+	float peak_power;
+	double peak_freq;
+	time_point<steady_clock> sweep_end; // for latency measurement
+} alertevent_t;
+
+enum class alertsink_t { none, unix_socket, fifo, exec };
+
+typedef struct
+{
+	vector<alertrange_t> ranges;
+	// current plan, every range is judged against its own limit even where ranges overlap
+	size_t steps;
+	double start_freq;
+	double step_freq;
+
+	// delivery
+	alertsink_t sink;
+	string target;
+	int fd;
+	std::thread sender;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	std::deque<alertevent_t> queue;
+	bool stopping;
+
+	// end of sweep -> delivered
+	size_t delivered;
+	size_t dropped;
+	double total_latency_us;
+	double max_latency_us;
+} alertengine_t;
+
+void alert_load_mask(alertengine_t &engine, const string &filename);
+void alert_plan(alertengine_t &engine, const logheader_t &h);
+size_t alert_evaluate(alertengine_t &engine, const vector<float> &sweep, time_point<steady_clock> sweep_end);
+// for replayed sweeps, whose time isn't now
+size_t alert_evaluate(alertengine_t &engine, const vector<float> &sweep, time_point<steady_clock> sweep_end,
+	time_point<steady_clock> sweep_time, const string &time);
+void alert_start(alertengine_t &engine, const string &target);
+void alert_stop(alertengine_t &engine);
@@ -0,0 +1,155 @@
+/*
+ *   baseline - rolling per-bin baseline of spectrum sweeps
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "baseline.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+// state file layout (native endianness):
+//	magic, plan, alpha, sweeps, mean[], variance[]
+constexpr static char BASELINE_MAGIC[8] = {'S', 'P', 'B', 'A', 'S', 'E', '1', '\0'};
+
+void baseline_init(baseline_t &b, const logheader_t &h, float alpha)
+{
+	if_error(!(alpha > 0 && alpha <= 1), format("Error: baseline alpha {} not in (0, 1]", alpha));
+
+	b.start_freq = h.start_freq;
+	b.stop_freq = h.stop_freq;
+	b.steps = h.steps;
+	b.rbw = h.rbw;
+	b.alpha = alpha;
+	b.sweeps = 0;
+	b.mean.assign(h.steps, 0);
+	b.variance.assign(h.steps, BASELINE_MIN_VARIANCE);
+}
+
+bool baseline_matches(const baseline_t &b, const logheader_t &h)
+{
+	return b.start_freq == h.start_freq && b.stop_freq == h.stop_freq &&
+		b.steps == h.steps && b.rbw == h.rbw;
+}
+
+// O(steps) incremental update, see "Incremental calculation of weighted mean and variance" by Tony Finch
+SIMD_CLONES
+void baseline_update(baseline_t &b, const float *record)
+{
+	const size_t steps = b.steps;
+	float *mean = b.mean.data();
+	float *variance = b.variance.data();
+
+	// first sweep is taken as is
+	if(b.sweeps == 0)
+	{
+		std::copy(record, record + steps, mean);
+		b.sweeps++;
+		return;
+	}
+
+	const float alpha = b.alpha;
+	#pragma omp simd
+	for(size_t i = 0; i < steps; i++)
+	{
+		const float diff = record[i] - mean[i];
+		const float increment = alpha * diff;
+		mean[i] += increment;
+		variance[i] = (1 - alpha) * (variance[i] + diff * increment);
+	}
+	b.sweeps++;
+}
+
+// z-score of every bin against the baseline, returns how many bins have |z| >= threshold
+SIMD_CLONES
+size_t baseline_score(const baseline_t &b, const float *record, float *z, float threshold)
+{
+	const size_t steps = b.steps;
+	const float *mean = b.mean.data();
+	const float *variance = b.variance.data();
+	size_t anomalies = 0;
+
+	#pragma omp simd reduction(+:anomalies)
+	for(size_t i = 0; i < steps; i++)
+	{
+		z[i] = (record[i] - mean[i]) / std::sqrt(std::max(variance[i], BASELINE_MIN_VARIANCE));
+		anomalies += std::fabs(z[i]) >= threshold;
+	}
+
+	return anomalies;
+}
+
+// returns false if file doesn't exist or is damaged, fails if it was built for another frequency plan
+// arrays are sized from h & checked against the file size, never from the file's own count
+bool baseline_load(baseline_t &b, const string &filename, const logheader_t &h)
+{
+	fstream f(filename, ios::in | ios::binary);
+	if(!f.is_open())
+		return false;
+
+	f.seekg(0, ios::end);
+	const uint64_t file_size = f.tellg();
+	f.seekg(0, ios::beg);
+
+	char magic[sizeof(BASELINE_MAGIC)];
+	f.read(magic, sizeof(magic));
+	if(!f.good() || std::memcmp(magic, BASELINE_MAGIC, sizeof(magic)) != 0)
+		return false;
+
+	read_pod(f, b.start_freq);
+	read_pod(f, b.stop_freq);
+	read_pod(f, b.steps);
+	read_pod(f, b.rbw);
+	read_pod(f, b.alpha);
+	read_pod(f, b.sweeps);
+	if(!f.good())
+		return false;
+	if_error(!baseline_matches(b, h), format("Error: baseline {} has a different frequency plan ({} steps, expected {})",
+		filename, b.steps, h.steps));
+	if(file_size - f.tellg() != 2 * h.steps * sizeof(float))
+		return false;
+	read_array(f, b.mean, h.steps);
+	read_array(f, b.variance, h.steps);
+
+	return f.good();
+}
+
+// written to a temporary file first, so a crash never leaves a damaged baseline
+void baseline_save(const baseline_t &b, const string &filename)
+{
+	const string tmp_name = filename + ".tmp";
+	{
+		fstream f(tmp_name, ios::out | ios::binary | ios::trunc);
+		if_error(!f.is_open(), "Error: cannot open baseline file " + tmp_name);
+
+		f.write(BASELINE_MAGIC, sizeof(BASELINE_MAGIC));
+		write_pod(f, b.start_freq);
+		write_pod(f, b.stop_freq);
+		write_pod(f, b.steps);
+		write_pod(f, b.rbw);
+		write_pod(f, b.alpha);
+		write_pod(f, b.sweeps);
+		write_array(f, b.mean);
+		write_array(f, b.variance);
+
+		if_error(!f.good(), "Error: failed to write baseline file " + tmp_name);
+	}
+	if_error(std::rename(tmp_name.c_str(), filename.c_str()) != 0,
+		"Error: failed to replace baseline file " + filename);
+}
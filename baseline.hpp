@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.hpp"
+
+/* baseline.hpp: rolling per-bin baseline (exponentially weighted mean & variance) */
+
+typedef struct
+{
+	// frequency plan the baseline was built for
+	double start_freq;
+	double stop_freq;
+	size_t steps;
+	float rbw;
+
+	float alpha;
+	size_t sweeps; // number of sweeps seen, 0 means not warmed up yet
+
+	vector<float> mean;
+	vector<float> variance;
+} baseline_t;
+
+void baseline_init(baseline_t &b, const logheader_t &h, float alpha);
+bool baseline_matches(const baseline_t &b, const logheader_t &h);
+void baseline_update(baseline_t &b, const float *record);
+size_t baseline_score(const baseline_t &b, const float *record, float *z, float threshold);
+
+bool baseline_load(baseline_t &b, const string &filename, const logheader_t &h);
+void baseline_save(const baseline_t &b, const string &filename);
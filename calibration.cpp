@@ -0,0 +1,116 @@
+/*
+ *   calibration - per-bin level correction of spectrum sweeps
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "calibration.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <cstdio>
+
+// RBW in headers is written with 3 decimals
+static bool same_rbw(float a, float b)
+{
+	return std::fabs(a - b) < 1e-3f;
+}
+
+void calibration_load(calibration_t &cal, const string &filename)
+{
+	fstream table(filename, ios::in);
+	if_error(!table.is_open(), "Error: cannot open calibration file " + filename);
+
+	string line;
+	size_t line_count = 0;
+	cal.points.clear();
+	while(getline(table, line))
+	{
+		line_count++;
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		calpoint_t p = {0, 0, 0};
+		const int ret = sscanf(line.c_str(), "%lf,%f,%f", &p.freq, &p.offset, &p.rbw);
+		if_error(ret < 2 || !isfinite(p.offset), format("Error: invalid calibration point at {}:{}", filename, line_count));
+		if_error(p.rbw < 0, format("Error: negative RBW at {}:{}", filename, line_count));
+		cal.points.emplace_back(p);
+	}
+	if_error(cal.points.empty(), "Error: no point in calibration file " + filename);
+
+	std::sort(cal.points.begin(), cal.points.end(), [](const calpoint_t &a, const calpoint_t &b)
+	{
+		return a.rbw != b.rbw ? a.rbw < b.rbw : a.freq < b.freq;
+	});
+	cal.plan = {0, 0, 0, 0, "", "", false};
+	cal.correction.clear();
+}
+
+const vector<float> &calibration_plan(calibration_t &cal, const logheader_t &h)
+{
+	const logheader_t &p = cal.plan;
+	if(p.steps == h.steps && p.start_freq == h.start_freq && p.stop_freq == h.stop_freq && p.rbw == h.rbw)
+		return cal.correction;
+
+	// points of one RBW are contiguous
+	auto first = std::find_if(cal.points.begin(), cal.points.end(), [&](const calpoint_t &c) { return same_rbw(c.rbw, h.rbw); });
+	if(first == cal.points.end())
+		first = std::find_if(cal.points.begin(), cal.points.end(), [](const calpoint_t &c) { return c.rbw == 0; });
+	if_error(first == cal.points.end(), format("Error: calibration has no points for RBW {}kHz", h.rbw));
+	const float rbw = first->rbw;
+	const auto last = std::find_if(first, cal.points.end(), [&](const calpoint_t &c) { return c.rbw != rbw; });
+
+	// bins are in ascending frequency, so table is walked once
+	cal.correction.resize(h.steps);
+	const double step_freq = h.steps > 1 ? (h.stop_freq - h.start_freq) / (h.steps - 1) : 0;
+	auto next = first;
+	for(size_t i = 0; i < h.steps; i++)
+	{
+		const double freq = h.start_freq + step_freq * i;
+		while(next != last && next->freq <= freq)
+			next++;
+		if(next == first)
+			cal.correction[i] = first->offset;
+		else if(next == last)
+			cal.correction[i] = (last - 1)->offset;
+		else
+		{
+			const calpoint_t &a = *(next - 1);
+			const calpoint_t &b = *next;
+			const double t = (freq - a.freq) / (b.freq - a.freq);
+			cal.correction[i] = a.offset + (b.offset - a.offset) * t;
+		}
+	}
+	cal.plan = h;
+	return cal.correction;
+}
+
+SIMD_CLONES
+static void add_correction(float *power_data, const float *correction, size_t steps, size_t records)
+{
+	for(size_t r = 0; r < records; r++)
+	{
+		float *row = power_data + r * steps;
+		#pragma omp simd
+		for(size_t i = 0; i < steps; i++)
+			row[i] += correction[i];
+	}
+}
+
+void calibrate_records(calibration_t &cal, const logheader_t &h, float *power_data, size_t records)
+{
+	if_error(h.calibrated, "Error: log was already calibrated by spsave -L, it would be corrected twice");
+	add_correction(power_data, calibration_plan(cal, h).data(), h.steps, records);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.hpp"
+
+/* calibration.hpp: per-bin level correction from a table of frequency & dB offset */
+
+typedef struct
+{
+	float rbw; // kHz, 0 means any RBW
+	double freq; // MHz
+	float offset; // dB added to measured level
+} calpoint_t;
+
+typedef struct
+{
+	vector<calpoint_t> points; // sorted by RBW, then frequency
+
+	// correction of last frequency plan, only rebuilt when plan changes
+	logheader_t plan;
+	vector<float> correction;
+} calibration_t;
+
+// "<freq MHz>,<offset dB>[,<RBW kHz>]" per line
+void calibration_load(calibration_t &cal, const string &filename);
+// per-bin offsets for h's frequency plan, interpolated linearly & flat past both ends of the table
+// uses points of h's RBW if there are any, otherwise points without RBW
+const vector<float> &calibration_plan(calibration_t &cal, const logheader_t &h);
+// records of h's frequency plan, corrected in place, a log spsave already calibrated is an error
+void calibrate_records(calibration_t &cal, const logheader_t &h, float *power_data, size_t records);
@@ -0,0 +1,399 @@
+/*
+ *   columnar - .npy & Arrow IPC stream writers
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "columnar.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+constexpr static char BYTE_ORDER_MARK = '<';
+#else
+constexpr static char BYTE_ORDER_MARK = '>';
+#endif
+
+static const uint8_t ZERO_PADDING[8] = {};
+
+// writev() until everything is written, iov is consumed
+static void writev_all(int fd, vector<iovec> &iov, const string &filename)
+{
+	size_t first = 0;
+	while(first < iov.size())
+	{
+		const ssize_t ret = writev(fd, &iov[first], std::min<size_t>(iov.size() - first, IOV_MAX));
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if_error(ret < 0, format("Error: failed to write {}: {}", filename, strerror(errno)));
+
+		// skip what has been written, last one may be partial
+		size_t written = ret;
+		while(first < iov.size() && written >= iov[first].iov_len)
+			written -= iov[first++].iov_len;
+		if(first < iov.size())
+		{
+			iov[first].iov_base = static_cast<uint8_t *>(iov[first].iov_base) + written;
+			iov[first].iov_len -= written;
+		}
+	}
+}
+
+static void write_all(int fd, const void *data, size_t size, const string &filename)
+{
+	vector<iovec> iov = {{const_cast<void *>(data), size}};
+	writev_all(fd, iov, filename);
+}
+
+static int open_output(const string &filename)
+{
+	const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if_error(fd < 0, format("Error: cannot open output file {}: {}", filename, strerror(errno)));
+	return fd;
+}
+
+/* .npy, see numpy.lib.format, version 1.0 */
+
+constexpr static char NPY_MAGIC[8] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0};
+// wide enough for any row count, padded with spaces, which is still a valid tuple
+constexpr static size_t NPY_ROWS_WIDTH = 20;
+
+void npy_begin(npywriter_t &npy, const string &filename, const string &descr, size_t item_size, size_t row_items)
+{
+	npy.filename = filename;
+	npy.row_bytes = item_size * std::max<size_t>(row_items, 1);
+	npy.rows = 0;
+
+	const string shape_prefix = "{'descr': '" + string(1, BYTE_ORDER_MARK) + descr + "', 'fortran_order': False, 'shape': (";
+	string header = shape_prefix + format("{:>{}}", 0, NPY_ROWS_WIDTH) +
+		(row_items == 0 ? string(",), }") : format(", {}), }}", row_items));
+	// magic, header length & header, terminated by newline, are aligned to 64 bytes
+	const size_t unpadded = sizeof(NPY_MAGIC) + 2 + header.size() + 1;
+	header.append((64 - unpadded % 64) % 64, ' ');
+	header += '\n';
+	npy.shape_offset = sizeof(NPY_MAGIC) + 2 + shape_prefix.size();
+
+	uint8_t prefix[sizeof(NPY_MAGIC) + 2];
+	std::memcpy(prefix, NPY_MAGIC, sizeof(NPY_MAGIC));
+	prefix[sizeof(NPY_MAGIC)] = header.size() & 0xff; // little endian
+	prefix[sizeof(NPY_MAGIC) + 1] = header.size() >> 8;
+
+	npy.fd = open_output(filename);
+	vector<iovec> iov = {{prefix, sizeof(prefix)}, {header.data(), header.size()}};
+	writev_all(npy.fd, iov, filename);
+}
+
+// rows are written straight from caller's buffer, with one write()
+void npy_write_rows(npywriter_t &npy, const void *data, size_t rows)
+{
+	write_all(npy.fd, data, rows * npy.row_bytes, npy.filename);
+	npy.rows += rows;
+}
+
+void npy_end(npywriter_t &npy)
+{
+	const string rows = format("{:>{}}", npy.rows, NPY_ROWS_WIDTH);
+	const ssize_t ret = pwrite(npy.fd, rows.data(), rows.size(), npy.shape_offset);
+	if_error(ret != (ssize_t)rows.size(), "Error: failed to write " + npy.filename);
+	if_error(close(npy.fd) != 0, "Error: failed to write " + npy.filename);
+	npy.fd = -1;
+}
+
+/* Arrow IPC stream, see https://arrow.apache.org/docs/format/Columnar.html */
+
+// just enough of a FlatBuffers builder for Arrow metadata
+// like the official one it builds back to front, so children are done before
+// their parents, and references are distances from end of buffer
+class FlatBuilder
+{
+public:
+	size_t size() const { return buf.size(); }
+
+	template <typename T>
+	void push(T value)
+	{
+		align(sizeof(T));
+		uint8_t bytes[sizeof(T)];
+		for(size_t i = 0; i < sizeof(T); i++)
+			bytes[i] = (uint64_t)value >> (i * 8); // always little endian
+		buf.insert(buf.begin(), bytes, bytes + sizeof(T));
+	}
+
+	void push_offset(size_t ref)
+	{
+		align(4);
+		push<uint32_t>(size() + 4 - ref);
+	}
+
+	size_t create_string(const string &s)
+	{
+		prealign(s.size() + 1, 4);
+		buf.insert(buf.begin(), 0);
+		buf.insert(buf.begin(), s.begin(), s.end());
+		push<uint32_t>(s.size());
+		return size();
+	}
+
+	size_t create_offset_vector(const vector<size_t> &refs)
+	{
+		prealign(refs.size() * 4, 4);
+		for(auto ref = refs.rbegin(); ref != refs.rend(); ref++)
+			push_offset(*ref);
+		push<uint32_t>(refs.size());
+		return size();
+	}
+
+	// vector of structs made of two longs, Arrow's FieldNode & Buffer
+	size_t create_long_pair_vector(const vector<std::pair<int64_t, int64_t>> &items)
+	{
+		prealign(items.size() * 16, 8);
+		for(auto item = items.rbegin(); item != items.rend(); item++)
+		{
+			push<int64_t>(item->second);
+			push<int64_t>(item->first);
+		}
+		push<uint32_t>(items.size());
+		return size();
+	}
+
+	void start_table()
+	{
+		fields.clear();
+		table_start = size();
+	}
+
+	template <typename T>
+	void add_scalar(uint16_t id, T value)
+	{
+		push(value);
+		fields.emplace_back(id, size());
+	}
+
+	void add_offset(uint16_t id, size_t ref)
+	{
+		push_offset(ref);
+		fields.emplace_back(id, size());
+	}
+
+	size_t end_table()
+	{
+		push<int32_t>(0); // offset to vtable, patched below
+		const size_t table = size();
+
+		uint16_t field_count = 0;
+		for(const auto &f : fields)
+			field_count = std::max<uint16_t>(field_count, f.first + 1);
+		vector<uint16_t> vtable(field_count, 0);
+		for(const auto &f : fields)
+			vtable[f.first] = table - f.second;
+
+		for(auto entry = vtable.rbegin(); entry != vtable.rend(); entry++)
+			push<uint16_t>(*entry);
+		push<uint16_t>(table - table_start);
+		push<uint16_t>((field_count + 2) * 2);
+
+		// vtable is right before table
+		const int32_t soffset = size() - table;
+		for(size_t i = 0; i < 4; i++)
+			buf[buf.size() - table + i] = (uint32_t)soffset >> (i * 8);
+		return table;
+	}
+
+	const vector<uint8_t> &finish(size_t root)
+	{
+		prealign(4, minalign);
+		push_offset(root);
+		return buf;
+	}
+
+private:
+	vector<uint8_t> buf;
+	vector<std::pair<uint16_t, size_t>> fields; // id, reference
+	size_t table_start = 0;
+	size_t minalign = 1;
+
+	void align(size_t n)
+	{
+		prealign(0, n);
+	}
+
+	// pad, so that it's aligned after len more bytes
+	void prealign(size_t len, size_t n)
+	{
+		minalign = std::max(minalign, n);
+		buf.insert(buf.begin(), (n - (buf.size() + len) % n) % n, 0);
+	}
+};
+
+// ids from Schema.fbs & Message.fbs
+enum : uint8_t { ARROW_TYPE_FLOATINGPOINT = 3, ARROW_TYPE_TIMESTAMP = 10, ARROW_TYPE_FIXEDSIZELIST = 16 };
+enum : uint8_t { ARROW_HEADER_SCHEMA = 1, ARROW_HEADER_RECORDBATCH = 3 };
+constexpr static int16_t ARROW_METADATA_V5 = 4;
+constexpr static int16_t ARROW_PRECISION_SINGLE = 1;
+constexpr static int16_t ARROW_TIMEUNIT_SECOND = 0;
+constexpr static uint32_t ARROW_CONTINUATION = 0xffffffff;
+
+static size_t arrow_field(FlatBuilder &fb, const string &name, uint8_t type_id, size_t type, const vector<size_t> &children)
+{
+	const size_t name_ref = fb.create_string(name);
+	// readers insist on children, even when there's none
+	const size_t children_ref = fb.create_offset_vector(children);
+	fb.start_table();
+	fb.add_offset(0, name_ref);
+	fb.add_scalar<uint8_t>(1, false); // nullable
+	fb.add_scalar<uint8_t>(2, type_id);
+	fb.add_offset(3, type);
+	fb.add_offset(5, children_ref);
+	return fb.end_table();
+}
+
+static size_t arrow_timestamp_field(FlatBuilder &fb, const string &name)
+{
+	// no time zone, times are as they are written in the log
+	fb.start_table();
+	fb.add_scalar<int16_t>(0, ARROW_TIMEUNIT_SECOND);
+	return arrow_field(fb, name, ARROW_TYPE_TIMESTAMP, fb.end_table(), {});
+}
+
+static size_t arrow_key_value(FlatBuilder &fb, const string &key, const string &value)
+{
+	const size_t key_ref = fb.create_string(key);
+	const size_t value_ref = fb.create_string(value);
+	fb.start_table();
+	fb.add_offset(0, key_ref);
+	fb.add_offset(1, value_ref);
+	return fb.end_table();
+}
+
+// metadata is framed as continuation marker, size & flatbuffer padded to 8 bytes
+static vector<uint8_t> arrow_message(FlatBuilder &fb, uint8_t header_type, size_t header, int64_t body_length)
+{
+	fb.start_table();
+	fb.add_scalar<int64_t>(3, body_length);
+	fb.add_offset(2, header);
+	fb.add_scalar<int16_t>(0, ARROW_METADATA_V5);
+	fb.add_scalar<uint8_t>(1, header_type);
+	const vector<uint8_t> &flatbuffer = fb.finish(fb.end_table());
+
+	const uint32_t padded = (flatbuffer.size() + 7) / 8 * 8;
+	vector<uint8_t> message(8 + padded, 0);
+	for(size_t i = 0; i < 4; i++)
+	{
+		message[i] = ARROW_CONTINUATION >> (i * 8);
+		message[4 + i] = padded >> (i * 8);
+	}
+	std::copy(flatbuffer.begin(), flatbuffer.end(), message.begin() + 8);
+	return message;
+}
+
+void arrow_begin(arrowwriter_t &arrow, const string &filename, const logheader_t &h)
+{
+	arrow.filename = filename;
+	arrow.steps = h.steps;
+	arrow.rows = 0;
+	arrow.batches = 0;
+
+	FlatBuilder fb;
+	vector<size_t> fields;
+	fields.emplace_back(arrow_timestamp_field(fb, "start_time"));
+	fields.emplace_back(arrow_timestamp_field(fb, "end_time"));
+
+	fb.start_table();
+	fb.add_scalar<int16_t>(0, ARROW_PRECISION_SINGLE);
+	const size_t item = arrow_field(fb, "item", ARROW_TYPE_FLOATINGPOINT, fb.end_table(), {});
+	fb.start_table();
+	fb.add_scalar<int32_t>(0, h.steps);
+	fields.emplace_back(arrow_field(fb, "power", ARROW_TYPE_FIXEDSIZELIST, fb.end_table(), {item}));
+
+	// frequency axis, same numbers as in log header
+	const vector<size_t> metadata =
+	{
+		arrow_key_value(fb, "start_freq", format("{:.06f}", h.start_freq)),
+		arrow_key_value(fb, "stop_freq", format("{:.06f}", h.stop_freq)),
+		arrow_key_value(fb, "steps", format("{}", h.steps)),
+		arrow_key_value(fb, "rbw", format("{:.03f}", h.rbw))
+	};
+
+	const size_t fields_ref = fb.create_offset_vector(fields);
+	const size_t metadata_ref = fb.create_offset_vector(metadata);
+	fb.start_table();
+	fb.add_scalar<int16_t>(0, BYTE_ORDER_MARK == '<' ? 0 : 1); // endianness
+	fb.add_offset(1, fields_ref);
+	fb.add_offset(2, metadata_ref);
+	const size_t schema = fb.end_table();
+
+	const vector<uint8_t> message = arrow_message(fb, ARROW_HEADER_SCHEMA, schema, 0);
+	arrow.fd = open_output(filename);
+	write_all(arrow.fd, message.data(), message.size(), filename);
+}
+
+// buffers are written straight from caller's arrays, with one writev()
+void arrow_write_batch(arrowwriter_t &arrow, const int64_t *start_times, const int64_t *end_times, const float *power, size_t rows)
+{
+	const int64_t time_bytes = rows * sizeof(int64_t);
+	const int64_t power_bytes = rows * arrow.steps * sizeof(float);
+	const int64_t power_padded = (power_bytes + 7) / 8 * 8;
+
+	// pre-order: start_time, end_time, power, power.item
+	// no nulls, so every validity bitmap is empty
+	const int64_t length = rows;
+	const int64_t items = rows * arrow.steps;
+	const vector<std::pair<int64_t, int64_t>> nodes =
+	{
+		{length, 0}, {length, 0}, {length, 0}, {items, 0}
+	};
+	const vector<std::pair<int64_t, int64_t>> buffers =
+	{
+		{0, 0}, {0, time_bytes},
+		{time_bytes, 0}, {time_bytes, time_bytes},
+		{time_bytes * 2, 0},
+		{time_bytes * 2, 0}, {time_bytes * 2, power_bytes}
+	};
+
+	FlatBuilder fb;
+	const size_t nodes_ref = fb.create_long_pair_vector(nodes);
+	const size_t buffers_ref = fb.create_long_pair_vector(buffers);
+	fb.start_table();
+	fb.add_scalar<int64_t>(0, length);
+	fb.add_offset(1, nodes_ref);
+	fb.add_offset(2, buffers_ref);
+	const size_t batch = fb.end_table();
+	const vector<uint8_t> message = arrow_message(fb, ARROW_HEADER_RECORDBATCH, batch, time_bytes * 2 + power_padded);
+
+	vector<iovec> iov =
+	{
+		{const_cast<uint8_t *>(message.data()), message.size()},
+		{const_cast<int64_t *>(start_times), (size_t)time_bytes},
+		{const_cast<int64_t *>(end_times), (size_t)time_bytes},
+		{const_cast<float *>(power), (size_t)power_bytes},
+		{const_cast<uint8_t *>(ZERO_PADDING), (size_t)(power_padded - power_bytes)}
+	};
+	writev_all(arrow.fd, iov, arrow.filename);
+	arrow.rows += rows;
+	arrow.batches++;
+}
+
+void arrow_end(arrowwriter_t &arrow)
+{
+	// end of stream: continuation marker & zero length
+	const uint32_t eos[2] = {ARROW_CONTINUATION, 0};
+	write_all(arrow.fd, eos, sizeof(eos), arrow.filename);
+	if_error(close(arrow.fd) != 0, "Error: failed to write " + arrow.filename);
+	arrow.fd = -1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.hpp"
+
+/* columnar.hpp: streaming .npy & Arrow IPC writers, for exporting logs without the text round trip */
+
+// rows are appended as they come, the row count is patched into the header
+// when finished, so output has to be a seekable file
+typedef struct
+{
+	int fd;
+	string filename;
+	size_t row_bytes;
+	size_t rows;
+	size_t shape_offset; // where the row count is in header
+} npywriter_t;
+
+// descr is the dtype without byte order, ex. "f4", row_items is 0 for 1-D arrays
+void npy_begin(npywriter_t &npy, const string &filename, const string &descr, size_t item_size, size_t row_items);
+void npy_write_rows(npywriter_t &npy, const void *data, size_t rows);
+void npy_end(npywriter_t &npy);
+
+// Arrow IPC stream of start_time, end_time (timestamp[s]) & power (fixed_size_list<float>[steps]),
+// frequency plan is kept as schema metadata, every call of arrow_write_batch() is one record batch
+typedef struct
+{
+	int fd;
+	string filename;
+	size_t steps;
+	size_t rows;
+	size_t batches;
+} arrowwriter_t;
+
+void arrow_begin(arrowwriter_t &arrow, const string &filename, const logheader_t &h);
+void arrow_write_batch(arrowwriter_t &arrow, const int64_t *start_times, const int64_t *end_times, const float *power, size_t rows);
+void arrow_end(arrowwriter_t &arrow);
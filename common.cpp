@@ -7,6 +7,7 @@
 #include <cstddef>
 #include <cstdlib>
 #include <cctype>
+#include <algorithm>
 #include <ctime>
 #include <chrono>
 #include <unistd.h>
@@ -15,6 +16,10 @@
 #include <date/date.h>
 #include "common.hpp"
 #include "config.hpp"
+#include "probes.hpp"
+
+// semaphores of probes fired from here
+PROBE_SEMAPHORE(parse__records);
 
 const time_point<system_clock> now(void)
 {
@@ -23,7 +28,12 @@ const time_point<system_clock> now(void)
 
 const string time_str(void)
 {
-	return format("{:%Y%m%dT%H%M%S}", std::chrono::floor<std::chrono::seconds>(now()));
+	return time_str(now());
+}
+
+const string time_str(const time_point<system_clock> &time)
+{
+	return format("{:%Y%m%dT%H%M%S}", std::chrono::floor<std::chrono::seconds>(time));
 }
 
 const time_point<system_clock> time_from_str(const string &str)
@@ -38,10 +48,48 @@ const time_point<system_clock> time_from_str(const string &str)
 	return time;
 }
 
+int64_t epoch_seconds(const string &str)
+{
+	return duration_cast<seconds>(time_from_str(str).time_since_epoch()).count();
+}
+
+double bin_frequency(const logheader_t &h, size_t bin)
+{
+	return h.steps > 1 ? h.start_freq + (h.stop_freq - h.start_freq) * bin / (h.steps - 1) : h.start_freq;
+}
+
+// sanity check of a parsed header
+static bool check_header(const logheader_t &h)
+{
+	if(h.start_freq >= h.stop_freq)
+	{
+		cerr << "Error: start_freq >= stop_freq" << endl;
+		return false;
+	}
+	if(h.steps == 0)
+	{
+		cerr << "Error: steps == 0" << endl;
+		return false;
+	}
+	if(h.rbw <= 0 || h.rbw > 1000)
+	{
+		cerr << "Error: rbw <= 0 || rbw > 1000" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+static bool marked_calibrated(const string &line)
+{
+	const size_t length = sizeof(LOG_CALIBRATED_FIELD) - 1;
+	return line.size() > length && line.compare(line.size() - length, length, LOG_CALIBRATED_FIELD) == 0;
+}
+
 // parse log record header line
-// # <start_freq>,<stop_freq>,<steps>,<RBW>,<start_time>,<end_time>
+// $ <start_freq>,<stop_freq>,<steps>,<RBW>,<start_time>,<end_time>[,calibrated]
 // formatted by:
-//	"# %.06f,%.06f,%ld,%.03f,%s,%s\n"
+//	"$ %.06f,%.06f,%ld,%.03f,%s,%s\n"
 bool parse_header(const string &line, logheader_t &h)
 {
 	char start_time_str[32];
@@ -52,87 +100,121 @@ bool parse_header(const string &line, logheader_t &h)
 	int ret = sscanf(line.c_str(), "$ %lf,%lf,%zu,%f,%31[^,],%31[^,]", &h.start_freq, &h.stop_freq, &h.steps, &h.rbw, start_time_str, end_time_str);
 	h.start_time = start_time_str;
 	h.end_time = end_time_str;
+	h.calibrated = marked_calibrated(line);
 
 	if(ret != 6)
 		return false;
 
-	// sanity check
-	if(h.start_freq >= h.stop_freq)
+	return check_header(h);
+}
+
+// parse deadband (delta) record header line, only changed points follow
+// % <start_freq>,<stop_freq>,<steps>,<RBW>,<start_time>,<end_time>,<changed points>[,calibrated]
+bool parse_delta_header(const string &line, logheader_t &h, size_t &changes)
+{
+	char start_time_str[32];
+	char end_time_str[32];
+	if(line[0] != '%')
+		return false;
+
+	int ret = sscanf(line.c_str(), "%% %lf,%lf,%zu,%f,%31[^,],%31[^,],%zu", &h.start_freq, &h.stop_freq, &h.steps, &h.rbw, start_time_str, end_time_str, &changes);
+	h.start_time = start_time_str;
+	h.end_time = end_time_str;
+	h.calibrated = marked_calibrated(line);
+
+	if(ret != 7)
+		return false;
+	if(changes > h.steps)
 	{
-		cerr << "Error: start_freq >= stop_freq" << endl;
+		cerr << "Error: changed points > steps" << endl;
 		return false;
 	}
-	if(h.steps == 0)
+
+	return check_header(h);
+}
+
+static float parse_power(const string &line, size_t real_line_count)
+{
+	float power = 0;
+	try
 	{
-		cerr << "Error: steps == 0" << endl;
-		return false;
+		power = std::stof(line);
 	}
-	if(h.rbw <= 0 || h.rbw > 1000)
+	catch(const std::exception& e)
 	{
-		cerr << "Error: rbw <= 0 || rbw > 1000" << endl;
-		return false;
+		cerr << format("std::stod exception: {}\n", e.what());
+		if_error(true, format("Error: failed to parse double from line {}: \"{}\"", real_line_count, line));
 	}
+	if(!isfinite(power))
+		if_error(true, format("Error: invalid power value at line #{}", real_line_count));
+	return power;
+}
 
-	return true;
+void logreader_init(logreader_t &reader)
+{
+	reader.first_header = {0, 0, 0, 0, "", "", false};
+	reader.h = reader.first_header;
+	reader.real_line_count = 0;
+	reader.bytes_read = 0;
+	reader.in_record = false;
+	reader.delta = false;
+	reader.remaining = 0;
+	reader.last_record.clear();
 }
 
-// parse log file
-void parse_logfile
+// read up to max_records complete records from stream & append them
+// returns number of records read, 0 means end of stream
+// deadband records are reconstructed from the previous record, so callers
+// always get full sweeps, even across calls
+size_t read_records
 (
+	logreader_t &reader,
+	istream &logfile_stream,
 	vector<float> &power_data,
 	vector<logheader_t> &headers,
-	istream &logfile_stream
+	size_t max_records
 )
 {
-	logheader_t h; // current header
-	logheader_t first_header
-	{
-		/* start freq */ 0,
-		/* stop freq */ 0,
-		/* steps */ 0,
-		/* rbw */ 0,
-		/* start_time */ "",
-		/* end_time */ ""
-	};
-
-	// for appending to vector<> headers
-	if(!headers.empty())
-	{
-		first_header = headers.front();
-	}
+	logheader_t &h = reader.h; // current header
+	const logheader_t &first_header = reader.first_header;
+	size_t &real_line_count = reader.real_line_count;
+	size_t &remaining = reader.remaining; // data lines left in current record
 
 	string line;
-	size_t in_record_line_count = 0;
-	size_t real_line_count = 0;
-	size_t lines_per_record = SIZE_MAX;
+	size_t records = 0;
+	const auto parse_start = PROBE_START(parse__records);
+	const size_t bytes_before = reader.bytes_read;
+	const size_t call_base = power_data.size();
+	size_t record_base = power_data.size(); // index of current record in power_data
 
-	if_error(!logfile_stream.good(), "Error: invalid logfile stream");
 	// types of lines:
-	// 	record header: # <start_freq>,<stop_freq>,<steps>,<RBW>,<start_time>,<end_time>
+	// 	record header: $ <start_freq>,<stop_freq>,<steps>,<RBW>,<start_time>,<end_time>
 	// 	data: <dbm>\n<dbm>\n<dbm>\n...
+	// 	deadband record header: % <start_freq>,<stop_freq>,<steps>,<RBW>,<start_time>,<end_time>,<changes>
+	// 	deadband data: <bin>,<dbm>\n<bin>,<dbm>\n...
 	// 	trailing newline of a record: \n
 	// any other line is invalid
 
 	if_error(logfile_stream.bad(), "Error: invalid logfile stream");
 
-	while(getline(logfile_stream, line))
+	while(records < max_records && getline(logfile_stream, line))
 	{
 		real_line_count++;
+		reader.bytes_read += line.size() + 1;
 		if(line[0] == '#')
 			continue; // comment line
 
-		in_record_line_count++;
-
 		// parse header
-		if(in_record_line_count % lines_per_record == 1)
+		if(!reader.in_record)
 		{
-			bool ret = parse_header(line, h);
+			size_t changes = 0;
+			reader.delta = line[0] == '%';
+			bool ret = reader.delta ? parse_delta_header(line, h, changes) : parse_header(line, h);
 			if_error(!ret, format("Error: invalid header at line #{}", real_line_count));
 
 			if(first_header.steps == 0)
 			{
-				lines_per_record = h.steps + 2; // +1 for header, +1 for trailing newline
-				first_header = h;
+				reader.first_header = h;
 			}
 			else
 			{
@@ -150,38 +232,135 @@ void parse_logfile
 						real_line_count, h.rbw, first_header.rbw));
 			}
 
+			record_base = power_data.size();
+			if(reader.delta)
+			{
+				// start from a copy of previous record, which may be from a previous call
+				power_data.resize(record_base + h.steps);
+				if(record_base >= call_base + h.steps)
+				{
+					std::copy(&power_data[record_base - h.steps], &power_data[record_base], &power_data[record_base]);
+				}
+				else
+				{
+					if_error(reader.last_record.size() != h.steps,
+						format("Error: deadband record without preceding record at line #{}", real_line_count));
+					std::copy(reader.last_record.begin(), reader.last_record.end(), &power_data[record_base]);
+				}
+				remaining = changes;
+			}
+			else
+			{
+				remaining = h.steps;
+			}
+
 			headers.emplace_back(h);
+			reader.in_record = true;
 		}
-		else if(in_record_line_count % lines_per_record == 0)
+		else if(remaining == 0)
 		{
 			// trailing newline of a record
 			if_error(!line.empty(), format("Error: newline expected at line #{}", real_line_count));
-			in_record_line_count = 0;
+			reader.in_record = false;
+			continue;
+		}
+		else if(reader.delta)
+		{
+			// changed point
+			const auto comma = line.find(',');
+			if_error(comma == string::npos, format("Error: invalid deadband point at line #{}", real_line_count));
+			char *end = nullptr;
+			const size_t bin = strtoull(line.c_str(), &end, 10);
+			if_error(end != line.c_str() + comma || bin >= h.steps,
+				format("Error: invalid bin index at line #{}", real_line_count));
+			power_data[record_base + bin] = parse_power(line.substr(comma + 1), real_line_count);
+			remaining--;
 		}
 		else
 		{
-			float power = 0;
 			// data line
-			try
-			{
-				power = std::stof(line);
-			}
-			catch(const std::exception& e)
-			{
-				cerr << format("std::stod exception: {}\n", e.what());
-				if_error(true, format("Error: failed to parse double from line {}: \"{}\"", real_line_count, line));
-			}
-			if(!isfinite(power))
-				if_error(true, format("Error: invalid power value at line #{}", real_line_count));
-			power_data.emplace_back(power);
+			power_data.emplace_back(parse_power(line, real_line_count));
+			remaining--;
 		}
+
+		if(remaining == 0)
+			records++; // record complete, trailing newline is consumed by next call
+	}
+
+	// remember last record for deadband records in next call
+	if(records > 0)
+		reader.last_record.assign(power_data.end() - h.steps, power_data.end());
+
+	// stream ended in the middle of a record
+	if(records < max_records)
+		if_error(reader.in_record && remaining != 0, "Error: power_data count is not correct");
+
+	PROBE3(parse__records, records, reader.bytes_read - bytes_before, probe_elapsed_ns(parse_start));
+	return records;
+}
+
+// parse whole log file, returns bytes read
+size_t parse_logfile
+(
+	vector<float> &power_data,
+	vector<logheader_t> &headers,
+	istream &logfile_stream
+)
+{
+	logreader_t reader;
+	logreader_init(reader);
+
+	// for appending to vector<> headers
+	if(!headers.empty())
+	{
+		reader.first_header = headers.front();
+		if(power_data.size() >= reader.first_header.steps)
+			reader.last_record.assign(power_data.end() - reader.first_header.steps, power_data.end());
 	}
 
+	if_error(!logfile_stream.good(), "Error: invalid logfile stream");
+
+	read_records(reader, logfile_stream, power_data, headers, SIZE_MAX);
+
 	if_error(headers.size() == 0, "Error: no valid record found in log file");
 
 	// check if size of power_data is correct
-	if(power_data.size() != headers.size() * first_header.steps)
+	if(power_data.size() != headers.size() * reader.first_header.steps)
 		if_error(true, "Error: power_data count is not correct");
+
+	return reader.bytes_read;
+}
+
+// read records one at a time into the same buffer & hand them to callback,
+// so memory usage only depends on steps, not on length of the log
+// returns number of records passed to callback
+size_t stream_records
+(
+	logreader_t &reader,
+	istream &logfile_stream,
+	const recordcallback_t &callback
+)
+{
+	vector<float> samples;
+	vector<logheader_t> headers;
+	size_t records = 0;
+
+	if_error(!logfile_stream.good(), "Error: invalid logfile stream");
+
+	while(true)
+	{
+		// capacity is kept, so buffers are only allocated for the first record
+		samples.clear();
+		headers.clear();
+		if(read_records(reader, logfile_stream, samples, headers, 1) == 0)
+			break;
+
+		records++;
+		if(!callback(headers.front(), samples.data()))
+			break;
+	}
+
+	return records;
 }
 
 // check for time consistency of log file
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -12,6 +14,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <thread>
+#include <functional>
 #include <omp.h>
 
 #include <fmt/core.h>
@@ -51,8 +54,12 @@ typedef struct
 	float rbw;
 	string start_time;
 	string end_time;
+	bool calibrated; // levels were corrected by spsave -L, header ends with LOG_CALIBRATED_FIELD
 } logheader_t;
 
+// readers that don't know it ignore a field past the last one they parse
+constexpr static char LOG_CALIBRATED_FIELD[] = ",calibrated";
+
 // log problems
 typedef struct
 {
@@ -81,13 +88,74 @@ static void inline if_error(bool condition, const string &message)
 	}
 }
 
+// raw binary I/O for caches & state files, native endianness
+template <typename T>
+static void inline write_pod(fstream &f, const T &value)
+{
+	f.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static void inline read_pod(fstream &f, T &value)
+{
+	f.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static void inline write_array(fstream &f, const vector<T> &v)
+{
+	f.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+template <typename T>
+static void inline read_array(fstream &f, vector<T> &v, size_t size)
+{
+	v.resize(size);
+	f.read(reinterpret_cast<char *>(v.data()), v.size() * sizeof(T));
+}
+
 const time_point<system_clock> now(void);
 const string time_str(void);
+const string time_str(const time_point<system_clock> &time);
 const time_point<system_clock> time_from_str(const string &str);
+// UNIX seconds of a log timestamp
+int64_t epoch_seconds(const string &str);
+// MHz, bins are spread evenly from start_freq to stop_freq
+double bin_frequency(const logheader_t &h, size_t bin);
 bool parse_header(const string &line, logheader_t &h);
-void parse_logfile(
+bool parse_delta_header(const string &line, logheader_t &h, size_t &changes);
+// incremental log reader state
+typedef struct
+{
+	logheader_t first_header; // all records must match its frequency plan
+	logheader_t h; // header of current record
+	size_t real_line_count;
+	size_t bytes_read;
+	bool in_record;
+	bool delta; // current record is a deadband record
+	size_t remaining; // data lines left in current record
+	vector<float> last_record; // for deadband records
+} logreader_t;
+
+void logreader_init(logreader_t &reader);
+size_t read_records(
+	logreader_t &reader,
+	istream &logfile_stream,
+	vector<float> &power_data,
+	vector<logheader_t> &headers,
+	size_t max_records
+);
+size_t parse_logfile(
 	vector<float> &power_data,
 	vector<logheader_t> &headers,
 	istream &logfile_stream
 );
+// called with every full record, both are only valid during the call
+// return false to stop reading
+typedef std::function<bool(const logheader_t &h, const float *samples)> recordcallback_t;
+size_t stream_records(
+	logreader_t &reader,
+	istream &logfile_stream,
+	const recordcallback_t &callback
+);
 bool check_logfile_time_consistency(const vector<logheader_t> &headers, logproblem_t &problems);
@@ -8,6 +8,10 @@ constexpr static int ZERO_LEVEL_ULTRA =	174;
 
 /* options used by log2png: */
 
+// dBm range mapped onto the colormap
+constexpr static float SPECTROGRAM_MIN_DBM = -120;
+constexpr static float SPECTROGRAM_MAX_DBM = -20;
+
 // Font for info text
 // Too long, can't be constexpr
 const static string FONT_FAMILY{"Iosevka Term"};
@@ -18,7 +22,149 @@ constexpr static int FOOTER_HEIGHT = 24;
 const static string BANNER_COLOR{"white"};
 const static string FOOTER_COLOR{"yellow"};
 
+// glyph atlases of font are cached in $XDG_CACHE_HOME/<this> or ~/.cache/<this>
+const static string GLYPH_CACHE_DIR{"spsaver"};
+
 #define PX_TO_PT(x)	((double)(x) * 72 / 96)
 
 // Minimum number of gridlines to draw
 constexpr static int MIN_GRIDLINES = 6;
+// "grey" at 75% opacity
+constexpr static float GRIDLINE_GREY = 190;
+constexpr static float GRIDLINE_ALPHA = 0.75;
+
+/* options used by time-of-day folding (log2png -F): */
+
+// Histogram used for percentile reduction, 1dB per bin from FOLD_HIST_MIN_DBM
+// Values outside of the range are clamped into the first / last bin
+// Percentiles are interpolated within a bin, so they're only as accurate as values are evenly spread in it
+constexpr static int FOLD_HIST_MIN_DBM = -150;
+constexpr static int FOLD_HIST_BINS = 160;
+// 4 bytes per cell & bin, every thread folding a file holds one histogram besides the merged one
+// percentile folds needing more than this in all are refused instead of running out of memory
+constexpr static size_t FOLD_HIST_MAX_MIB = 2048;
+
+/* options used by rolling per-bin baseline (spsave -b, log2png -B/-z): */
+
+// weight of newest sweep in exponentially weighted mean & variance
+constexpr static float BASELINE_DEFAULT_ALPHA = 0.01;
+// variance floor in dB^2, keeps quiet bins from producing huge z-scores
+constexpr static float BASELINE_MIN_VARIANCE = 0.25;
+// spsave -b rewrites its baseline file every this many sweeps & on exit, not after every sweep
+constexpr static size_t BASELINE_SAVE_SWEEPS = 60;
+// |z| below threshold isn't an anomaly, z is coloured in [-ZSCORE_RANGE, ZSCORE_RANGE]
+constexpr static float ZSCORE_DEFAULT_THRESHOLD = 3;
+constexpr static float ZSCORE_RANGE = 10;
+
+/* options used by threshold alerts (spsave -M / -A): */
+
+// an active alert clears once every bin is this far below its limit
+constexpr static float ALERT_DEFAULT_HYSTERESIS = 3;
+// events waiting for delivery, newer events are dropped when it's full
+constexpr static size_t ALERT_QUEUE_SIZE = 256;
+
+/* options used by tty & log I/O of spsave: */
+
+// SQEs in io_uring (spsave -U), a sweep needs 3 at most
+constexpr static unsigned SWEEPIO_RING_ENTRIES = 16;
+// bytes per tty read & registered buffer for log records, bigger records are written unregistered
+constexpr static size_t SWEEPIO_READ_SIZE = 64 * 1024;
+constexpr static size_t SWEEPIO_WRITE_SIZE = 256 * 1024;
+// log file space reserved ahead of writes (spsave -R / -x), at most this is left allocated if spsave is killed
+constexpr static size_t LOG_PREALLOC_CHUNK = 4 * 1024 * 1024;
+
+/* options used by live terminal waterfall (spsave -w): */
+
+// colours between SPECTROGRAM_MIN_DBM & SPECTROGRAM_MAX_DBM
+constexpr static size_t WATERFALL_LEVELS = 64;
+// "HH:MM:SS " in front of every line
+constexpr static size_t WATERFALL_LABEL_WIDTH = 9;
+// when terminal size can't be found
+constexpr static size_t WATERFALL_DEFAULT_COLUMNS = 80;
+
+/* options used by noise floor subtraction (log2png -n): */
+
+// sliding histogram per bin, values outside are clamped into first / last bin
+constexpr static float NOISEFLOOR_HIST_MIN_DBM = -150;
+constexpr static float NOISEFLOOR_HIST_STEP = 0.5;
+constexpr static int NOISEFLOOR_HIST_BINS = 320;
+constexpr static float NOISEFLOOR_DEFAULT_PERCENTILE = 10;
+// dB above noise floor mapped onto the colormap
+constexpr static float NOISEFLOOR_DISPLAY_MIN = 0;
+constexpr static float NOISEFLOOR_DISPLAY_MAX = 50;
+// bins processed together by one thread, keeps reads of each record contiguous
+constexpr static size_t FILTER_BIN_BLOCK = 64;
+
+/* options used by despeckle filter (log2png -D / -H): */
+
+// rows of output processed together by one thread
+constexpr static size_t DESPECKLE_BAND_ROWS = 16;
+// Hampel: replace by median only if |x - median| > k * 1.4826 * MAD
+constexpr static float HAMPEL_DEFAULT_K = 3;
+
+/* options used by pipelined rendering (log2png): */
+
+// records parsed, coloured & encoded as one unit
+constexpr static size_t PIPELINE_CHUNK_RECORDS = 128;
+// chunks waiting between two stages, bounds memory usage
+constexpr static size_t PIPELINE_QUEUE_DEPTH = 4;
+// points coloured together by one thread
+constexpr static size_t COLOUR_BLOCK_POINTS = 4096;
+// colormap is sampled this finely once, points are coloured by lookup
+constexpr static size_t COLOUR_LUT_LEVELS = 4096;
+// zlib level used by PNG writer
+constexpr static int PNG_COMPRESSION_LEVEL = 6;
+constexpr static size_t PNG_IDAT_SIZE = 256 * 1024;
+
+/* options used by multi-band mosaic (log2png -m): */
+
+// black pixels between panels
+constexpr static size_t MOSAIC_GAP = 8;
+// frequency label above every panel
+constexpr static int MOSAIC_LABEL_HEIGHT = 24;
+const static string MOSAIC_LABEL_COLOR{"cyan"};
+// rows of common time grid, guards against bands logged months apart
+constexpr static size_t MOSAIC_MAX_ROWS = 1 << 20;
+
+/* options used by waterfall video (log2png -V): */
+
+// records in one frame & records a frame advances by
+constexpr static size_t VIDEO_DEFAULT_WINDOW = 480;
+constexpr static size_t VIDEO_DEFAULT_STEP = 4;
+constexpr static int VIDEO_FPS = 30;
+
+/* options used by logfeatures: */
+
+// noise floor is this percentile of bins in a sweep
+constexpr static float FEATURE_FLOOR_PERCENTILE = 10;
+// a bin is occupied this far above noise floor
+constexpr static float FEATURE_OCCUPIED_DB = 10;
+// histogram for noise floor & occupied bins, at the log's 0.1dB resolution, values outside are clamped
+constexpr static float FEATURE_HIST_MIN_DBM = -150;
+constexpr static float FEATURE_HIST_STEP = 0.1;
+constexpr static int FEATURE_HIST_BINS = 1800;
+// points summed & binned at a time, block of bin indices stays in L1
+constexpr static size_t FEATURE_BLOCK_POINTS = 256;
+// records parsed & described at a time
+constexpr static size_t FEATURE_CHUNK_RECORDS = 1024;
+
+/* options used by logexport: */
+
+// records read & written as one .npy append / Arrow record batch, bounds memory usage
+constexpr static size_t EXPORT_BATCH_RECORDS = 1024;
+
+/* options used by log2patches: */
+
+constexpr static uint32_t PATCH_DEFAULT_SIZE = 64;
+// dB per step of int16 values, logs have 0.1dB resolution, so it's lossless
+constexpr static float PATCH_SCALE_DB = 0.01;
+constexpr static size_t PATCH_SHARD_PATCHES = 4096;
+// records read from a log at once
+constexpr static size_t PATCH_CHUNK_RECORDS = 256;
+// blocks of patches waiting for writer, bounds memory usage
+constexpr static size_t PATCH_QUEUE_DEPTH = 8;
+
+/* options used by Chrome trace output (spsave & log2png -T): */
+
+// events kept per thread, later events are dropped when it's full
+constexpr static size_t TRACE_BUFFER_EVENTS = 65536;
@@ -0,0 +1,32 @@
+/*
+ *   cpu - report which SIMD kernel clones are in use
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cpu.hpp"
+
+// same order of preference as the resolvers generated for SIMD_CLONES
+const char *simd_path(void)
+{
+#ifdef HAVE_SIMD_CLONES
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("x86-64-v4"))
+		return "x86-64-v4";
+	if(__builtin_cpu_supports("x86-64-v3"))
+		return "x86-64-v3";
+#endif
+	return "default";
+}
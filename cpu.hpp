@@ -0,0 +1,20 @@
+#pragma once
+
+/* cpu.hpp: hot kernels built for several x86-64 ISA levels, picked by CPUID at load time */
+
+// a kernel marked SIMD_CLONES is compiled once per level, and an ifunc resolver
+// binds the best clone for the running CPU before main(), so calls cost nothing extra
+// without compiler / loader support or with -DNO_SIMD_CLONES only "default" is built
+#if defined(__x86_64__) && defined(__has_attribute) && !defined(NO_SIMD_CLONES)
+#if __has_attribute(target_clones)
+#define SIMD_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#define HAVE_SIMD_CLONES 1
+#endif
+#endif
+
+#ifndef SIMD_CLONES
+#define SIMD_CLONES
+#endif
+
+// clone picked by the resolvers, "x86-64-v4" (AVX-512), "x86-64-v3" (AVX2 & FMA) or "default"
+const char *simd_path(void);
@@ -0,0 +1,184 @@
+/*
+ *   features - per-sweep descriptors for long-term trending
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "features.hpp"
+#include "cpu.hpp"
+#include <cstring>
+
+static inline int32_t float_bits(float x)
+{
+	int32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits;
+}
+
+static inline float bits_float(int32_t bits)
+{
+	float x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+// integer that orders like the float, negative floats have their other bits flipped
+// float min / max branch on NaN, which keeps -O2 from vectorizing a loop, integer ones don't
+static inline int32_t ordered_bits(float x)
+{
+	const int32_t bits = float_bits(x);
+	return bits ^ ((bits >> 31) & INT32_MAX);
+}
+
+static inline float ordered_float(int32_t ordered)
+{
+	return bits_float(ordered ^ ((ordered >> 31) & INT32_MAX));
+}
+
+// NaN goes to hi, or to lo with the sign bit set
+static inline float clamp_ordered(float x, float lo, float hi)
+{
+	return ordered_float(std::min(std::max(ordered_bits(x), ordered_bits(lo)), ordered_bits(hi)));
+}
+
+// 2^x, relative error below 2e-7 for x in [-126, 126], clamped outside
+// libm's exp*f() isn't vectorized without -ffast-math, this is
+static inline float fast_exp2(float x)
+{
+	x = clamp_ordered(x, -126.0f, 126.0f);
+	const int32_t i = static_cast<int32_t>(x + 126.0f) - 126; // x + 126 is positive, so truncation is floor
+	// exact, taking it from x + 126 would lose low bits
+	// slightly negative when x + 126 rounded up to the next integer, the polynomial is good there too
+	const float f = x - i;
+	// degree 5 minimax polynomial of 2^f on [0, 1], relative error 7.5e-8 before float rounding
+	const float p = 0.99999994f + f * (0.693153083f + f * (0.240153611f + f * (0.0558263175f + f * (0.00898933969f + f * 0.00187757669f))));
+	return bits_float((i + 127) << 23) * p; // 2^i * 2^f
+}
+
+constexpr static float DB_TO_LOG2 = 0.332192809f; // log2(10) / 10
+
+// sums in linear power, max & histogram bin of every point of a block, in one vectorized pass
+// fixed length, so -O2's cost model takes the loop without a scalar epilogue
+// NaN points are masked to 0 on the bits & go through the same float ops as the others,
+// a float op only some points run keeps the loop from vectorizing
+SIMD_CLONES
+static void block_sums(const float *record, size_t first, uint16_t *bins,
+	double &linear, double &weighted, double &db, float &max_power, size_t &valid)
+{
+	// a block is short enough to sum in float, the sweep's totals are kept in double
+	float l = 0, w = 0, d = 0;
+	int32_t m = INT32_MIN;
+	uint32_t v = 0;
+	#pragma omp simd reduction(+:l, w, d, v) reduction(max:m)
+	for(size_t i = 0; i < FEATURE_BLOCK_POINTS; i++)
+	{
+		const int32_t mask = -static_cast<int32_t>(isfinite(record[i]));
+		const float p = bits_float(float_bits(record[i]) & mask);
+		// in mW relative to -100dBm, so float doesn't lose small bins next to big ones
+		const float power = bits_float(float_bits(fast_exp2((p + 100) * DB_TO_LOG2)) & mask);
+		l += power;
+		w += power * static_cast<int32_t>(i); // offset of the block is added once below
+		d += p;
+		v -= mask;
+		// NaN points are below everything
+		m = std::max(m, (ordered_bits(p) & mask) | (~mask & INT32_MIN));
+		// nearest bin, NaN goes into the extra bin past the end
+		const int32_t bin = clamp_ordered((p - FEATURE_HIST_MIN_DBM) / FEATURE_HIST_STEP + 0.5f, 0.0f, FEATURE_HIST_BINS - 0.5f);
+		bins[i] = (bin & mask) | (~mask & FEATURE_HIST_BINS);
+	}
+	linear += l;
+	weighted += w + l * first;
+	db += d;
+	max_power = m == INT32_MIN ? -INFINITY : ordered_float(m);
+	valid += v;
+}
+
+// percentile by walking the histogram, interpolated within the bin like fold's percentile reduction
+static float histogram_percentile(const uint32_t *hist, size_t valid, float percentile)
+{
+	const double rank = std::max<double>(std::ceil(valid * percentile / 100), 1);
+	size_t below = 0;
+	int bin = 0;
+	for(; bin < FEATURE_HIST_BINS - 1; bin++)
+	{
+		if(below + hist[bin] >= rank)
+			break;
+		below += hist[bin];
+	}
+	const double within = hist[bin] == 0 ? 0.5 : (rank - below - 0.5) / hist[bin];
+	return FEATURE_HIST_MIN_DBM + (bin - 0.5 + std::clamp(within, 0.0, 1.0)) * FEATURE_HIST_STEP;
+}
+
+// points at or above threshold, bins hold the log's 0.1dB values so a hundredth of a step absorbs float error
+static uint32_t histogram_above(const uint32_t *hist, float threshold)
+{
+	const int first = std::ceil((threshold - FEATURE_HIST_MIN_DBM) / FEATURE_HIST_STEP - 0.01f);
+	uint32_t count = 0;
+	for(int bin = std::clamp(first, 0, FEATURE_HIST_BINS); bin < FEATURE_HIST_BINS; bin++)
+		count += hist[bin];
+	return count;
+}
+
+void sweep_features(const logheader_t &h, const float *record, sweepfeatures_t &f)
+{
+	const size_t steps = h.steps;
+	const double step_freq = steps > 1 ? (h.stop_freq - h.start_freq) / (steps - 1) : 0;
+
+	// one pass over the record, each block's bin indices are counted while they're still in L1
+	uint32_t hist[FEATURE_HIST_BINS + 1] = {}; // last one collects NaN points
+	uint16_t bins[FEATURE_BLOCK_POINTS];
+	float tail[FEATURE_BLOCK_POINTS];
+	double linear = 0, weighted = 0, db = 0;
+	size_t valid = 0, peak = 0;
+	f.max_power = -INFINITY;
+	for(size_t first = 0; first < steps; first += FEATURE_BLOCK_POINTS)
+	{
+		const size_t n = std::min(steps - first, FEATURE_BLOCK_POINTS);
+		const float *block = record + first;
+		// last block is padded with NaN, which is left out like any other NaN point
+		if(n < FEATURE_BLOCK_POINTS)
+		{
+			std::fill(std::copy(block, block + n, tail), tail + FEATURE_BLOCK_POINTS, NAN);
+			block = tail;
+		}
+		float block_max;
+		block_sums(block, first, bins, linear, weighted, db, block_max, valid);
+		// strictly greater, so peak is the first bin of max_power
+		if(block_max > f.max_power)
+		{
+			f.max_power = block_max;
+			peak = first + (std::find(block, block + n, block_max) - block);
+		}
+		for(size_t i = 0; i < n; i++)
+			hist[bins[i]]++;
+	}
+	if(valid == 0)
+	{
+		f.noise_floor = f.max_power = f.flatness = f.total_power = NAN;
+		f.peak_freq = f.centroid = NAN;
+		f.occupied = 0;
+		return;
+	}
+
+	f.peak_freq = h.start_freq + peak * step_freq;
+	f.noise_floor = histogram_percentile(hist, valid, FEATURE_FLOOR_PERCENTILE);
+	f.occupied = histogram_above(hist, f.noise_floor + FEATURE_OCCUPIED_DB);
+	f.total_power = 10 * std::log10(linear) - 100;
+	// geometric mean of linear power is mean of dB
+	f.flatness = linear > 0 ? std::pow(10.0, (db / valid + 100) / 10) / (linear / valid) : NAN;
+	f.centroid = linear > 0 ? h.start_freq + weighted / linear * step_freq : NAN;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common.hpp"
+
+/* features.hpp: compact per-sweep descriptors for long-term trending */
+
+typedef struct
+{
+	int64_t start_time; // UNIX seconds
+	float noise_floor; // dBm, FEATURE_FLOOR_PERCENTILE of bins
+	float max_power; // dBm
+	double peak_freq; // MHz, bin of max_power
+	float flatness; // geometric / arithmetic mean of linear power, 1 is white noise
+	double centroid; // MHz, power weighted mean frequency
+	uint32_t occupied; // bins FEATURE_OCCUPIED_DB or more above noise floor
+	float total_power; // dBm, sum of linear power of every bin
+} sweepfeatures_t;
+
+// NaN bins are left out, a sweep without any valid bin gets NaN features
+void sweep_features(const logheader_t &h, const float *record, sweepfeatures_t &f);
@@ -0,0 +1,302 @@
+/*
+ *   filter - filter stages between parsing & colour mapping
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "filter.hpp"
+#include "trace.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+
+static inline uint16_t noisefloor_bin(float power)
+{
+	const int bin = std::floor((power - NOISEFLOOR_HIST_MIN_DBM) / NOISEFLOOR_HIST_STEP);
+	return std::clamp(bin, 0, NOISEFLOOR_HIST_BINS - 1);
+}
+
+static inline float noisefloor_value(uint16_t bin)
+{
+	return NOISEFLOOR_HIST_MIN_DBM + (bin + 0.5f) * NOISEFLOOR_HIST_STEP;
+}
+
+void noisefloor_init(noisefloor_t &nf, size_t steps, size_t window, float percentile)
+{
+	if_error(window == 0 || window > UINT16_MAX, format("Error: noise floor window must be in 1 ~ {}", UINT16_MAX));
+	if_error(percentile < 0 || percentile > 100, "Error: noise floor percentile must be in 0 ~ 100");
+
+	nf.steps = steps;
+	nf.window = window;
+	nf.percentile = percentile;
+	nf.seen = 0;
+	nf.histogram.assign(steps * NOISEFLOOR_HIST_BINS, 0);
+	nf.ring.assign(window * steps, 0);
+	nf.cursor.assign(steps, 0);
+	nf.below.assign(steps, 0);
+}
+
+// subtract the running percentile from every point, in place
+// sliding window is kept as a histogram per bin, so adding & removing a record
+// is O(1), and the order statistic cursor only moves as far as the floor changes
+void noisefloor_subtract(noisefloor_t &nf, float *records, size_t record_count)
+{
+	const size_t steps = nf.steps;
+	const size_t window = nf.window;
+	const size_t blocks = (steps + FILTER_BIN_BLOCK - 1) / FILTER_BIN_BLOCK;
+
+	// bins are independent, every thread walks through time for its block of bins
+	#pragma omp parallel
+	{
+		trace_begin("noise floor");
+		#pragma omp for schedule(static) nowait
+		for(size_t block = 0; block < blocks; block++)
+		{
+			const size_t first = block * FILTER_BIN_BLOCK;
+			const size_t last = std::min(first + FILTER_BIN_BLOCK, steps);
+
+			for(size_t r = 0; r < record_count; r++)
+			{
+				const size_t t = nf.seen + r;
+				const size_t slot = t % window;
+				const size_t samples = std::min(t + 1, window);
+				const uint32_t rank = std::max(1.0, std::ceil(nf.percentile / 100.0 * samples));
+				float *record = records + r * steps;
+				uint16_t *ring = &nf.ring[slot * steps];
+
+				for(size_t i = first; i < last; i++)
+				{
+					uint16_t *histogram = &nf.histogram[i * NOISEFLOOR_HIST_BINS];
+					uint16_t &cursor = nf.cursor[i];
+					uint32_t &below = nf.below[i];
+
+					// oldest record leaves the window
+					if(t >= window)
+					{
+						const uint16_t old = ring[i];
+						histogram[old]--;
+						below -= old < cursor;
+					}
+
+					const uint16_t bin = noisefloor_bin(record[i]);
+					ring[i] = bin;
+					histogram[bin]++;
+					below += bin < cursor;
+
+					// move cursor to the bin holding the rank-th sample
+					while(below >= rank)
+					{
+						cursor--;
+						below -= histogram[cursor];
+					}
+					while(below + histogram[cursor] < rank)
+					{
+						below += histogram[cursor];
+						cursor++;
+					}
+
+					record[i] -= noisefloor_value(cursor);
+				}
+			}
+		}
+		trace_end("noise floor");
+	}
+
+	nf.seen += record_count;
+}
+
+// median selection networks by N. Devillard ("Fast median search: an ANSI C implementation"),
+// pairs of (a, b) to be ordered so that a <= b, median ends up in the middle
+constexpr static uint8_t MEDIAN9_NETWORK[][2] =
+{
+	{1, 2}, {4, 5}, {7, 8}, {0, 1}, {3, 4}, {6, 7}, {1, 2}, {4, 5}, {7, 8},
+	{0, 3}, {5, 8}, {4, 7}, {3, 6}, {1, 4}, {2, 5}, {4, 7}, {4, 2}, {6, 4},
+	{4, 2}
+};
+
+constexpr static uint8_t MEDIAN25_NETWORK[][2] =
+{
+	{0, 1}, {3, 4}, {2, 4}, {2, 3}, {6, 7}, {5, 7}, {5, 6}, {9, 10}, {8, 10},
+	{8, 9}, {12, 13}, {11, 13}, {11, 12}, {15, 16}, {14, 16}, {14, 15}, {18, 19}, {17, 19},
+	{17, 18}, {21, 22}, {20, 22}, {20, 21}, {23, 24}, {2, 5}, {3, 6}, {0, 6}, {0, 3},
+	{4, 7}, {1, 7}, {1, 4}, {11, 14}, {8, 14}, {8, 11}, {12, 15}, {9, 15}, {9, 12},
+	{13, 16}, {10, 16}, {10, 13}, {20, 23}, {17, 23}, {17, 20}, {21, 24}, {18, 24}, {18, 21},
+	{19, 22}, {8, 17}, {9, 18}, {0, 18}, {0, 9}, {10, 19}, {1, 19}, {1, 10}, {11, 20},
+	{2, 20}, {2, 11}, {12, 21}, {3, 21}, {3, 12}, {13, 22}, {4, 22}, {4, 13}, {14, 23},
+	{5, 23}, {5, 14}, {15, 24}, {6, 24}, {6, 15}, {7, 16}, {7, 19}, {13, 21}, {15, 23},
+	{7, 13}, {7, 15}, {1, 9}, {3, 11}, {5, 17}, {11, 17}, {9, 17}, {4, 10}, {6, 12},
+	{7, 14}, {4, 6}, {4, 7}, {12, 14}, {10, 14}, {6, 7}, {10, 12}, {6, 10}, {6, 17},
+	{12, 17}, {7, 17}, {7, 10}, {12, 18}, {7, 12}, {10, 18}, {12, 20}, {10, 20}, {10, 12}
+};
+
+void despeckle_init(despeckle_t &d, size_t steps, size_t size, bool hampel, float hampel_k)
+{
+	if_error(size != 3 && size != 5, "Error: despeckle filter size must be 3 or 5");
+	if_error(hampel && hampel_k <= 0, "Error: Hampel threshold must be positive");
+
+	d.steps = steps;
+	d.radius = size / 2;
+	d.hampel = hampel;
+	d.hampel_k = hampel_k;
+	d.history.clear();
+	d.history_first = 0;
+	d.input_rows = 0;
+	d.output_rows = 0;
+}
+
+// every compare-exchange works on a whole tile of bins at once, so it's
+// vectorized as plain min / max over contiguous floats
+// always inlined, so it's built for the ISA level of each despeckle_rows() clone
+template <size_t N, size_t OPS>
+__attribute__((always_inline)) static inline void median_network(float (*v)[FILTER_BIN_BLOCK], const uint8_t (&network)[OPS][2], size_t width)
+{
+	for(size_t op = 0; op < OPS; op++)
+	{
+		float *a = v[network[op][0]];
+		float *b = v[network[op][1]];
+		#pragma omp simd
+		for(size_t j = 0; j < width; j++)
+		{
+			const float lo = std::min(a[j], b[j]);
+			const float hi = std::max(a[j], b[j]);
+			a[j] = lo;
+			b[j] = hi;
+		}
+	}
+}
+
+template <size_t N, size_t OPS>
+__attribute__((always_inline)) static inline void despeckle_tile(
+	const despeckle_t &d,
+	const uint8_t (&network)[OPS][2],
+	size_t y, // record index of output row
+	size_t x0,
+	size_t width,
+	float *out
+)
+{
+	constexpr size_t K = N == 9 ? 3 : 5;
+	const ssize_t r = d.radius;
+	const size_t last_row = d.input_rows - 1;
+	const size_t steps = d.steps;
+	float v[N][FILTER_BIN_BLOCK];
+
+	// gather neighbourhood, borders are clamped
+	for(size_t dy = 0; dy < K; dy++)
+	{
+		const size_t row = std::clamp<ssize_t>((ssize_t)(y + dy) - r, 0, last_row);
+		const float *in = &d.history[(row - d.history_first) * steps];
+		for(size_t dx = 0; dx < K; dx++)
+		{
+			float *dst = v[dy * K + dx];
+			for(size_t j = 0; j < width; j++)
+			{
+				const size_t col = std::clamp<ssize_t>((ssize_t)(x0 + j + dx) - r, 0, steps - 1);
+				dst[j] = in[col];
+			}
+		}
+	}
+
+	median_network<N>(v, network, width);
+	const float *median = v[N / 2];
+
+	if(!d.hampel)
+	{
+		std::copy(median, median + width, out);
+		return;
+	}
+
+	// Hampel: median of absolute deviations from median, set is the same after sorting
+	const float *center = &d.history[(y - d.history_first) * steps + x0];
+	float m[FILTER_BIN_BLOCK];
+	std::copy(median, median + width, m);
+	for(size_t i = 0; i < N; i++)
+	{
+		#pragma omp simd
+		for(size_t j = 0; j < width; j++)
+			v[i][j] = std::fabs(v[i][j] - m[j]);
+	}
+	median_network<N>(v, network, width);
+
+	const float *mad = v[N / 2];
+	const float limit = d.hampel_k * 1.4826f;
+	#pragma omp simd
+	for(size_t j = 0; j < width; j++)
+		out[j] = std::fabs(center[j] - m[j]) > limit * mad[j] ? m[j] : center[j];
+}
+
+// rows [begin, end) of one tile, output rows start at out
+SIMD_CLONES
+static void despeckle_rows(const despeckle_t &d, size_t first, size_t begin, size_t end, size_t x0, size_t width, float *out)
+{
+	for(size_t i = begin; i < end; i++, out += d.steps)
+	{
+		if(d.radius == 1)
+			despeckle_tile<9>(d, MEDIAN9_NETWORK, first + i, x0, width, out);
+		else
+			despeckle_tile<25>(d, MEDIAN25_NETWORK, first + i, x0, width, out);
+	}
+}
+
+// append filtered rows to output, rows needing neighbours not seen yet are held back
+// unless flushing, only 2 * radius rows of history are kept between calls
+void despeckle_process(despeckle_t &d, const float *records, size_t record_count, vector<float> &output, bool flush)
+{
+	const size_t steps = d.steps;
+	d.history.insert(d.history.end(), records, records + record_count * steps);
+	d.input_rows += record_count;
+
+	size_t ready = d.input_rows;
+	if(!flush)
+		ready = d.input_rows > d.radius ? d.input_rows - d.radius : 0;
+	if(ready <= d.output_rows)
+		return;
+
+	const size_t first = d.output_rows;
+	const size_t rows = ready - first;
+	const size_t bands = (rows + DESPECKLE_BAND_ROWS - 1) / DESPECKLE_BAND_ROWS;
+	const size_t tiles = (steps + FILTER_BIN_BLOCK - 1) / FILTER_BIN_BLOCK;
+	const size_t output_base = output.size();
+	output.resize(output_base + rows * steps);
+
+	// small bands of rows x tiles of bins, so working set of each task stays in cache
+	#pragma omp parallel
+	{
+		trace_begin("despeckle");
+		#pragma omp for collapse(2) schedule(dynamic) nowait
+		for(size_t band = 0; band < bands; band++)
+		{
+			for(size_t tile = 0; tile < tiles; tile++)
+			{
+				const size_t x0 = tile * FILTER_BIN_BLOCK;
+				const size_t width = std::min(FILTER_BIN_BLOCK, steps - x0);
+				const size_t band_begin = band * DESPECKLE_BAND_ROWS;
+				const size_t band_end = std::min((band + 1) * DESPECKLE_BAND_ROWS, rows);
+				despeckle_rows(d, first, band_begin, band_end, x0, width, &output[output_base + band_begin * steps + x0]);
+			}
+		}
+		trace_end("despeckle");
+	}
+	d.output_rows = ready;
+
+	// drop rows that are no longer anyone's neighbour
+	const size_t keep_from = d.output_rows > d.radius ? d.output_rows - d.radius : 0;
+	if(keep_from > d.history_first)
+	{
+		d.history.erase(d.history.begin(), d.history.begin() + (keep_from - d.history_first) * steps);
+		d.history_first = keep_from;
+	}
+}
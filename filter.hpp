@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common.hpp"
+
+/* filter.hpp: filter stages between parsing & colour mapping */
+
+// running low percentile of each bin over a sliding window of records
+// works on chunks of records, so it can be fed incrementally
+typedef struct
+{
+	size_t steps;
+	size_t window; // records
+	float percentile; // 0 ~ 100
+	size_t seen; // records processed so far
+
+	// per bin: histogram of the window, ring of histogram bins to remove,
+	// and order statistic cursor (bin, number of samples below it)
+	vector<uint16_t> histogram; // [bin][NOISEFLOOR_HIST_BINS]
+	vector<uint16_t> ring; // [bin][window]
+	vector<uint16_t> cursor;
+	vector<uint32_t> below;
+} noisefloor_t;
+
+void noisefloor_init(noisefloor_t &nf, size_t steps, size_t window, float percentile);
+void noisefloor_subtract(noisefloor_t &nf, float *records, size_t record_count);
+
+// 3x3 or 5x5 median / Hampel filter over (record, bin) matrix
+// output lags input by radius rows, the rest comes out when flushed
+typedef struct
+{
+	size_t steps;
+	size_t radius; // 1 or 2
+	bool hampel; // false: plain median
+	float hampel_k;
+
+	// last input rows still needed as neighbours
+	vector<float> history;
+	size_t history_first; // record index of first row in history
+	size_t input_rows;
+	size_t output_rows;
+} despeckle_t;
+
+void despeckle_init(despeckle_t &d, size_t steps, size_t size, bool hampel, float hampel_k);
+void despeckle_process(despeckle_t &d, const float *records, size_t record_count, vector<float> &output, bool flush);
@@ -0,0 +1,429 @@
+/*
+ *   fold - fold spectrum logs onto a 24-hour time-of-day axis
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "fold.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+// cache file layout (native endianness, it's a cache, not an exchange format):
+//	magic, plan, bucket_seconds, buckets, files, records, has_histogram,
+//	sum[], count[], nonzero histogram entries count, (index, count)[]
+// histogram of a single day is very sparse, so only nonzero entries are stored
+constexpr static char FOLD_CACHE_MAGIC[8] = {'S', 'P', 'F', 'O', 'L', 'D', '1', '\0'};
+
+void fold_init(foldstate_t &fold, const logheader_t &h, size_t bucket_seconds, bool keep_histogram)
+{
+	if_error(bucket_seconds == 0 || SECONDS_PER_DAY % bucket_seconds != 0,
+		format("Error: time-of-day bucket ({}s) must be a factor of 24 hours", bucket_seconds));
+
+	fold.start_freq = h.start_freq;
+	fold.stop_freq = h.stop_freq;
+	fold.steps = h.steps;
+	fold.rbw = h.rbw;
+	fold.bucket_seconds = bucket_seconds;
+	fold.buckets = SECONDS_PER_DAY / bucket_seconds;
+	fold.files = 0;
+	fold.records = 0;
+	fold.bytes_read = 0;
+
+	const size_t cells = fold.buckets * fold.steps;
+	fold.sum.assign(cells, 0);
+	fold.count.assign(cells, 0);
+	fold.histogram.clear();
+	if(keep_histogram)
+	{
+		// called by every folding thread, outside of a parallel region there's just one
+		const size_t histograms = omp_get_num_threads() + 1;
+		const size_t mib = (cells * FOLD_HIST_BINS * sizeof(uint32_t)) >> 20;
+		if_error(histograms * mib > FOLD_HIST_MAX_MIB,
+			format("Error: percentile reduction of {} buckets x {} steps needs {}MiB of histograms, {}MiB for each folding thread & the merged one, over {}MiB, "
+				"use longer time-of-day buckets, fewer threads (OMP_NUM_THREADS) or mean", fold.buckets, fold.steps, histograms * mib, mib, FOLD_HIST_MAX_MIB));
+		fold.histogram.assign(cells * FOLD_HIST_BINS, 0);
+	}
+}
+
+static bool same_plan(const foldstate_t &fold, double start_freq, double stop_freq, size_t steps, float rbw)
+{
+	return fold.start_freq == start_freq && fold.stop_freq == stop_freq &&
+		fold.steps == steps && fold.rbw == rbw;
+}
+
+static inline size_t hist_bin(float power)
+{
+	const int bin = std::floor(power) - FOLD_HIST_MIN_DBM;
+	return std::clamp(bin, 0, FOLD_HIST_BINS - 1);
+}
+
+// add one record into the aggregate
+void fold_record(foldstate_t &fold, const logheader_t &h, const float *record)
+{
+	const size_t steps = fold.steps;
+	const bool keep_histogram = !fold.histogram.empty();
+
+	if_error(!same_plan(fold, h.start_freq, h.stop_freq, h.steps, h.rbw),
+		format("Error: record #{} has a different frequency plan, can't be folded", fold.records + 1));
+
+	const auto t = time_from_str(h.start_time).time_since_epoch();
+	const size_t time_of_day = duration_cast<seconds>(t).count() % SECONDS_PER_DAY;
+	const size_t cell = (time_of_day / fold.bucket_seconds) * steps;
+
+	double *sum = &fold.sum[cell];
+	uint32_t *count = &fold.count[cell];
+	for(size_t i = 0; i < steps; i++)
+	{
+		sum[i] += record[i];
+		count[i]++;
+	}
+
+	if(keep_histogram)
+	{
+		uint32_t *histogram = &fold.histogram[cell * FOLD_HIST_BINS];
+		for(size_t i = 0; i < steps; i++)
+			histogram[i * FOLD_HIST_BINS + hist_bin(record[i])]++;
+	}
+
+	fold.records++;
+}
+
+void fold_merge(foldstate_t &dst, const foldstate_t &src)
+{
+	if_error(!same_plan(dst, src.start_freq, src.stop_freq, src.steps, src.rbw),
+		"Error: can't merge folds with different frequency plans");
+	if_error(dst.bucket_seconds != src.bucket_seconds,
+		"Error: can't merge folds with different time-of-day buckets");
+	if_error(dst.histogram.size() != src.histogram.size(),
+		"Error: can't merge folds with and without histogram");
+
+	for(size_t i = 0; i < dst.sum.size(); i++)
+	{
+		dst.sum[i] += src.sum[i];
+		dst.count[i] += src.count[i];
+	}
+	for(size_t i = 0; i < dst.histogram.size(); i++)
+		dst.histogram[i] += src.histogram[i];
+
+	dst.files += src.files;
+	dst.records += src.records;
+	dst.bytes_read += src.bytes_read;
+}
+
+// reduce every cell into one value, cells without data become NaN
+void fold_reduce(const foldstate_t &fold, const foldreduce_t &reduce, vector<float> &output)
+{
+	const size_t cells = fold.buckets * fold.steps;
+	if_error(reduce.use_percentile && fold.histogram.empty(),
+		"Error: percentile reduction needs histogram");
+
+	output.resize(cells);
+
+	#pragma omp parallel
+	{
+		trace_begin("fold reduce");
+		#pragma omp for nowait
+		for(size_t c = 0; c < cells; c++)
+		{
+			const uint32_t count = fold.count[c];
+			if(count == 0)
+			{
+				output[c] = NAN;
+				continue;
+			}
+
+			if(!reduce.use_percentile)
+			{
+				output[c] = fold.sum[c] / count;
+				continue;
+			}
+
+			// walk the histogram until we reach the requested rank
+			const uint32_t *histogram = &fold.histogram[c * FOLD_HIST_BINS];
+			const double rank = std::max(1.0, std::ceil(reduce.percentile / 100 * count));
+			uint64_t below = 0;
+			int bin = 0;
+			for(; bin < FOLD_HIST_BINS - 1; bin++)
+			{
+				if(below + histogram[bin] >= rank)
+					break;
+				below += histogram[bin];
+			}
+			// values are taken as evenly spread over the 1dB bin, a lone value is its centre
+			const double within = histogram[bin] == 0 ? 0.5 : (rank - below - 0.5) / histogram[bin];
+			output[c] = FOLD_HIST_MIN_DBM + bin + std::clamp(within, 0.0, 1.0);
+		}
+		trace_end("fold reduce");
+	}
+}
+
+// "mean", "median" or "p<percentile>", ex. "p90"
+bool fold_parse_reduce(const string &str, foldreduce_t &reduce)
+{
+	if(str == "mean")
+	{
+		reduce = {false, 0};
+		return true;
+	}
+	if(str == "median")
+	{
+		reduce = {true, 50};
+		return true;
+	}
+	if(str.size() >= 2 && str[0] == 'p')
+	{
+		char *end = nullptr;
+		const double p = strtod(str.c_str() + 1, &end);
+		if(*end != '\0' || p < 0 || p > 100)
+			return false;
+		reduce = {true, p};
+		return true;
+	}
+	return false;
+}
+
+// returns false if cache doesn't exist, is damaged or was folded onto another grid
+// counts are checked against the file size before anything is allocated from them
+bool fold_load(foldstate_t &fold, const string &filename, size_t bucket_seconds)
+{
+	fstream f(filename, ios::in | ios::binary);
+	if(!f.is_open())
+		return false;
+
+	f.seekg(0, ios::end);
+	const uint64_t file_size = f.tellg();
+	f.seekg(0, ios::beg);
+
+	char magic[sizeof(FOLD_CACHE_MAGIC)];
+	f.read(magic, sizeof(magic));
+	if(!f.good() || std::memcmp(magic, FOLD_CACHE_MAGIC, sizeof(magic)) != 0)
+		return false;
+
+	uint8_t has_histogram = 0;
+	read_pod(f, fold.start_freq);
+	read_pod(f, fold.stop_freq);
+	read_pod(f, fold.steps);
+	read_pod(f, fold.rbw);
+	read_pod(f, fold.bucket_seconds);
+	read_pod(f, fold.buckets);
+	read_pod(f, fold.files);
+	read_pod(f, fold.records);
+	read_pod(f, has_histogram);
+	fold.bytes_read = 0;
+	if(!f.good() || fold.bucket_seconds != bucket_seconds || fold.buckets != SECONDS_PER_DAY / bucket_seconds)
+		return false;
+
+	// sum[] & count[] must fit in what's left, histogram entries must fill the rest exactly
+	constexpr uint64_t cell_bytes = sizeof(double) + sizeof(uint32_t);
+	constexpr uint64_t entry_bytes = sizeof(uint64_t) + sizeof(uint32_t);
+	const uint64_t remaining = file_size - f.tellg();
+	if(fold.steps == 0 || fold.steps > remaining / cell_bytes / fold.buckets)
+		return false;
+	const size_t cells = fold.buckets * fold.steps;
+	const uint64_t histogram_bytes = remaining - cells * cell_bytes;
+	if(has_histogram ? histogram_bytes < sizeof(uint64_t) : histogram_bytes != 0)
+		return false;
+
+	read_array(f, fold.sum, cells);
+	read_array(f, fold.count, cells);
+	fold.histogram.clear();
+	if(has_histogram)
+	{
+		uint64_t nonzero = 0;
+		read_pod(f, nonzero);
+		if(!f.good() || nonzero > cells * FOLD_HIST_BINS || nonzero * entry_bytes != histogram_bytes - sizeof(uint64_t))
+			return false;
+		fold.histogram.assign(cells * FOLD_HIST_BINS, 0);
+		for(uint64_t i = 0; i < nonzero && f.good(); i++)
+		{
+			uint64_t index = 0;
+			uint32_t count = 0;
+			read_pod(f, index);
+			read_pod(f, count);
+			if(index >= fold.histogram.size())
+				return false;
+			fold.histogram[index] = count;
+		}
+	}
+
+	return f.good();
+}
+
+void fold_save(const foldstate_t &fold, const string &filename)
+{
+	fstream f(filename, ios::out | ios::binary | ios::trunc);
+	if_error(!f.is_open(), "Error: cannot open fold cache " + filename);
+
+	f.write(FOLD_CACHE_MAGIC, sizeof(FOLD_CACHE_MAGIC));
+	write_pod(f, fold.start_freq);
+	write_pod(f, fold.stop_freq);
+	write_pod(f, fold.steps);
+	write_pod(f, fold.rbw);
+	write_pod(f, fold.bucket_seconds);
+	write_pod(f, fold.buckets);
+	write_pod(f, fold.files);
+	write_pod(f, fold.records);
+	write_pod(f, static_cast<uint8_t>(!fold.histogram.empty()));
+	write_array(f, fold.sum);
+	write_array(f, fold.count);
+	if(!fold.histogram.empty())
+	{
+		const uint64_t nonzero = fold.histogram.size() -
+			std::count(fold.histogram.begin(), fold.histogram.end(), 0);
+		write_pod(f, nonzero);
+		for(size_t i = 0; i < fold.histogram.size(); i++)
+		{
+			if(fold.histogram[i] == 0)
+				continue;
+			write_pod(f, static_cast<uint64_t>(i));
+			write_pod(f, fold.histogram[i]);
+		}
+	}
+
+	if_error(!f.good(), "Error: failed to write fold cache " + filename);
+}
+
+// cache is only trusted if it's newer than the log it was made from
+static bool cache_is_fresh(const string &logfile_name, const string &cache_name)
+{
+	struct stat log_st, cache_st;
+	if(stat(logfile_name.c_str(), &log_st) != 0 || stat(cache_name.c_str(), &cache_st) != 0)
+		return false;
+	return cache_st.st_mtime >= log_st.st_mtime;
+}
+
+static void fold_one_logfile(
+	foldstate_t &partial,
+	const string &logfile_name,
+	size_t bucket_seconds,
+	bool keep_histogram,
+	bool use_cache
+)
+{
+	const string cache_name = logfile_name + ".fold";
+	use_cache = use_cache && logfile_name != "-";
+
+	if(use_cache && cache_is_fresh(logfile_name, cache_name) && fold_load(partial, cache_name, bucket_seconds) &&
+		(!keep_histogram || !partial.histogram.empty()))
+	{
+		if(!keep_histogram)
+			partial.histogram.clear();
+		print("Folded {}: {} records (cached)\n", logfile_name, partial.records);
+		return;
+	}
+
+	// records are folded as they are read, so a log is never held in memory
+	logreader_t reader;
+	logreader_init(reader);
+	bool initialized = false;
+	auto fold_one = [&](const logheader_t &h, const float *record)
+	{
+		if(!initialized)
+		{
+			fold_init(partial, h, bucket_seconds, keep_histogram);
+			initialized = true;
+		}
+		fold_record(partial, h, record);
+		return true;
+	};
+	if(logfile_name == "-")
+	{
+		stream_records(reader, cin, fold_one);
+	}
+	else
+	{
+		fstream logfile_stream(logfile_name, ios::in);
+		if_error(!logfile_stream.is_open(), "Error: could not open file " + logfile_name);
+		stream_records(reader, logfile_stream, fold_one);
+	}
+
+	if_error(!initialized, "Error: no valid record found in log file");
+	partial.files++;
+	partial.bytes_read = reader.bytes_read;
+	print("Folded {}: {} records\n", logfile_name, partial.records);
+
+	if(use_cache)
+	{
+		try
+		{
+			fold_save(partial, cache_name);
+		}
+		catch(const StringException &e)
+		{
+			// not fatal, we just can't reuse it next time
+			cerr << "Warning: " << e.what() << endl;
+		}
+	}
+}
+
+void fold_logfiles(
+	foldstate_t &fold,
+	const vector<string> &logfile_names,
+	size_t bucket_seconds,
+	bool keep_histogram,
+	bool use_cache
+)
+{
+	bool initialized = false;
+	string error;
+
+	// every file is parsed into its own partial aggregate, then merged
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(size_t i = 0; i < logfile_names.size(); i++)
+	{
+		try
+		{
+			foldstate_t partial;
+			trace_begin("fold file");
+			fold_one_logfile(partial, logfile_names[i], bucket_seconds, keep_histogram, use_cache);
+			trace_end("fold file");
+
+			#pragma omp critical(fold_merge)
+			{
+				trace_begin("fold merge");
+				try
+				{
+					if(!initialized)
+					{
+						fold = std::move(partial);
+						initialized = true;
+					}
+					else
+					{
+						fold_merge(fold, partial);
+					}
+				}
+				catch(const std::exception &e)
+				{
+					error = format("{}: {}", logfile_names[i], e.what());
+				}
+				trace_end("fold merge");
+			}
+		}
+		catch(const std::exception &e)
+		{
+			// exceptions can't leave an OpenMP region
+			#pragma omp critical(fold_merge)
+			error = format("{}: {}", logfile_names[i], e.what());
+		}
+	}
+
+	if_error(!error.empty(), error);
+	if_error(!initialized, "Error: no log file to fold");
+}
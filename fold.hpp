@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.hpp"
+
+/* fold.hpp: fold records of many days onto a 24-hour time-of-day axis */
+
+constexpr static size_t SECONDS_PER_DAY = 24 * 60 * 60;
+
+// how each (time-of-day bucket, bin) cell is reduced
+typedef struct
+{
+	bool use_percentile; // false: mean
+	double percentile; // 0 ~ 100, only used if use_percentile
+} foldreduce_t;
+
+// Partial aggregate, can be merged with other partials of the same plan
+// all per-cell arrays are laid out as [bucket][bin]
+typedef struct
+{
+	// frequency plan, must be identical across all merged logs
+	double start_freq;
+	double stop_freq;
+	size_t steps;
+	float rbw;
+
+	size_t bucket_seconds;
+	size_t buckets;
+
+	size_t files;
+	size_t records;
+	size_t bytes_read; // log files parsed, cached ones are not counted
+
+	vector<double> sum;
+	vector<uint32_t> count;
+	// [bucket][bin][FOLD_HIST_BINS], empty if histogram isn't kept
+	vector<uint32_t> histogram;
+} foldstate_t;
+
+void fold_init(foldstate_t &fold, const logheader_t &h, size_t bucket_seconds, bool keep_histogram);
+void fold_record(foldstate_t &fold, const logheader_t &h, const float *record);
+void fold_merge(foldstate_t &dst, const foldstate_t &src);
+void fold_reduce(const foldstate_t &fold, const foldreduce_t &reduce, vector<float> &output);
+bool fold_parse_reduce(const string &str, foldreduce_t &reduce);
+
+// per-file partial aggregate cache
+bool fold_load(foldstate_t &fold, const string &filename, size_t bucket_seconds);
+void fold_save(const foldstate_t &fold, const string &filename);
+
+// fold a set of log files in parallel, optionally using per-file caches
+void fold_logfiles(
+	foldstate_t &fold,
+	const vector<string> &logfile_names,
+	size_t bucket_seconds,
+	bool keep_histogram,
+	bool use_cache
+);
@@ -0,0 +1,225 @@
+/*
+ *   glyphs - glyph atlas for drawing text without ImageMagick in the loop
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "glyphs.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <Magick++.h>
+
+// cache file layout (native endianness, it's a cache, not an exchange format):
+//	magic, px, glyph count, (advance, width, coverage[width * px])[]
+constexpr static char GLYPH_CACHE_MAGIC[8] = {'S', 'P', 'G', 'L', 'Y', 'P', 'H', '1'};
+
+// "$XDG_CACHE_HOME/spsaver" or "$HOME/.cache/spsaver", empty if there's nowhere to cache
+static string cache_dir()
+{
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	string dir;
+	if(xdg != nullptr && xdg[0] != '\0')
+		dir = xdg;
+	else if(home != nullptr && home[0] != '\0')
+		dir = string(home) + "/.cache";
+	else
+		return "";
+
+	mkdir(dir.c_str(), 0755);
+	dir += "/" + string(GLYPH_CACHE_DIR);
+	mkdir(dir.c_str(), 0755);
+	struct stat st;
+	return stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) ? dir : "";
+}
+
+static string cache_name(const string &dir, const string &font, int px)
+{
+	string name = font;
+	for(char &c : name)
+		if(!isalnum(static_cast<unsigned char>(c)))
+			c = '_';
+	return format("{}/{}.{}.glyphs", dir, name, px);
+}
+
+// returns false if cache doesn't exist or is damaged
+static bool atlas_load(glyphatlas_t &atlas, const string &filename)
+{
+	fstream f(filename, ios::in | ios::binary);
+	if(!f.is_open())
+		return false;
+
+	char magic[sizeof(GLYPH_CACHE_MAGIC)];
+	f.read(magic, sizeof(magic));
+	if(!f.good() || std::memcmp(magic, GLYPH_CACHE_MAGIC, sizeof(magic)) != 0)
+		return false;
+
+	int32_t px = 0;
+	uint32_t count = 0;
+	read_pod(f, px);
+	read_pod(f, count);
+	if(!f.good() || px != atlas.px || count != GLYPH_LAST - GLYPH_FIRST + 1)
+		return false;
+
+	atlas.glyphs.resize(count);
+	for(auto &glyph : atlas.glyphs)
+	{
+		read_pod(f, glyph.advance);
+		read_pod(f, glyph.width);
+		if(!f.good() || glyph.width > (uint32_t)px * 8)
+			return false;
+		read_array(f, glyph.coverage, (size_t)glyph.width * px);
+	}
+	return f.good();
+}
+
+// written under a temporary name, so another log2png never reads half a cache
+static void atlas_save(const glyphatlas_t &atlas, const string &filename)
+{
+	const string partial_name = format("{}.{}", filename, getpid());
+	{
+		fstream f(partial_name, ios::out | ios::binary | ios::trunc);
+		if(!f.is_open())
+			return; // it's only a cache
+		f.write(GLYPH_CACHE_MAGIC, sizeof(GLYPH_CACHE_MAGIC));
+		write_pod(f, static_cast<int32_t>(atlas.px));
+		write_pod(f, static_cast<uint32_t>(atlas.glyphs.size()));
+		for(const auto &glyph : atlas.glyphs)
+		{
+			write_pod(f, glyph.advance);
+			write_pod(f, glyph.width);
+			f.write(reinterpret_cast<const char *>(glyph.coverage.data()), glyph.coverage.size());
+		}
+		if(!f.good())
+		{
+			f.close();
+			unlink(partial_name.c_str());
+			return;
+		}
+	}
+	rename(partial_name.c_str(), filename.c_str());
+}
+
+// every glyph drawn alone in white on black, like text_rows() would draw it
+static void atlas_build(glyphatlas_t &atlas)
+{
+	using namespace Magick;
+	Image probe(Geometry(1, 1), Color("black"));
+	probe.textAntiAlias(true);
+	probe.fontFamily(atlas.font);
+	probe.fontPointsize(PX_TO_PT(atlas.px));
+	TypeMetric pair_metrics;
+	probe.fontTypeMetrics("xx", &pair_metrics);
+
+	atlas.glyphs.resize(GLYPH_LAST - GLYPH_FIRST + 1);
+	for(char c = GLYPH_FIRST; c <= GLYPH_LAST; c++)
+	{
+		glyph_t &glyph = atlas.glyphs[c - GLYPH_FIRST];
+		// between two other glyphs, so width of space & side bearings are counted
+		TypeMetric metrics;
+		probe.fontTypeMetrics(string("x") + c + "x", &metrics);
+		glyph.advance = std::max(metrics.textWidth() - pair_metrics.textWidth(), 0.0);
+		// room for italics & wide glyphs overhanging their advance
+		glyph.width = std::ceil(glyph.advance) + atlas.px / 4 + 1;
+
+		Image cell(Geometry(glyph.width, atlas.px), Color("black"));
+		cell.type(TrueColorType);
+		cell.depth(8);
+		cell.textAntiAlias(true);
+		cell.fontFamily(atlas.font);
+		cell.fontPointsize(PX_TO_PT(atlas.px));
+		cell.fillColor(Color("white"));
+		if(c != ' ')
+			cell.annotate(string(1, c), Geometry(0, 0, 0, 0), NorthWestGravity);
+		glyph.coverage.resize((size_t)glyph.width * atlas.px);
+		cell.write(0, 0, glyph.width, atlas.px, "R", CharPixel, glyph.coverage.data());
+	}
+}
+
+const glyphatlas_t &glyph_atlas(const string &font, int px)
+{
+	static std::mutex lock;
+	static std::map<std::pair<string, int>, std::unique_ptr<glyphatlas_t>> atlases;
+
+	std::lock_guard<std::mutex> guard(lock);
+	auto &atlas = atlases[{font, px}];
+	if(atlas)
+		return *atlas;
+
+	atlas = std::make_unique<glyphatlas_t>();
+	atlas->font = font;
+	atlas->px = px;
+	const string dir = cache_dir();
+	const string filename = dir.empty() ? "" : cache_name(dir, font, px);
+	if(!filename.empty() && atlas_load(*atlas, filename))
+		return *atlas;
+
+	trace_begin("glyph atlas");
+	atlas_build(*atlas);
+	trace_end("glyph atlas");
+	print("Built glyph atlas: {} {}px\n", font, px);
+	if(!filename.empty())
+		atlas_save(*atlas, filename);
+	return *atlas;
+}
+
+bool glyphs_cover(const string &text)
+{
+	return std::all_of(text.begin(), text.end(), [](char c) { return c >= GLYPH_FIRST && c <= GLYPH_LAST; });
+}
+
+double text_width(const glyphatlas_t &atlas, const string &text)
+{
+	double width = 0;
+	for(const char c : text)
+		width += atlas.glyphs[c - GLYPH_FIRST].advance;
+	return width;
+}
+
+void draw_glyphs(const glyphatlas_t &atlas, const string &text, const uint8_t (&colour)[3],
+	double x, long y, uint8_t *rgb, size_t width, size_t height)
+{
+	const long first_row = std::max(y, 0L);
+	const long last_row = std::min(y + atlas.px, (long)height);
+	for(const char c : text)
+	{
+		const glyph_t &glyph = atlas.glyphs[c - GLYPH_FIRST];
+		const long left = std::lrint(x);
+		x += glyph.advance;
+		const long first_column = std::max(left, 0L);
+		const long last_column = std::min(left + (long)glyph.width, (long)width);
+		for(long row = first_row; row < last_row; row++)
+		{
+			const uint8_t *coverage = &glyph.coverage[(row - y) * glyph.width - left];
+			uint8_t *out = &rgb[(row * width) * 3];
+			for(long column = first_column; column < last_column; column++)
+			{
+				const unsigned a = coverage[column];
+				if(a == 0)
+					continue;
+				for(size_t i = 0; i < 3; i++)
+					out[column * 3 + i] = (out[column * 3 + i] * (255 - a) + colour[i] * a + 127) / 255;
+			}
+		}
+	}
+}
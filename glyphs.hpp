@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.hpp"
+
+/* glyphs.hpp: pre-rasterized glyph atlas, text is composited straight into RGB rows */
+
+// printable ASCII, anything else falls back to drawing text through ImageMagick
+constexpr static char GLYPH_FIRST = ' ';
+constexpr static char GLYPH_LAST = '~';
+
+typedef struct
+{
+	float advance; // pen moves by this many pixels, may be fractional
+	uint32_t width; // of coverage bitmap, wider than advance, glyphs may overhang into next one
+	vector<uint8_t> coverage; // width x px, 255 is fully covered
+} glyph_t;
+
+typedef struct
+{
+	string font;
+	int px; // height of every glyph bitmap
+	vector<glyph_t> glyphs; // GLYPH_FIRST ~ GLYPH_LAST
+} glyphatlas_t;
+
+// built once per font & size, then cached in memory & in GLYPH_CACHE_DIR
+// safe to call from any thread
+const glyphatlas_t &glyph_atlas(const string &font, int px);
+bool glyphs_cover(const string &text);
+double text_width(const glyphatlas_t &atlas, const string &text);
+// blend text in colour over width x height 8-bit RGB, pen starts at (x, y) = top left, clipped to buffer
+void draw_glyphs(const glyphatlas_t &atlas, const string &text, const uint8_t (&colour)[3],
+	double x, long y, uint8_t *rgb, size_t width, size_t height);
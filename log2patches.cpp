@@ -0,0 +1,154 @@
+/*
+ *   log2patches - cut log files into a sharded dataset of spectrogram patches
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "patches.hpp"
+#include <getopt.h>
+
+static vector<string> logfile_names;
+static string output_prefix = "sp";
+static patchplan_t plan = {PATCH_DEFAULT_SIZE, PATCH_DEFAULT_SIZE, PATCH_DEFAULT_SIZE / 2, PATCH_DEFAULT_SIZE / 2};
+static size_t shard_patches = PATCH_SHARD_PATCHES;
+
+// "<a>x<b>"
+static bool parse_pair(const char *str, uint32_t &a, uint32_t &b)
+{
+	return sscanf(str, "%ux%u", &a, &b) == 2 && a > 0 && b > 0;
+}
+
+bool parse_args(int argc, char *argv[])
+{
+	int opt;
+	bool stride_given = false;
+	while((opt = getopt(argc, argv, "f:p:s:o:n:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'f':
+				logfile_names.emplace_back(optarg);
+				break;
+			case 'p':
+				output_prefix = optarg;
+				break;
+			case 's':
+				if_error(!parse_pair(optarg, plan.height, plan.width), "Error: invalid patch size for -s");
+				break;
+			case 'o':
+				if_error(!parse_pair(optarg, plan.time_stride, plan.bin_stride), "Error: invalid patch stride for -o");
+				stride_given = true;
+				break;
+			case 'n':
+				shard_patches = atoll(optarg);
+				if_error(shard_patches == 0, "Error: invalid patches per shard for -n");
+				break;
+			case 'h':
+			default:
+				cerr << "Usage: " << argv[0] <<
+					" [-f <log file>] [-p <output prefix>] [-s <records>x<bins>] [-o <records>x<bins>] [-n <patches per shard>] [more log files...]\n"
+					"\t-s patch size (default: " << PATCH_DEFAULT_SIZE << "x" << PATCH_DEFAULT_SIZE << "),\n"
+					"\t-o stride between patches (default: half of patch size, so patches overlap by half)\n"
+					"\twrites <prefix>.<shard>.patches of int16 dB / " << PATCH_SCALE_DB << " and <prefix>.index" << endl;
+				return false;
+		}
+	}
+
+	for(int i = optind; i < argc; i++)
+		logfile_names.emplace_back(argv[i]);
+
+	if_error(logfile_names.empty(), "Error: no log file specified (-f).");
+	if(!stride_given)
+	{
+		plan.time_stride = std::max<uint32_t>(plan.height / 2, 1);
+		plan.bin_stride = std::max<uint32_t>(plan.width / 2, 1);
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+try
+{
+	if(parse_args(argc, argv) == false)
+		return EXIT_FAILURE;
+
+	const auto start_time = now();
+	BoundedQueue<patchblock_t> queue(PATCH_QUEUE_DEPTH);
+	patchwriter_t writer;
+	patch_writer_begin(writer, output_prefix, plan, shard_patches, logfile_names);
+
+	// first error wins, and stops everyone
+	std::mutex error_lock;
+	string error;
+	auto fail = [&](const string &message)
+	{
+		std::lock_guard<std::mutex> guard(error_lock);
+		if(error.empty())
+			error = message;
+		queue.abort();
+	};
+
+	// one writer, so shards fill up one after another
+	std::thread writer_thread([&]
+	{
+		try
+		{
+			patchblock_t block;
+			while(queue.pop(block))
+				patch_writer_add(writer, block);
+		}
+		catch(const std::exception &e)
+		{
+			fail(e.what());
+		}
+	});
+
+	// logs are cut in parallel, a single log is cut in parallel inside instead
+	#pragma omp parallel for schedule(dynamic, 1) if(logfile_names.size() > 1)
+	for(size_t i = 0; i < logfile_names.size(); i++)
+	{
+		try
+		{
+			if(patch_logfile(plan, logfile_names[i], i, queue))
+				print("Cut {}\n", logfile_names[i]);
+		}
+		catch(const std::exception &e)
+		{
+			// exceptions can't leave an OpenMP region
+			fail(format("{}: {}", logfile_names[i], e.what()));
+		}
+	}
+	queue.close();
+	writer_thread.join();
+
+	if_error(!error.empty(), error);
+	patch_writer_end(writer);
+
+	const double elapsed = std::chrono::duration<double>(now() - start_time).count();
+	print("Written {} patches of {}x{} in {} shards ({}.index), {:.3f} seconds\n",
+		writer.patches, plan.height, plan.width, writer.shards, output_prefix, elapsed);
+}
+catch(const StringException &e)
+{
+	cerr << e.what() << endl;
+	return EXIT_FAILURE;
+}
+
+	return EXIT_SUCCESS;
+}
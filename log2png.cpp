@@ -18,53 +18,36 @@
 
 #include "common.hpp"
 #include "config.hpp"
+#include "fold.hpp"
+#include "mosaic.hpp"
+#include "pyramid.hpp"
+#include "video.hpp"
+#include "glyphs.hpp"
+#include "baseline.hpp"
+#include "calibration.hpp"
+#include "filter.hpp"
+#include "pipeline.hpp"
+#include "png.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <getopt.h>
 #include <Magick++.h>
 #include <tinycolormap.hpp>
 
 using namespace Magick;
 using MagickCore::Quantum;
 
-void draw_spectrogram(
-	const size_t sp_width,
-	const size_t sp_height,
-	const size_t sp_xoffset,
-	const size_t sp_yoffset,
-	vector<float> &power_data,
-	Image &image
-)
+// value range mapped onto colormap, values outside are clamped
+typedef struct
 {
-	Quantum *pixels = image.getPixels(sp_xoffset, sp_yoffset, sp_width, sp_height);
-	const int channels = image.channels();
-
-	// Measure speed
-	auto drawing_start_time = now();
-
-	// trivial to parallelize, so why not?
-	#pragma omp parallel for
-	for(size_t i = 0; i < power_data.size(); i++)
-	{
-		const double value = (power_data.at(i) + 120) / 100;
-		const auto mappedcolor = tinycolormap::GetColor(value, tinycolormap::ColormapType::Cubehelix);
-
-		// Raw pixel access is faster than directly using pixelColor()
-		pixels[i * channels + 0] = QuantumRange * mappedcolor.r();
-		pixels[i * channels + 1] = QuantumRange * mappedcolor.g();
-		pixels[i * channels + 2] = QuantumRange * mappedcolor.b();
-	}
-	image.syncPixels();
-
-	const auto drawing_end_time = now();
-	const auto drawing_duration = duration_cast<std::chrono::nanoseconds>(drawing_end_time - drawing_start_time);
-	assert(drawing_duration.count() > 0);
-	const size_t spectrogram_pixel_count = power_data.size();
-
-	print("Drawn spectrogram: {:.6f}Mpix took {:.3f} seconds, at {:.3f}Mpix/s\n",
-		(double)spectrogram_pixel_count / 1e6, // Mpix
-		(double)drawing_duration.count() / 1e9, // seconds
-		(double)spectrogram_pixel_count * 1e3 / (drawing_duration.count()) // Mpix/s
-	);
-
-}
+	float min;
+	float max;
+	tinycolormap::ColormapType colormap;
+} colorscale_t;
 
 void draw_text
 (
@@ -82,12 +65,9 @@ void draw_text
 	image.modifyImage();
 }
 
-void draw_vertical_gridlines(const size_t steps, const size_t records, const logheader_t &h, Image &image)
+// columns of vertical gridlines, spacing is chosen from frequency range
+vector<size_t> gridline_columns(const size_t steps, const logheader_t &h)
 {
-	const size_t xoffset = 0;
-	const size_t yoffset = BANNER_HEIGHT;
-
-	// draw vertical gridlines
 	// calculate gridline spacing from frequency range
 
 	const size_t start_freq = h.start_freq * 1e6;
@@ -97,12 +77,6 @@ void draw_vertical_gridlines(const size_t steps, const size_t records, const log
 	size_t gridline_exponent = 100ULL * 1000 * 1000 * 1000; // 100 GHz
 	size_t gridline_spacing = SIZE_MAX;
 
-	Color gridline_color("grey");
-	gridline_color.quantumAlpha(QuantumRange * 0.75);
-	image.strokeColor(gridline_color);
-	image.strokeWidth(1);
-	image.strokeAntiAlias(false);
-
 	// find a gridline spacing that will result in at least MIN_GRIDLINES gridlines
 	while(freq_range / gridline_spacing < MIN_GRIDLINES)
 	{
@@ -122,34 +96,330 @@ void draw_vertical_gridlines(const size_t steps, const size_t records, const log
 	// find point of the last gridline
 	const size_t last_gridline_point =  ((stop_freq / gridline_spacing * gridline_spacing) - start_freq) / step_freq;
 
-	std::vector<Magick::Drawable> draw_list;
+	vector<size_t> columns;
 	for(size_t i = 0; i < gridline_count; i++)
 	{
-		const size_t x = xoffset + last_gridline_point - i * (gridline_spacing / step_freq);
-		const size_t h = records;
-		draw_list.emplace_back(Magick::DrawableLine(x, yoffset, x, yoffset + h - 1));
+		const size_t x = last_gridline_point - i * (gridline_spacing / step_freq);
+		if(x < steps)
+			columns.emplace_back(x);
 	}
-	image.draw(draw_list);
-	image.modifyImage();
+	return columns;
+}
+
+// colormap sampled at COLOUR_LUT_LEVELS levels, 8-bit RGB each, one more black entry for NaN
+// built once per colormap & never freed, so references stay valid for every thread
+static const uint8_t *colour_lut(tinycolormap::ColormapType colormap)
+{
+	static std::mutex lock;
+	static std::map<tinycolormap::ColormapType, vector<uint8_t>> luts;
+	std::lock_guard<std::mutex> guard(lock);
+	vector<uint8_t> &lut = luts[colormap];
+	if(lut.empty())
+	{
+		lut.assign((COLOUR_LUT_LEVELS + 1) * 3, 0);
+		for(size_t i = 0; i < COLOUR_LUT_LEVELS; i++)
+		{
+			const auto mappedcolor = tinycolormap::GetColor((double)i / (COLOUR_LUT_LEVELS - 1), colormap);
+			lut[i * 3 + 0] = std::lrint(255 * mappedcolor.r());
+			lut[i * 3 + 1] = std::lrint(255 * mappedcolor.g());
+			lut[i * 3 + 2] = std::lrint(255 * mappedcolor.b());
+		}
+	}
+	return lut.data();
+}
+
+// colour one block of points with lut from colour_lut(scale.colormap), NaN is left black
+// it's looked up once by the caller, not under the lock for every block
+// the index pass is branch free arithmetic the clones vectorize, the lookup pass is a plain copy
+SIMD_CLONES
+static void colour_block(const float *power_data, const size_t points, const colorscale_t &scale, const uint8_t *lut, uint8_t *rgb)
+{
+	const float min = scale.min;
+	const float levels = COLOUR_LUT_LEVELS - 1;
+	const float step = levels / (scale.max - scale.min);
+	int32_t index[COLOUR_BLOCK_POINTS];
+	// callers other than colour_records may pass more than a block
+	for(size_t first = 0; first < points; first += COLOUR_BLOCK_POINTS)
+	{
+		const size_t count = std::min(points - first, COLOUR_BLOCK_POINTS);
+		const float *power = power_data + first;
+		#pragma omp simd
+		for(size_t i = 0; i < count; i++)
+		{
+			const float p = power[i];
+			// rounded before clamping, nothing that could trap follows the branches of min / max
+			const int32_t nearest = std::min(std::max((p - min) * step + 0.5f, 0.0f), levels);
+			// NaN fails the comparison & picks the black entry
+			index[i] = p == p ? nearest : static_cast<int32_t>(COLOUR_LUT_LEVELS);
+		}
+		uint8_t *out = rgb + first * 3;
+		for(size_t i = 0; i < count; i++)
+		{
+			const uint8_t *colour = lut + index[i] * 3;
+			out[i * 3 + 0] = colour[0];
+			out[i * 3 + 1] = colour[1];
+			out[i * 3 + 2] = colour[2];
+		}
+	}
+}
+
+// colour points into 8-bit RGB, NaN is left black
+void colour_records(const float *power_data, const size_t points, const colorscale_t &scale, uint8_t *rgb)
+{
+	const size_t blocks = (points + COLOUR_BLOCK_POINTS - 1) / COLOUR_BLOCK_POINTS;
+	const uint8_t *lut = colour_lut(scale.colormap);
+	#pragma omp parallel
+	{
+		trace_begin("colour records");
+		#pragma omp for nowait
+		for(size_t block = 0; block < blocks; block++)
+		{
+			const size_t first = block * COLOUR_BLOCK_POINTS;
+			const size_t count = std::min(COLOUR_BLOCK_POINTS, points - first);
+			colour_block(power_data + first, count, scale, lut, rgb + first * 3);
+		}
+		trace_end("colour records");
+	}
+}
+
+// blend gridlines straight into one RGB row, "grey" at GRIDLINE_ALPHA
+static inline void blend_gridlines(uint8_t *row, const vector<size_t> &columns)
+{
+	for(const size_t x : columns)
+	{
+		for(size_t c = 0; c < 3; c++)
+			row[x * 3 + c] = std::lrint(GRIDLINE_ALPHA * GRIDLINE_GREY + (1 - GRIDLINE_ALPHA) * row[x * 3 + c]);
+	}
+}
+
+void draw_gridline_columns(uint8_t *rgb, const size_t width, const size_t rows, const vector<size_t> &columns)
+{
+	for(size_t y = 0; y < rows; y++)
+		blend_gridlines(rgb + y * width * 3, columns);
+}
+
+// render a line of text on black background into 8-bit RGB rows
+// glyphs come from an atlas, ImageMagick only draws text the atlas doesn't cover
+void text_rows
+(
+	const string &text,
+	const int px,
+	const Magick::Color &color,
+	const Magick::GravityType &gravity,
+	const size_t width,
+	const size_t height,
+	vector<uint8_t> &rgb
+)
+{
+	rgb.assign(width * height * 3, 0);
+	if(!glyphs_cover(text))
+	{
+		Image strip(Geometry(width, height), Color("black"));
+		strip.type(TrueColorType);
+		strip.depth(8);
+		strip.textAntiAlias(true);
+		strip.fontFamily(FONT_FAMILY);
+		draw_text(text, px, color, Geometry(0, 0, 0, 0), gravity, strip);
+		strip.write(0, 0, width, height, "RGB", Magick::CharPixel, rgb.data());
+		return;
+	}
+
+	const glyphatlas_t &atlas = glyph_atlas(FONT_FAMILY, px);
+	const uint8_t colour[3] =
+	{
+		static_cast<uint8_t>(std::lrint(255.0 * color.quantumRed() / QuantumRange)),
+		static_cast<uint8_t>(std::lrint(255.0 * color.quantumGreen() / QuantumRange)),
+		static_cast<uint8_t>(std::lrint(255.0 * color.quantumBlue() / QuantumRange))
+	};
+	const bool east = gravity == Magick::NorthEastGravity || gravity == Magick::EastGravity || gravity == Magick::SouthEastGravity;
+	const bool south = gravity == Magick::SouthWestGravity || gravity == Magick::SouthGravity || gravity == Magick::SouthEastGravity;
+	const double x = east ? width - text_width(atlas, text) : 0;
+	const long y = south ? (long)height - px : 0;
+	draw_glyphs(atlas, text, colour, x, y, rgb.data(), width, height);
+}
+
+// replace every record with its z-score against a rolling baseline, which is
+// updated after scoring, so every record is compared only against its past
+// |z| < threshold becomes NaN, so only deviations get coloured
+// returns number of points with |z| >= threshold
+size_t anomaly_map(float *power_data, const size_t record_count, baseline_t &baseline, float threshold)
+{
+	const size_t steps = baseline.steps;
+	vector<float> record(steps);
+	size_t anomalies = 0;
+
+	for(size_t r = 0; r < record_count; r++)
+	{
+		float *row = &power_data[r * steps];
+		std::copy(row, row + steps, record.begin());
+
+		if(baseline.sweeps == 0)
+			std::fill(row, row + steps, NAN);
+		else
+			anomalies += baseline_score(baseline, record.data(), row, threshold);
+		baseline_update(baseline, record.data());
+
+		#pragma omp simd
+		for(size_t i = 0; i < steps; i++)
+			row[i] = std::fabs(row[i]) >= threshold ? row[i] : NAN;
+	}
+
+	return anomalies;
+}
+
+// one of several images rendered from the same parse (-o)
+typedef struct
+{
+	string name; // put in file name, must be unique
+	size_t width; // 0: all steps
+	size_t height; // 0: all records, or in proportion if only width is given
+	colorscale_t scale;
+	bool gridlines;
+	bool text; // banner & footer
+	string format; // "png" uses our own encoder, anything else goes through Magick
+} outputspec_t;
+
+static bool parse_colormap(const string &name, tinycolormap::ColormapType &colormap)
+{
+	using tinycolormap::ColormapType;
+	const std::pair<const char *, ColormapType> colormaps[] =
+	{
+		{"parula", ColormapType::Parula}, {"heat", ColormapType::Heat}, {"jet", ColormapType::Jet},
+		{"turbo", ColormapType::Turbo}, {"hot", ColormapType::Hot}, {"gray", ColormapType::Gray},
+		{"magma", ColormapType::Magma}, {"inferno", ColormapType::Inferno}, {"plasma", ColormapType::Plasma},
+		{"viridis", ColormapType::Viridis}, {"cividis", ColormapType::Cividis}, {"github", ColormapType::Github},
+		{"cubehelix", ColormapType::Cubehelix}, {"hsv", ColormapType::HSV}
+	};
+	for(const auto &c : colormaps)
+	{
+		if(name == c.first)
+		{
+			colormap = c.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+// <name>[:<key>=<value>[,<key>=<value>]...], keys:
+//	size=<width>x<height> (either may be 0), cmap=<colormap>, range=<min dBm>:<max dBm>,
+//	grid=<true|false>, text=<true|false>, format=<png|jpg|webp|...>
+static bool parse_output_spec(const string &arg, outputspec_t &spec)
+{
+	const size_t colon = arg.find(':');
+	spec.name = arg.substr(0, colon);
+	if(spec.name.empty() || spec.name.find_first_of("/.") != string::npos)
+		return false;
+
+	stringstream options(colon == string::npos ? "" : arg.substr(colon + 1));
+	string option;
+	while(std::getline(options, option, ','))
+	{
+		const size_t equal = option.find('=');
+		if(equal == string::npos)
+			return false;
+		const string key = option.substr(0, equal);
+		const string value = option.substr(equal + 1);
+		if(key == "size")
+		{
+			if(sscanf(value.c_str(), "%zux%zu", &spec.width, &spec.height) != 2)
+				return false;
+		}
+		else if(key == "cmap")
+		{
+			if(!parse_colormap(value, spec.scale.colormap))
+				return false;
+		}
+		else if(key == "range")
+		{
+			if(sscanf(value.c_str(), "%f:%f", &spec.scale.min, &spec.scale.max) != 2 || !(spec.scale.min < spec.scale.max))
+				return false;
+		}
+		else if(key == "grid" || key == "text")
+		{
+			if(value != "true" && value != "false")
+				return false;
+			(key == "grid" ? spec.gridlines : spec.text) = value == "true";
+		}
+		else if(key == "format")
+		{
+			if(value.empty())
+				return false;
+			spec.format = value;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
 static fstream logfile_stream;
 
-static string logfile_name = "";
+static vector<string> logfile_names;
 static string filename_prefix = "sp";
 static string graph_title = "Unnamed Spectrogram";
 static bool do_gridlines = true;
+static size_t fold_bucket_minutes = 0; // 0 means no time-of-day folding
+static foldreduce_t fold_reduce_mode = {false, 0};
+static bool fold_use_cache = false;
+static float zscore_threshold = 0; // 0 means normal spectrogram
+static string baseline_file = "";
+static float baseline_alpha = BASELINE_DEFAULT_ALPHA;
+static size_t noisefloor_window = 0; // 0 means no noise floor subtraction
+static float noisefloor_percentile = NOISEFLOOR_DEFAULT_PERCENTILE;
+static size_t despeckle_size = 0; // 0 means no despeckle filter
+static bool despeckle_hampel = false;
+static float despeckle_hampel_k = HAMPEL_DEFAULT_K;
+static stats_t stats;
+static bool do_stats = false;
+static bool stats_json = false;
+static string trace_file = ""; // empty means no tracing
+static bool do_mosaic = false;
+static mosaiclayout_t mosaic_layout = mosaiclayout_t::side;
+static vector<string> output_args; // parsed after every other option, -g sets their default
+static vector<outputspec_t> output_specs;
+static string video_file = ""; // empty means no video
+static size_t video_window = VIDEO_DEFAULT_WINDOW;
+static size_t video_step = VIDEO_DEFAULT_STEP;
+static string calibration_file = ""; // empty means raw levels
+static calibration_t calibration;
 
 bool parse_args(int argc, char *argv[])
 {
 	int opt;
+	// only long option, short ones are all taken by now
+	const option long_options[] =
+	{
+		{"stats", optional_argument, nullptr, 'S'},
+		{"cpu", no_argument, nullptr, 'C'},
+		{"calibration", required_argument, nullptr, 'L'},
+		{nullptr, 0, nullptr, 0}
+	};
 
-	while((opt = getopt(argc, argv, "f:p:t:g:h")) != -1)
+	while((opt = getopt_long(argc, argv, "f:p:t:g:F:R:cz:B:a:n:P:D:H:T:m:o:V:W:K:h", long_options, nullptr)) != -1)
 	{
 		switch(opt)
 		{
+			case 'S':
+				do_stats = true;
+				if(optarg != nullptr && string(optarg) == "json")
+					stats_json = true;
+				else if(optarg != nullptr)
+				{
+					cerr << "Error: invalid value for --stats: " << optarg << endl;
+					return false;
+				}
+				break;
+			case 'C':
+				print("SIMD path: {}\n", simd_path());
+				exit(EXIT_SUCCESS);
+			case 'L':
+				calibration_file = optarg;
+				break;
 			case 'f':
-				logfile_name = optarg;
+				logfile_names.emplace_back(optarg);
 				break;
 			case 'p':
 				filename_prefix = optarg;
@@ -168,19 +438,809 @@ bool parse_args(int argc, char *argv[])
 					return false;
 				}
 				break;
+			case 'F':
+				fold_bucket_minutes = atoll(optarg);
+				if_error(fold_bucket_minutes == 0, "Error: invalid time-of-day bucket for -F");
+				break;
+			case 'R':
+				if(!fold_parse_reduce(optarg, fold_reduce_mode))
+				{
+					cerr << "Error: invalid value for -R: " << optarg << endl;
+					return false;
+				}
+				break;
+			case 'c':
+				fold_use_cache = true;
+				break;
+			case 'z':
+				zscore_threshold = atof(optarg);
+				if_error(zscore_threshold <= 0, "Error: z-score threshold must be positive");
+				break;
+			case 'B':
+				baseline_file = optarg;
+				break;
+			case 'a':
+				baseline_alpha = atof(optarg);
+				if_error(!(baseline_alpha > 0 && baseline_alpha <= 1), "Error: baseline alpha must be in (0, 1]");
+				break;
+			case 'n':
+				noisefloor_window = atoll(optarg);
+				if_error(noisefloor_window == 0, "Error: invalid noise floor window for -n");
+				break;
+			case 'P':
+				noisefloor_percentile = atof(optarg);
+				break;
+			case 'D':
+				despeckle_size = atoll(optarg);
+				if_error(despeckle_size != 3 && despeckle_size != 5, "Error: despeckle filter size (-D) must be 3 or 5");
+				break;
+			case 'H':
+				despeckle_hampel = true;
+				despeckle_hampel_k = atof(optarg);
+				break;
+			case 'T':
+				trace_file = optarg;
+				break;
+			case 'o':
+				output_args.emplace_back(optarg);
+				break;
+			case 'V':
+				video_file = optarg;
+				break;
+			case 'W':
+				video_window = atoll(optarg);
+				if_error(video_window < 2, "Error: video window (-W) must be at least 2 records");
+				break;
+			case 'K':
+				video_step = atoll(optarg);
+				if_error(video_step == 0, "Error: invalid video step for -K");
+				break;
+			case 'm':
+				do_mosaic = true;
+				if(string(optarg) == "side")
+					mosaic_layout = mosaiclayout_t::side;
+				else if(string(optarg) == "stack")
+					mosaic_layout = mosaiclayout_t::stack;
+				else
+				{
+					cerr << "Error: invalid value for -m: " << optarg << endl;
+					return false;
+				}
+				break;
 			case 'h':
 			default:
 				cerr << "Usage: " << argv[0] <<
-					" [-f <log file>] [-p <filename prefix>] [-t <graph title>] [-g <grid? true/false>]" << endl;
+					" [-f <log file>] [-p <filename prefix>] [-t <graph title>] [-g <grid? true/false>]\n"
+					"\t[-F <time-of-day bucket minutes>] [-R <mean|median|p<percentile>>] [-c] [more log files...]\n"
+					"\t-F folds all log files onto a 24-hour axis, -R selects the reduction (default: mean),\n"
+					"\tpercentiles come from per-cell 1dB histograms & are interpolated within a bin,\n"
+					"\t-c caches per-file partial aggregates as <log file>.fold\n"
+					"\t[-z <z-score threshold>] [-B <baseline file>] [-a <baseline alpha>]\n"
+					"\t-z renders deviations from a rolling per-bin baseline instead of power,\n"
+					"\t-B loads the baseline (if it exists) and saves it updated with this log\n"
+					"\t[-n <noise floor window records>] [-P <noise floor percentile>]\n"
+					"\t-n subtracts running per-bin noise floor (default: 10th percentile) before colouring\n"
+					"\t[-D <3|5>] [-H <Hampel k>]\n"
+					"\t-D applies a 3x3 or 5x5 median filter, -H makes it a Hampel filter that only replaces outliers\n"
+					"\t[--stats[=json]]\n"
+					"\t--stats reports time, CPU, threads & allocations of every phase, peak RSS and input size,\n"
+					"\t=json prints it as one line of JSON on stderr\n"
+					"\t[-o <name>[:<key>=<value>,...]]...\n"
+					"\t-o renders one more image per -o from the same parse, keys: size=<width>x<height> (0 keeps\n"
+					"\tproportion), cmap=<colormap>, range=<min dBm>:<max dBm>, grid=<true|false>, text=<true|false>,\n"
+					"\tformat=<png|jpg|webp|...>, written as <prefix>.<end time>.<name>.<format>\n"
+					"\t[-V <Y4M file or - for stdout>] [-W <window records>] [-K <step records>]\n"
+					"\t-V writes a scrolling waterfall video instead of an image, each frame shows -W records\n"
+					"\t(default: " << VIDEO_DEFAULT_WINDOW << ") and advances by -K records (default: " << VIDEO_DEFAULT_STEP << "), " << VIDEO_FPS << " frames per second\n"
+					"\t[-m <side|stack>] [more log files...]\n"
+					"\t-m renders one log per band into a single image, aligned on a common time grid,\n"
+					"\tpanels side by side or stacked top to bottom\n"
+					"\t[--calibration=<calibration file>]\n"
+					"\t--calibration corrects levels of raw logs per bin, one \"<freq MHz>,<offset dB>[,<RBW kHz>]\" per line\n"
+					"\t[-T <trace file>]\n"
+					"\t-T records every phase & thread as Chrome trace JSON, for chrome://tracing or ui.perfetto.dev\n"
+					"\t[--cpu]\n"
+					"\t--cpu prints which SIMD kernels this CPU runs & exits" << endl;
 				return false;
 		}
 	}
 
-	if_error(logfile_name.empty(), "Error: no log file specified (-f).");
+	// remaining arguments are additional log files, for folding rotated logs
+	for(int i = optind; i < argc; i++)
+		logfile_names.emplace_back(argv[i]);
+
+	if_error(logfile_names.empty(), "Error: no log file specified (-f).");
+	if_error(fold_bucket_minutes == 0 && !do_mosaic && logfile_names.size() > 1,
+		"Error: multiple log files are only supported with time-of-day folding (-F) or mosaic (-m).");
+	if_error(do_mosaic && (fold_bucket_minutes != 0 || zscore_threshold != 0 || noisefloor_window != 0 || despeckle_size != 0),
+		"Error: mosaic (-m) only works on plain spectrograms.");
+	if_error(fold_bucket_minutes != 0 && zscore_threshold != 0,
+		"Error: time-of-day folding (-F) and anomaly map (-z) can't be used together.");
+	if_error(noisefloor_window != 0 && (fold_bucket_minutes != 0 || zscore_threshold != 0),
+		"Error: noise floor subtraction (-n) only works on plain spectrograms.");
+	if_error(!video_file.empty() && (!output_args.empty() || do_mosaic || fold_bucket_minutes != 0 || zscore_threshold != 0 || noisefloor_window != 0 || despeckle_size != 0),
+		"Error: video (-V) only works on plain spectrograms.");
+	if_error(!output_args.empty() && (do_mosaic || fold_bucket_minutes != 0 || zscore_threshold != 0 || noisefloor_window != 0 || despeckle_size != 0),
+		"Error: multiple outputs (-o) only work on plain spectrograms.");
+	for(const auto &arg : output_args)
+	{
+		outputspec_t spec = {"", 0, 0, {SPECTROGRAM_MIN_DBM, SPECTROGRAM_MAX_DBM, tinycolormap::ColormapType::Cubehelix}, do_gridlines, true, "png"};
+		if_error(!parse_output_spec(arg, spec), "Error: invalid output spec for -o: " + arg);
+		for(const auto &other : output_specs)
+			if_error(other.name == spec.name, "Error: output name used twice: " + spec.name);
+		output_specs.emplace_back(spec);
+	}
+	if_error(despeckle_hampel && despeckle_size == 0, "Error: Hampel filter (-H) needs filter size (-D).");
+	if_error(despeckle_size != 0 && fold_bucket_minutes != 0,
+		"Error: despeckle filter (-D) can't be used with time-of-day folding (-F).");
 
 	return true;
 }
 
+// chunks passed between pipeline stages
+typedef struct
+{
+	logheader_t header; // first header of chunk, for frequency plan
+	vector<float> power_data;
+	size_t records;
+} powerchunk_t;
+
+typedef struct
+{
+	vector<uint8_t> rgb;
+	size_t width;
+	size_t rows;
+} rasterchunk_t;
+
+static double seconds_since(const time_point<system_clock> &start)
+{
+	return std::chrono::duration<double>(now() - start).count();
+}
+
+// parse -> filter & colour -> encode, each on its own thread with bounded queues
+// in between, so parsing chunk N+1 overlaps colouring chunk N and encoding chunk N-1
+// returns name of image written
+string render_pipeline(istream &logfile, const string &logfile_name)
+{
+	BoundedQueue<powerchunk_t> parsed(PIPELINE_QUEUE_DEPTH);
+	BoundedQueue<rasterchunk_t> coloured(PIPELINE_QUEUE_DEPTH);
+	vector<logheader_t> headers; // only touched by parse stage until it's done
+	size_t anomalies = 0;
+	size_t points = 0;
+
+	// first error wins, and stops every stage
+	std::mutex error_lock;
+	string error;
+	auto fail = [&](const std::exception &e)
+	{
+		std::lock_guard<std::mutex> guard(error_lock);
+		if(error.empty())
+			error = e.what();
+		parsed.abort();
+		coloured.abort();
+	};
+
+	colorscale_t scale = {SPECTROGRAM_MIN_DBM, SPECTROGRAM_MAX_DBM, tinycolormap::ColormapType::Cubehelix};
+	string suffix = ".png";
+	string footer_prefix = "";
+	if(!calibration_file.empty())
+		footer_prefix += "Calibrated, ";
+	if(despeckle_size != 0)
+		footer_prefix += format("{} {}x{}, ", despeckle_hampel ? "Hampel" : "Median", despeckle_size, despeckle_size);
+	if(noisefloor_window != 0)
+	{
+		scale = {NOISEFLOOR_DISPLAY_MIN, NOISEFLOOR_DISPLAY_MAX, tinycolormap::ColormapType::Cubehelix};
+		suffix = ".floor.png";
+		footer_prefix = format("Above p{:g} noise floor of {} records, ", noisefloor_percentile, noisefloor_window) + footer_prefix;
+	}
+	if(zscore_threshold != 0)
+	{
+		scale = {-ZSCORE_RANGE, ZSCORE_RANGE, tinycolormap::ColormapType::Turbo};
+		suffix = ".anomaly.png";
+		footer_prefix = format("Anomaly |z| >= {:g}, alpha {:g}, ", zscore_threshold, baseline_alpha) + footer_prefix;
+	}
+
+	// height isn't known until everything is parsed, so image gets its name at the end
+	const string partial_name = filename_prefix + ".part.png";
+	const auto pipeline_start_time = now();
+
+	std::thread parse_stage([&]
+	{
+		try
+		{
+			trace_thread_name("parse stage");
+			logreader_t reader;
+			logreader_init(reader);
+			while(true)
+			{
+				const auto timer = stats_begin(stats, phase_t::parse, false);
+				powerchunk_t chunk;
+				const size_t first = headers.size();
+				chunk.records = read_records(reader, logfile, chunk.power_data, headers, PIPELINE_CHUNK_RECORDS);
+				if(chunk.records != 0 && !calibration_file.empty())
+					calibrate_records(calibration, headers[first], chunk.power_data.data(), chunk.records);
+				stats_end(stats, timer);
+				if(chunk.records == 0)
+					break;
+
+				chunk.header = headers[first];
+				if(!parsed.push(std::move(chunk)))
+					return;
+			}
+			stats.bytes_read = reader.bytes_read;
+			parsed.close();
+		}
+		catch(const std::exception &e)
+		{
+			fail(e);
+		}
+	});
+
+	std::thread colour_stage([&]
+	{
+		try
+		{
+			trace_thread_name("colour stage");
+			bool initialized = false;
+			logheader_t h;
+			despeckle_t d;
+			noisefloor_t nf;
+			baseline_t baseline;
+			vector<size_t> columns;
+
+			// filters run in the same order as they would on a whole log
+			auto process = [&](vector<float> &power_data, size_t records, bool flush)
+			{
+				auto timer = stats_begin(stats, phase_t::filter, true);
+				vector<float> filtered;
+				if(despeckle_size != 0)
+				{
+					despeckle_process(d, power_data.data(), records, filtered, flush);
+					power_data.swap(filtered);
+					records = power_data.size() / h.steps;
+				}
+				if(noisefloor_window != 0)
+					noisefloor_subtract(nf, power_data.data(), records);
+				if(zscore_threshold != 0)
+					anomalies += anomaly_map(power_data.data(), records, baseline, zscore_threshold);
+				stats_end(stats, timer);
+				if(records == 0)
+					return;
+
+				timer = stats_begin(stats, phase_t::colour, true);
+				rasterchunk_t raster;
+				raster.width = h.steps;
+				raster.rows = records;
+				raster.rgb.resize(records * h.steps * 3);
+				colour_records(power_data.data(), records * h.steps, scale, raster.rgb.data());
+				stats_end(stats, timer);
+
+				timer = stats_begin(stats, phase_t::gridlines, false);
+				draw_gridline_columns(raster.rgb.data(), raster.width, raster.rows, columns);
+				stats_end(stats, timer);
+
+				points += records * h.steps;
+				coloured.push(std::move(raster));
+			};
+
+			powerchunk_t chunk;
+			while(parsed.pop(chunk))
+			{
+				if(!initialized)
+				{
+					h = chunk.header;
+					if(despeckle_size != 0)
+						despeckle_init(d, h.steps, despeckle_size, despeckle_hampel, despeckle_hampel_k);
+					if(noisefloor_window != 0)
+						noisefloor_init(nf, h.steps, noisefloor_window, noisefloor_percentile);
+					if(zscore_threshold != 0)
+					{
+						if(!baseline_file.empty() && baseline_load(baseline, baseline_file, h))
+						{
+							print("Loaded baseline: {}, {} sweeps\n", baseline_file, baseline.sweeps);
+							baseline.alpha = baseline_alpha;
+						}
+						else
+						{
+							baseline_init(baseline, h, baseline_alpha);
+						}
+					}
+					if(do_gridlines)
+						columns = gridline_columns(h.steps, h);
+					initialized = true;
+				}
+				process(chunk.power_data, chunk.records, false);
+			}
+
+			if(initialized)
+			{
+				// rows held back by despeckle filter
+				if(despeckle_size != 0)
+				{
+					vector<float> empty;
+					process(empty, 0, true);
+				}
+				if(zscore_threshold != 0 && !baseline_file.empty())
+					baseline_save(baseline, baseline_file);
+			}
+			coloured.close();
+		}
+		catch(const std::exception &e)
+		{
+			fail(e);
+		}
+	});
+
+	std::thread encode_stage([&]
+	{
+		try
+		{
+			trace_thread_name("encode stage");
+			pngwriter_t png;
+			bool started = false;
+			size_t width = 0;
+			vector<uint8_t> text;
+
+			rasterchunk_t raster;
+			while(coloured.pop(raster))
+			{
+				if(!started)
+				{
+					// banner doesn't depend on data, only on width
+					width = raster.width;
+					const auto timer = stats_begin(stats, phase_t::text, false);
+					text_rows(graph_title, BANNER_HEIGHT, BANNER_COLOR, Magick::NorthWestGravity, width, BANNER_HEIGHT, text);
+					stats_end(stats, timer);
+					png_begin(png, partial_name, width, graph_title);
+					png_write_rows(png, text.data(), BANNER_HEIGHT);
+					started = true;
+				}
+				const auto timer = stats_begin(stats, phase_t::encode, false);
+				png_write_rows(png, raster.rgb.data(), raster.rows);
+				stats_end(stats, timer);
+			}
+			// parse stage may still be running if pipeline was aborted
+			if(!started || coloured.failed())
+				return;
+
+			// everything has been parsed by now
+			const auto &h = headers.back();
+			const string footer_info = footer_prefix + format("Start: {}, Stop: {}, From {:.6f}MHz to {:.6f}MHz, {} Records, {} Steps, RBW: {:.1f}kHz, Generated on {}",
+				headers.front().start_time, h.end_time, h.start_freq, h.stop_freq, headers.size(), h.steps, h.rbw, time_str());
+			auto timer = stats_begin(stats, phase_t::text, false);
+			text_rows(footer_info, FOOTER_HEIGHT, FOOTER_COLOR, Magick::SouthEastGravity, width, FOOTER_HEIGHT, text);
+			stats_end(stats, timer);
+			timer = stats_begin(stats, phase_t::encode, false);
+			png_write_rows(png, text.data(), FOOTER_HEIGHT);
+			png_end(png);
+			stats_end(stats, timer);
+		}
+		catch(const std::exception &e)
+		{
+			fail(e);
+		}
+	});
+
+	// time consistency only needs headers, so it's checked while colouring & encoding go on
+	parse_stage.join();
+	if(!parsed.failed() && !headers.empty())
+	{
+		print("{} has {} records, {} points each\n", logfile_name, headers.size(), headers.back().steps);
+		const auto timer = stats_begin(stats, phase_t::consistency, false);
+		logproblem_t problems = {};
+		check_logfile_time_consistency(headers, problems);
+		stats_end(stats, timer);
+	}
+	colour_stage.join();
+	encode_stage.join();
+
+	// every stage has finished, so error can be read without lock
+	if(!error.empty())
+	{
+		std::remove(partial_name.c_str());
+		if_error(true, error);
+	}
+	if_error(headers.empty(), "Error: no valid record found in log file");
+
+	// ex. sp.20230320T220505.png
+	const string output_name = filename_prefix + "." + headers.back().end_time + suffix;
+	if_error(std::rename(partial_name.c_str(), output_name.c_str()) != 0, "Error: failed to rename image to " + output_name);
+
+	const double wall = seconds_since(pipeline_start_time);
+	stats.samples = points;
+	if(zscore_threshold != 0)
+		print("Anomaly map: {} of {} points have |z| >= {}\n", anomalies, points, zscore_threshold);
+	print("Drawn spectrogram: {:.6f}Mpix took {:.3f} seconds, at {:.3f}Mpix/s\n",
+		(double)points / 1e6, wall, (double)points / 1e6 / wall);
+
+	return output_name;
+}
+
+// records are coloured once as they're parsed & kept in a ring of one window,
+// every frame is cut from the ring, so a record shown in many frames costs nothing more
+void render_video(istream &logfile, const string &logfile_name)
+{
+	const auto render_start_time = now();
+	logreader_t reader;
+	logreader_init(reader);
+	videoring_t ring;
+	y4mwriter_t y4m;
+	vector<float> power_data;
+	vector<logheader_t> headers;
+	vector<uint8_t> rgb;
+	vector<size_t> columns;
+	const colorscale_t scale = {SPECTROGRAM_MIN_DBM, SPECTROGRAM_MAX_DBM, tinycolormap::ColormapType::Cubehelix};
+	bool started = false;
+	size_t next_frame = 0; // first record of next frame
+	size_t last_frame = 0;
+
+	while(true)
+	{
+		// never more than ring holds, and never past what next frame needs
+		const size_t batch = started ?
+			std::min(ring.window_rows, next_frame + ring.window_rows - ring.pushed) : video_window + video_window % 2;
+		power_data.clear();
+		headers.clear();
+		auto timer = stats_begin(stats, phase_t::parse, false);
+		const size_t count = read_records(reader, logfile, power_data, headers, batch);
+		if(count != 0 && !calibration_file.empty())
+			calibrate_records(calibration, reader.first_header, power_data.data(), count);
+		stats_end(stats, timer);
+		if(count == 0)
+			break;
+
+		const logheader_t &h = reader.first_header;
+		if(!started)
+		{
+			video_ring_init(ring, h.steps, video_window);
+			y4m_begin(y4m, video_file, ring, VIDEO_FPS);
+			if(do_gridlines)
+				columns = gridline_columns(h.steps, h);
+			started = true;
+		}
+
+		timer = stats_begin(stats, phase_t::colour, true);
+		rgb.resize(count * h.steps * 3);
+		colour_records(power_data.data(), count * h.steps, scale, rgb.data());
+		draw_gridline_columns(rgb.data(), h.steps, count, columns);
+		video_ring_push(ring, rgb.data(), h.steps, count);
+		stats_end(stats, timer);
+
+		timer = stats_begin(stats, phase_t::encode, true);
+		for(; next_frame + ring.window_rows <= ring.pushed; next_frame += video_step)
+		{
+			y4m_write_frame(y4m, ring, next_frame);
+			last_frame = next_frame;
+		}
+		stats_end(stats, timer);
+	}
+	if_error(!started, "Error: no valid record found in log file");
+
+	// last records always get into a frame, even if step doesn't end on them
+	if(y4m.frames == 0 || last_frame + ring.window_rows < ring.pushed)
+	{
+		const auto timer = stats_begin(stats, phase_t::encode, true);
+		y4m_write_frame(y4m, ring, ring.pushed > ring.window_rows ? ring.pushed - ring.window_rows : 0);
+		stats_end(stats, timer);
+	}
+	y4m_end(y4m);
+
+	const double wall = seconds_since(render_start_time);
+	stats.bytes_read = reader.bytes_read;
+	stats.samples = ring.pushed * reader.first_header.steps;
+	print("{} has {} records, {} points each\n", logfile_name, ring.pushed, reader.first_header.steps);
+	print("Written video: {}, {} frames of {}x{} ({:.1f}s at {}fps), took {:.3f} seconds, {:.1f} frames/s\n",
+		video_file == "-" ? "stdout" : video_file, y4m.frames, y4m.width, y4m.height,
+		(double)y4m.frames / VIDEO_FPS, VIDEO_FPS, wall, y4m.frames / wall);
+}
+
+// an output being rendered
+typedef struct
+{
+	size_t width;
+	size_t height;
+	size_t level; // of pyramid
+	string filename;
+	vector<uint8_t> banner;
+	vector<uint8_t> footer;
+	vector<uint8_t> rgb; // spectrogram rows
+} outputimage_t;
+
+static void encode_output(const outputspec_t &spec, outputimage_t &out)
+{
+	if(spec.format == "png")
+	{
+		pngwriter_t png;
+		png_begin(png, out.filename, out.width, graph_title);
+		if(spec.text)
+			png_write_rows(png, out.banner.data(), BANNER_HEIGHT);
+		png_write_rows(png, out.rgb.data(), out.height);
+		if(spec.text)
+			png_write_rows(png, out.footer.data(), FOOTER_HEIGHT);
+		png_end(png);
+		return;
+	}
+
+	// every other format is whatever Magick can write, from one buffer
+	vector<uint8_t> rgb;
+	if(spec.text)
+	{
+		rgb.reserve(out.banner.size() + out.rgb.size() + out.footer.size());
+		rgb.insert(rgb.end(), out.banner.begin(), out.banner.end());
+		rgb.insert(rgb.end(), out.rgb.begin(), out.rgb.end());
+		rgb.insert(rgb.end(), out.footer.begin(), out.footer.end());
+	}
+	else
+	{
+		rgb.swap(out.rgb);
+	}
+	const size_t height = rgb.size() / (out.width * 3);
+	Image image(out.width, height, "RGB", Magick::CharPixel, rgb.data());
+	image.comment(graph_title);
+	image.write(out.filename);
+}
+
+// parse once, then every -o output is sampled from a shared pyramid, coloured & encoded in parallel
+// returns names of images written
+vector<string> render_outputs(istream &logfile, const string &logfile_name)
+{
+	const auto render_start_time = now();
+	vector<float> power_data;
+	vector<logheader_t> headers;
+	auto timer = stats_begin(stats, phase_t::parse, true);
+	stats.bytes_read = parse_logfile(power_data, headers, logfile);
+	const logheader_t &h = headers.back();
+	const size_t records = headers.size();
+	if(!calibration_file.empty())
+		calibrate_records(calibration, h, power_data.data(), records);
+	stats_end(stats, timer);
+
+	print("{} has {} records, {} points each\n", logfile_name, records, h.steps);
+	timer = stats_begin(stats, phase_t::consistency, false);
+	logproblem_t problems = {};
+	check_logfile_time_consistency(headers, problems);
+	stats_end(stats, timer);
+
+	// levels are built before rendering starts, so outputs only read the pyramid
+	timer = stats_begin(stats, phase_t::filter, true);
+	pyramid_t pyramid;
+	pyramid_init(pyramid, std::move(power_data), records, h.steps);
+	const size_t n = output_specs.size();
+	vector<outputimage_t> outputs(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		const outputspec_t &spec = output_specs[i];
+		outputimage_t &out = outputs[i];
+		// never larger than the log itself
+		out.width = std::min(spec.width != 0 ? spec.width : h.steps, h.steps);
+		out.height = spec.height != 0 ? spec.height :
+			spec.width != 0 ? std::max<size_t>(std::lrint((double)records * out.width / h.steps), 1) : records;
+		out.height = std::min(out.height, records);
+		out.level = pyramid_level(pyramid, out.width, out.height);
+		out.filename = format("{}.{}.{}.{}", filename_prefix, h.end_time, spec.name, spec.format);
+	}
+	stats_end(stats, timer);
+
+	// Magick isn't used from more than one thread, so text is drawn here
+	timer = stats_begin(stats, phase_t::text, false);
+	const string footer_info = format("{}Start: {}, Stop: {}, From {:.6f}MHz to {:.6f}MHz, {} Records, {} Steps, RBW: {:.1f}kHz, Generated on {}",
+		calibration_file.empty() && !headers.front().calibrated ? "" : "Calibrated, ", headers.front().start_time, h.end_time, h.start_freq, h.stop_freq, records, h.steps, h.rbw, time_str());
+	for(size_t i = 0; i < n; i++)
+	{
+		if(!output_specs[i].text)
+			continue;
+		text_rows(graph_title, BANNER_HEIGHT, BANNER_COLOR, Magick::NorthWestGravity, outputs[i].width, BANNER_HEIGHT, outputs[i].banner);
+		text_rows(footer_info, FOOTER_HEIGHT, FOOTER_COLOR, Magick::SouthEastGravity, outputs[i].width, FOOTER_HEIGHT, outputs[i].footer);
+	}
+	stats_end(stats, timer);
+
+	// one output per thread, kernels inside don't nest another team
+	timer = stats_begin(stats, phase_t::colour, true);
+	const vector<size_t> full_columns = gridline_columns(h.steps, h);
+	size_t points = 0;
+	#pragma omp parallel for schedule(dynamic, 1) reduction(+:points)
+	for(size_t i = 0; i < n; i++)
+	{
+		trace_begin("colour output");
+		const outputspec_t &spec = output_specs[i];
+		outputimage_t &out = outputs[i];
+		vector<float> sampled;
+		pyramid_sample(pyramid, out.level, out.width, out.height, sampled);
+		out.rgb.resize(sampled.size() * 3);
+		colour_records(sampled.data(), sampled.size(), spec.scale, out.rgb.data());
+		if(spec.gridlines)
+		{
+			vector<size_t> columns;
+			for(const size_t column : full_columns)
+				columns.emplace_back(column * out.width / h.steps);
+			draw_gridline_columns(out.rgb.data(), out.width, out.height, columns);
+		}
+		points += sampled.size();
+		trace_end("colour output");
+	}
+	stats_end(stats, timer);
+
+	timer = stats_begin(stats, phase_t::encode, true);
+	string error;
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(size_t i = 0; i < n; i++)
+	{
+		try
+		{
+			trace_begin("encode output");
+			if(output_specs[i].format == "png")
+			{
+				encode_output(output_specs[i], outputs[i]);
+			}
+			else
+			{
+				#pragma omp critical(magick)
+				encode_output(output_specs[i], outputs[i]);
+			}
+			trace_end("encode output");
+		}
+		catch(const std::exception &e)
+		{
+			// exceptions can't leave an OpenMP region
+			#pragma omp critical(output_error)
+			error = format("{}: {}", outputs[i].filename, e.what());
+		}
+	}
+	stats_end(stats, timer);
+	if_error(!error.empty(), error);
+
+	const double wall = seconds_since(render_start_time);
+	stats.samples = records * h.steps;
+	print("Drawn {} outputs: {:.6f}Mpix, {} pyramid levels, took {:.3f} seconds\n",
+		n, (double)points / 1e6, pyramid.levels.size(), wall);
+
+	vector<string> names;
+	for(const auto &out : outputs)
+		names.emplace_back(out.filename);
+	return names;
+}
+
+// label strip above a panel
+static string band_label(const band_t &band)
+{
+	const logheader_t &h = band.headers.front();
+	return format("{:.6f}MHz to {:.6f}MHz, {} Steps, RBW: {:.1f}kHz, {} Records every {}s",
+		h.start_freq, h.stop_freq, h.steps, h.rbw, band.headers.size(), band.interval);
+}
+
+// every band is a panel of the same canvas, coloured in parallel, then encoded once
+// side: panels left to right, under one row of labels
+// stack: panels top to bottom, each under its own label, on the same time grid
+// returns name of image written
+string render_mosaic(void)
+{
+	const auto mosaic_start_time = now();
+	vector<band_t> bands;
+	auto timer = stats_begin(stats, phase_t::parse, true);
+	mosaic_load(bands, logfile_names);
+	// every band has its own plan
+	if(!calibration_file.empty())
+		for(auto &band : bands)
+			calibrate_records(calibration, band.headers.front(), band.power_data.data(), band.headers.size());
+	stats_end(stats, timer);
+
+	const timegrid_t grid = mosaic_grid(bands);
+	const size_t n = bands.size();
+	size_t width = 0;
+	for(const auto &band : bands)
+	{
+		const size_t steps = band.headers.front().steps;
+		width = mosaic_layout == mosaiclayout_t::side ? width + steps : std::max(width, steps);
+		stats.bytes_read += band.bytes_read;
+		print("{} has {} records, {} points each, every {}s\n", band.name, band.headers.size(), steps, band.interval);
+	}
+	if(mosaic_layout == mosaiclayout_t::side)
+		width += (n - 1) * MOSAIC_GAP;
+
+	// where each panel goes on canvas, which holds only spectrogram rows
+	vector<size_t> panel_offsets(n);
+	vector<vector<size_t>> rows(n);
+	vector<vector<size_t>> columns(n);
+	size_t x = 0;
+	for(size_t b = 0; b < n; b++)
+	{
+		const logheader_t &h = bands[b].headers.front();
+		panel_offsets[b] = mosaic_layout == mosaiclayout_t::side ? x * 3 : b * grid.rows * width * 3;
+		x += h.steps + MOSAIC_GAP;
+		mosaic_rows(bands[b], grid, rows[b]);
+		if(do_gridlines)
+			columns[b] = gridline_columns(h.steps, h);
+	}
+	const size_t canvas_rows = mosaic_layout == mosaiclayout_t::side ? grid.rows : n * grid.rows;
+	vector<uint8_t> canvas(canvas_rows * width * 3, 0);
+
+	// one task per row of a panel, rows nothing was logged for stay black
+	timer = stats_begin(stats, phase_t::colour, true);
+	const colorscale_t scale = {SPECTROGRAM_MIN_DBM, SPECTROGRAM_MAX_DBM, tinycolormap::ColormapType::Cubehelix};
+	const uint8_t *lut = colour_lut(scale.colormap);
+	size_t points = 0;
+	#pragma omp parallel reduction(+:points)
+	{
+		trace_begin("colour mosaic");
+		#pragma omp for schedule(static) collapse(2) nowait
+		for(size_t b = 0; b < n; b++)
+		{
+			for(size_t row = 0; row < grid.rows; row++)
+			{
+				const size_t record = rows[b][row];
+				if(record == SIZE_MAX)
+					continue;
+				const size_t steps = bands[b].headers.front().steps;
+				uint8_t *out = canvas.data() + panel_offsets[b] + row * width * 3;
+				colour_block(&bands[b].power_data[record * steps], steps, scale, lut, out);
+				blend_gridlines(out, columns[b]);
+				points += steps;
+			}
+		}
+		trace_end("colour mosaic");
+	}
+	stats_end(stats, timer);
+
+	const string end_time = time_str(system_clock::time_point(seconds(grid.start + (int64_t)(grid.rows - 1) * grid.step)));
+	const string output_name = filename_prefix + "." + end_time + ".mosaic.png";
+	const string footer_info = format("{}Mosaic of {} bands, Start: {}, Stop: {}, {} Rows of {}s, Generated on {}",
+		calibration_file.empty() ? "" : "Calibrated, ", n, time_str(system_clock::time_point(seconds(grid.start))), end_time, grid.rows, grid.step, time_str());
+
+	// Magick isn't used from more than one thread, so text is drawn here
+	timer = stats_begin(stats, phase_t::text, false);
+	vector<uint8_t> banner;
+	vector<uint8_t> footer;
+	text_rows(graph_title, BANNER_HEIGHT, BANNER_COLOR, Magick::NorthWestGravity, width, BANNER_HEIGHT, banner);
+	text_rows(footer_info, FOOTER_HEIGHT, FOOTER_COLOR, Magick::SouthEastGravity, width, FOOTER_HEIGHT, footer);
+	vector<vector<uint8_t>> labels(n);
+	for(size_t b = 0; b < n; b++)
+	{
+		const size_t label_width = mosaic_layout == mosaiclayout_t::side ? bands[b].headers.front().steps : width;
+		text_rows(band_label(bands[b]), MOSAIC_LABEL_HEIGHT, MOSAIC_LABEL_COLOR, Magick::NorthWestGravity,
+			label_width, MOSAIC_LABEL_HEIGHT, labels[b]);
+	}
+	stats_end(stats, timer);
+
+	timer = stats_begin(stats, phase_t::encode, false);
+	pngwriter_t png;
+	png_begin(png, output_name, width, graph_title);
+	png_write_rows(png, banner.data(), BANNER_HEIGHT);
+	if(mosaic_layout == mosaiclayout_t::side)
+	{
+		// labels of every panel share one strip
+		vector<uint8_t> strip(MOSAIC_LABEL_HEIGHT * width * 3, 0);
+		for(size_t b = 0; b < n; b++)
+		{
+			const size_t label_width = bands[b].headers.front().steps * 3;
+			for(int y = 0; y < MOSAIC_LABEL_HEIGHT; y++)
+				std::copy_n(&labels[b][y * label_width], label_width, &strip[panel_offsets[b] + y * width * 3]);
+		}
+		png_write_rows(png, strip.data(), MOSAIC_LABEL_HEIGHT);
+		png_write_rows(png, canvas.data(), grid.rows);
+	}
+	else
+	{
+		const vector<uint8_t> gap(MOSAIC_GAP * width * 3, 0);
+		for(size_t b = 0; b < n; b++)
+		{
+			if(b > 0)
+				png_write_rows(png, gap.data(), MOSAIC_GAP);
+			png_write_rows(png, labels[b].data(), MOSAIC_LABEL_HEIGHT);
+			png_write_rows(png, canvas.data() + panel_offsets[b], grid.rows);
+		}
+	}
+	png_write_rows(png, footer.data(), FOOTER_HEIGHT);
+	png_end(png);
+	stats_end(stats, timer);
+
+	const double wall = seconds_since(mosaic_start_time);
+	stats.samples = points;
+	print("Drawn mosaic: {} bands, {} rows of {}s, {:.6f}Mpix took {:.3f} seconds, at {:.3f}Mpix/s\n",
+		n, grid.rows, grid.step, (double)points / 1e6, wall, (double)points / 1e6 / wall);
+
+	return output_name;
+}
+
 int main(int argc, char *argv[])
 {
 try
@@ -190,90 +1250,179 @@ try
 
 	if(parse_args(argc, argv) == false)
 		return EXIT_FAILURE;
+	stats_init(stats, do_stats, stats_json);
+	if(!calibration_file.empty())
+	{
+		calibration_load(calibration, calibration_file);
+		print("Loaded calibration: {}, {} points\n", calibration_file, calibration.points.size());
+	}
+	if(!trace_file.empty())
+	{
+		trace_start(trace_file);
+		trace_thread_name("main");
+	}
 
-/* ==================== *\
-|| Text Processing Part ||
-\* ==================== */
+	if(do_mosaic)
+	{
+		const string output_name = render_mosaic();
+		print("[{}] Written image: {}\n", time_str(), output_name);
+		stats_report(stats);
+		trace_stop();
+		return EXIT_SUCCESS;
+	}
 
-	vector<logheader_t> headers;
-	vector<float> power_data;
+	if(!video_file.empty())
+	{
+		const string logfile_name = logfile_names.front();
+		if(logfile_name == "-")
+		{
+			render_video(cin, "stdin");
+		}
+		else
+		{
+			logfile_stream.open(logfile_name, ios::in);
+			if_error(!logfile_stream.is_open(), "Error: could not open file " + logfile_name);
+			render_video(logfile_stream, logfile_name);
+		}
+		stats_report(stats);
+		trace_stop();
+		return EXIT_SUCCESS;
+	}
 
-	// open log file
-	// go through all headers to get record count & validate everything
-	if(logfile_name == "-")
+	if(!output_specs.empty())
 	{
-		parse_logfile(power_data, headers, cin);
-		logfile_name = "stdin";
+		const string logfile_name = logfile_names.front();
+		vector<string> output_names;
+		if(logfile_name == "-")
+		{
+			output_names = render_outputs(cin, "stdin");
+		}
+		else
+		{
+			logfile_stream.open(logfile_name, ios::in);
+			if_error(!logfile_stream.is_open(), "Error: could not open file " + logfile_name);
+			output_names = render_outputs(logfile_stream, logfile_name);
+		}
+		for(const auto &name : output_names)
+			print("[{}] Written image: {}\n", time_str(), name);
+		stats_report(stats);
+		trace_stop();
+		return EXIT_SUCCESS;
 	}
-	else
+
+	// plain spectrogram & its filters are rendered by the pipeline
+	if(fold_bucket_minutes == 0)
 	{
-		logfile_stream.open(logfile_name, ios::in);
-		if_error(!logfile_stream.is_open(), "Error: could not open file " + logfile_name);
+		const string logfile_name = logfile_names.front();
+		string output_name;
+
+		if(logfile_name == "-")
+		{
+			output_name = render_pipeline(cin, "stdin");
+		}
+		else
+		{
+			logfile_stream.open(logfile_name, ios::in);
+			if_error(!logfile_stream.is_open(), "Error: could not open file " + logfile_name);
 
-		parse_logfile(power_data, headers, logfile_stream);
+			output_name = render_pipeline(logfile_stream, logfile_name);
+		}
+		print("[{}] Written image: {}\n", time_str(), output_name);
+		stats_report(stats);
+		trace_stop();
+		return EXIT_SUCCESS;
 	}
 
-	logproblem_t problems = {};
-	check_logfile_time_consistency(headers, problems);
+/* ==================== *\
+|| Text Processing Part ||
+\* ==================== */
 
-	const auto record_count = headers.size();
-	// get last header for easy access
-	const auto &h = headers.back();
+	vector<float> power_data;
+	const string current_time = time_str();
 
-	print("{} has {} records, {} points each\n", logfile_name, record_count, h.steps);
+	foldstate_t fold;
+	auto timer = stats_begin(stats, phase_t::parse, true);
+	fold_logfiles(fold, logfile_names, fold_bucket_minutes * 60, fold_reduce_mode.use_percentile, fold_use_cache);
+	stats_end(stats, timer);
+	timer = stats_begin(stats, phase_t::filter, true);
+	fold_reduce(fold, fold_reduce_mode, power_data);
+	stats_end(stats, timer);
 
-/* ===================== *\
-|| Image Processing Part ||
-\* ===================== */
+	const size_t record_count = fold.buckets;
+	const logheader_t h = {fold.start_freq, fold.stop_freq, fold.steps, fold.rbw, "", "", false};
+	// mean & percentiles shift with a per-bin offset, so buckets are corrected instead of every record
+	// and caches of partial aggregates stay raw
+	if(!calibration_file.empty())
+	{
+		timer = stats_begin(stats, phase_t::filter, true);
+		calibrate_records(calibration, h, power_data.data(), record_count);
+		stats_end(stats, timer);
+	}
+	const colorscale_t scale = {SPECTROGRAM_MIN_DBM, SPECTROGRAM_MAX_DBM, tinycolormap::ColormapType::Cubehelix};
+	const string reduce_name = fold_reduce_mode.use_percentile ?
+		format("p{:g}", fold_reduce_mode.percentile) : "mean";
 
-	// ex. sp.20230320T220505.png
-	string output_name = filename_prefix + "." + h.end_time + ".png";
+	print("Folded {} files, {} records into {} buckets of {} minutes, {} points each\n",
+		fold.files, fold.records, fold.buckets, fold_bucket_minutes, h.steps);
 
-	// create the image
+	// ex. sp.fold.png
+	const string output_name = filename_prefix + ".fold.png";
+	const string footer_info = format("{}Time-of-day fold of {} files, {} Records, {}min buckets, {}, From {:.6f}MHz to {:.6f}MHz, {} Steps, RBW: {:.1f}kHz, Generated on {}",
+		calibration_file.empty() ? "" : "Calibrated, ", fold.files, fold.records, fold_bucket_minutes, reduce_name, h.start_freq, h.stop_freq, h.steps, h.rbw, current_time);
 
-	const size_t sp_width = h.steps;
-	const size_t sp_height = record_count;
-	const size_t sp_xoffset = 0;	// Currently unused
-	const size_t sp_yoffset = BANNER_HEIGHT;
+/* ===================== *\
+|| Image Processing Part ||
+\* ===================== */
 
+	// banner, spectrogram & footer go straight into one RGB buffer
 	const size_t width = h.steps;
 	const size_t height = record_count + BANNER_HEIGHT + FOOTER_HEIGHT;
+	vector<uint8_t> rgb(width * height * 3);
+	vector<uint8_t> text;
 
-	Image image(Geometry(width, height), Color("black"));
-	image.verbose(true);
-	image.type(TrueColorType);
-	image.depth(8); // 8 bits per channel is enough for most usage
-	image.textAntiAlias(true);
-	image.fontFamily(FONT_FAMILY);
-	image.comment(graph_title);
-	image.modifyImage();
-
-	// Write banner text
-	draw_text(graph_title, BANNER_HEIGHT, BANNER_COLOR, Geometry(0, 0, 0, 0), Magick::NorthWestGravity, image);
-
-	draw_spectrogram(sp_width, sp_height, sp_xoffset, sp_yoffset, power_data, image);
-
-	const string current_time = time_str();
+	timer = stats_begin(stats, phase_t::text, false);
+	text_rows(graph_title, BANNER_HEIGHT, BANNER_COLOR, Magick::NorthWestGravity, width, BANNER_HEIGHT, text);
+	std::copy(text.begin(), text.end(), rgb.begin());
+	text_rows(footer_info, FOOTER_HEIGHT, FOOTER_COLOR, Magick::SouthEastGravity, width, FOOTER_HEIGHT, text);
+	std::copy(text.begin(), text.end(), rgb.begin() + (BANNER_HEIGHT + record_count) * width * 3);
+	stats_end(stats, timer);
 
-	// Footer text
-	const string footer_info = format("Start: {}, Stop: {}, From {:.6f}MHz to {:.6f}MHz, {} Records, {} Steps, RBW: {:.1f}kHz, Generated on {}",
-		headers.front().start_time, h.end_time, h.start_freq, h.stop_freq, record_count, h.steps, h.rbw, current_time);
-	draw_text(footer_info, FOOTER_HEIGHT, FOOTER_COLOR, Geometry(0, 0, 0, 0), Magick::SouthEastGravity, image);
+	uint8_t *spectrogram = &rgb[BANNER_HEIGHT * width * 3];
+	timer = stats_begin(stats, phase_t::colour, true);
+	colour_records(power_data.data(), power_data.size(), scale, spectrogram);
+	stats_end(stats, timer);
 
-	// Draw gridlines
 	if(do_gridlines)
 	{
-		draw_vertical_gridlines(h.steps, record_count, h, image);
+		timer = stats_begin(stats, phase_t::gridlines, false);
+		draw_gridline_columns(spectrogram, width, record_count, gridline_columns(h.steps, h));
+		stats_end(stats, timer);
 	}
 
-	// write the image to a file
-	print("[{}] Writing image: ", current_time);
-	// Enabled verbose
-	image.write(output_name);
+	print("[{}] Writing image: {}\n", current_time, output_name);
+	timer = stats_begin(stats, phase_t::encode, true);
+	pngwriter_t png;
+	png_begin(png, output_name, width, graph_title);
+	png_write_rows(png, rgb.data(), height);
+	png_end(png);
+	stats_end(stats, timer);
+	stats.bytes_read = fold.bytes_read;
+	stats.samples = fold.records * fold.steps;
+	stats_report(stats);
+	trace_stop();
 }
 catch(const StringException &e)
 {
 	cerr << e.what() << endl;
+	// trace is still useful for finding out what went wrong
+	try
+	{
+		trace_stop();
+	}
+	catch(const StringException &trace_error)
+	{
+		cerr << trace_error.what() << endl;
+	}
 	return EXIT_FAILURE;
 }
 
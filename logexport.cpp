@@ -0,0 +1,188 @@
+/*
+ *   logexport - export a log file as .npy arrays or Arrow IPC stream
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "columnar.hpp"
+#include <getopt.h>
+
+static string logfile_name = "";
+static string output_prefix = ""; // empty means log file name without ".log"
+static bool do_npy = true;
+static bool do_arrow = false;
+static size_t batch_records = EXPORT_BATCH_RECORDS;
+
+bool parse_args(int argc, char *argv[])
+{
+	int opt;
+	while((opt = getopt(argc, argv, "f:p:F:b:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'f':
+				logfile_name = optarg;
+				break;
+			case 'p':
+				output_prefix = optarg;
+				break;
+			case 'F':
+				if(string(optarg) != "npy" && string(optarg) != "arrow" && string(optarg) != "all")
+				{
+					cerr << "Error: invalid value for -F: " << optarg << endl;
+					return false;
+				}
+				do_npy = string(optarg) != "arrow";
+				do_arrow = string(optarg) != "npy";
+				break;
+			case 'b':
+				batch_records = atoll(optarg);
+				if_error(batch_records == 0, "Error: invalid record batch size for -b");
+				break;
+			case 'h':
+			default:
+				cerr << "Usage: " << argv[0] <<
+					" -f <log file> [-p <output prefix>] [-F <npy|arrow|all>] [-b <records per batch>]\n"
+					"\tnpy writes <prefix>.power.npy (records x steps, float32 dBm), <prefix>.start_time.npy &\n"
+					"\t<prefix>.end_time.npy (int64 UNIX seconds) and <prefix>.freq.npy (float64 MHz)\n"
+					"\tarrow writes <prefix>.arrows, an Arrow IPC stream of one record batch per -b records\n"
+					"\tprefix defaults to log file name without \".log\"" << endl;
+				return false;
+		}
+	}
+
+	if_error(logfile_name.empty(), "Error: no log file specified (-f).");
+	if(output_prefix.empty())
+	{
+		output_prefix = logfile_name == "-" ? "sp" : logfile_name;
+		if(output_prefix.size() > 4 && output_prefix.substr(output_prefix.size() - 4) == ".log")
+			output_prefix.erase(output_prefix.size() - 4);
+	}
+
+	return true;
+}
+
+// log is read & written batch by batch, so memory usage doesn't depend on its length
+void export_log(istream &logfile)
+{
+	logreader_t reader;
+	logreader_init(reader);
+	vector<float> power_data;
+	vector<logheader_t> headers;
+	vector<int64_t> start_times;
+	vector<int64_t> end_times;
+
+	npywriter_t power_npy, start_npy, end_npy;
+	arrowwriter_t arrow;
+	bool started = false;
+	size_t records = 0;
+	const auto start_time = now();
+
+	while(true)
+	{
+		power_data.clear();
+		headers.clear();
+		const size_t count = read_records(reader, logfile, power_data, headers, batch_records);
+		if(count == 0)
+			break;
+
+		start_times.resize(count);
+		end_times.resize(count);
+		for(size_t i = 0; i < count; i++)
+		{
+			start_times[i] = epoch_seconds(headers[i].start_time);
+			end_times[i] = epoch_seconds(headers[i].end_time);
+		}
+
+		const logheader_t &h = headers.front();
+		if(!started)
+		{
+			if(do_npy)
+			{
+				npy_begin(power_npy, output_prefix + ".power.npy", "f4", sizeof(float), h.steps);
+				npy_begin(start_npy, output_prefix + ".start_time.npy", "i8", sizeof(int64_t), 0);
+				npy_begin(end_npy, output_prefix + ".end_time.npy", "i8", sizeof(int64_t), 0);
+
+				vector<double> freqs(h.steps);
+				for(size_t i = 0; i < h.steps; i++)
+					freqs[i] = bin_frequency(h, i);
+				npywriter_t freq_npy;
+				npy_begin(freq_npy, output_prefix + ".freq.npy", "f8", sizeof(double), 0);
+				npy_write_rows(freq_npy, freqs.data(), freqs.size());
+				npy_end(freq_npy);
+			}
+			if(do_arrow)
+				arrow_begin(arrow, output_prefix + ".arrows", h);
+			started = true;
+		}
+
+		if(do_npy)
+		{
+			npy_write_rows(power_npy, power_data.data(), count);
+			npy_write_rows(start_npy, start_times.data(), count);
+			npy_write_rows(end_npy, end_times.data(), count);
+		}
+		if(do_arrow)
+			arrow_write_batch(arrow, start_times.data(), end_times.data(), power_data.data(), count);
+		records += count;
+	}
+
+	if_error(!started, "Error: no valid record found in log file");
+	if(do_npy)
+	{
+		npy_end(power_npy);
+		npy_end(start_npy);
+		npy_end(end_npy);
+		print("Written {}.{{power,start_time,end_time,freq}}.npy\n", output_prefix);
+	}
+	if(do_arrow)
+	{
+		arrow_end(arrow);
+		print("Written {}.arrows, {} record batches\n", output_prefix, arrow.batches);
+	}
+
+	const double elapsed = std::chrono::duration<double>(now() - start_time).count();
+	print("Exported {} records, {} points each, {:.1f}MiB of log in {:.3f} seconds\n",
+		records, reader.first_header.steps, reader.bytes_read / 1048576.0, elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+try
+{
+	if(parse_args(argc, argv) == false)
+		return EXIT_FAILURE;
+
+	if(logfile_name == "-")
+	{
+		export_log(cin);
+	}
+	else
+	{
+		fstream logfile_stream(logfile_name, ios::in);
+		if_error(!logfile_stream.is_open(), "Error: could not open file " + logfile_name);
+		export_log(logfile_stream);
+	}
+}
+catch(const StringException &e)
+{
+	cerr << e.what() << endl;
+	return EXIT_FAILURE;
+}
+
+	return EXIT_SUCCESS;
+}
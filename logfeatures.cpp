@@ -0,0 +1,185 @@
+/*
+ *   logfeatures - per-sweep feature time series of log files
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "columnar.hpp"
+#include "features.hpp"
+#include <getopt.h>
+
+static vector<string> logfile_names;
+static string output_prefix = "features";
+
+bool parse_args(int argc, char *argv[])
+{
+	int opt;
+	while((opt = getopt(argc, argv, "f:p:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'f':
+				logfile_names.emplace_back(optarg);
+				break;
+			case 'p':
+				output_prefix = optarg;
+				break;
+			case 'h':
+			default:
+				cerr << "Usage: " << argv[0] << " [-f <log file>] [-p <output prefix>] [more log files...]\n"
+					"\tone row per sweep of every log, in order given, as <prefix>.<column>.npy:\n"
+					"\tstart_time (int64 UNIX seconds), noise_floor (float32 dBm, p" << FEATURE_FLOOR_PERCENTILE << " of bins),\n"
+					"\tmax_power (float32 dBm), peak_freq (float64 MHz), flatness (float32, 1 is white noise),\n"
+					"\tcentroid (float64 MHz), occupied (uint32 bins " << FEATURE_OCCUPIED_DB << "dB above noise floor),\n"
+					"\ttotal_power (float32 dBm)\n"
+					"\tprefix defaults to \"features\"" << endl;
+				return false;
+		}
+	}
+
+	for(int i = optind; i < argc; i++)
+		logfile_names.emplace_back(argv[i]);
+
+	if_error(logfile_names.empty(), "Error: no log file specified (-f).");
+	return true;
+}
+
+// one .npy per column, so trending one feature only reads that feature
+typedef struct
+{
+	npywriter_t start_time, noise_floor, max_power, peak_freq, flatness, centroid, occupied, total_power;
+} featurewriter_t;
+
+static void features_begin(featurewriter_t &w)
+{
+	npy_begin(w.start_time, output_prefix + ".start_time.npy", "i8", sizeof(int64_t), 0);
+	npy_begin(w.noise_floor, output_prefix + ".noise_floor.npy", "f4", sizeof(float), 0);
+	npy_begin(w.max_power, output_prefix + ".max_power.npy", "f4", sizeof(float), 0);
+	npy_begin(w.peak_freq, output_prefix + ".peak_freq.npy", "f8", sizeof(double), 0);
+	npy_begin(w.flatness, output_prefix + ".flatness.npy", "f4", sizeof(float), 0);
+	npy_begin(w.centroid, output_prefix + ".centroid.npy", "f8", sizeof(double), 0);
+	npy_begin(w.occupied, output_prefix + ".occupied.npy", "u4", sizeof(uint32_t), 0);
+	npy_begin(w.total_power, output_prefix + ".total_power.npy", "f4", sizeof(float), 0);
+}
+
+// rows to columns, then one write per column
+template <typename T>
+static void write_column(npywriter_t &npy, const vector<sweepfeatures_t> &rows, T sweepfeatures_t::*member)
+{
+	vector<T> column(rows.size());
+	for(size_t i = 0; i < rows.size(); i++)
+		column[i] = rows[i].*member;
+	npy_write_rows(npy, column.data(), column.size());
+}
+
+static void features_write(featurewriter_t &w, const vector<sweepfeatures_t> &rows)
+{
+	write_column(w.start_time, rows, &sweepfeatures_t::start_time);
+	write_column(w.noise_floor, rows, &sweepfeatures_t::noise_floor);
+	write_column(w.max_power, rows, &sweepfeatures_t::max_power);
+	write_column(w.peak_freq, rows, &sweepfeatures_t::peak_freq);
+	write_column(w.flatness, rows, &sweepfeatures_t::flatness);
+	write_column(w.centroid, rows, &sweepfeatures_t::centroid);
+	write_column(w.occupied, rows, &sweepfeatures_t::occupied);
+	write_column(w.total_power, rows, &sweepfeatures_t::total_power);
+}
+
+static size_t features_end(featurewriter_t &w)
+{
+	size_t bytes = 0;
+	for(npywriter_t *npy : {&w.start_time, &w.noise_floor, &w.max_power, &w.peak_freq, &w.flatness, &w.centroid, &w.occupied, &w.total_power})
+	{
+		bytes += npy->rows * npy->row_bytes;
+		npy_end(*npy);
+	}
+	return bytes;
+}
+
+// log is read chunk by chunk, records of a chunk are described in parallel
+static size_t extract_log(istream &logfile, featurewriter_t &w, size_t &bytes_read)
+{
+	logreader_t reader;
+	logreader_init(reader);
+	vector<float> power_data;
+	vector<logheader_t> headers;
+	vector<sweepfeatures_t> rows;
+	size_t records = 0;
+
+	while(true)
+	{
+		power_data.clear();
+		headers.clear();
+		const size_t count = read_records(reader, logfile, power_data, headers, FEATURE_CHUNK_RECORDS);
+		if(count == 0)
+			break;
+
+		rows.resize(count);
+		// a bad timestamp throws, which must happen out here, not inside the parallel region
+		for(size_t i = 0; i < count; i++)
+			rows[i].start_time = epoch_seconds(headers[i].start_time);
+		const size_t steps = reader.first_header.steps;
+		#pragma omp parallel for schedule(static)
+		for(size_t i = 0; i < count; i++)
+			sweep_features(headers[i], &power_data[i * steps], rows[i]);
+		features_write(w, rows);
+		records += count;
+	}
+
+	if_error(records == 0, "Error: no valid record found in log file");
+	bytes_read += reader.bytes_read;
+	return records;
+}
+
+int main(int argc, char *argv[])
+{
+try
+{
+	if(parse_args(argc, argv) == false)
+		return EXIT_FAILURE;
+
+	const auto start_time = now();
+	featurewriter_t writer;
+	features_begin(writer);
+	size_t records = 0;
+	size_t bytes_read = 0;
+	for(const auto &logfile_name : logfile_names)
+	{
+		if(logfile_name == "-")
+		{
+			records += extract_log(cin, writer, bytes_read);
+		}
+		else
+		{
+			fstream logfile_stream(logfile_name, ios::in);
+			if_error(!logfile_stream.is_open(), "Error: could not open file " + logfile_name);
+			records += extract_log(logfile_stream, writer, bytes_read);
+		}
+	}
+	const size_t bytes_written = features_end(writer);
+
+	const double elapsed = std::chrono::duration<double>(now() - start_time).count();
+	print("Written {}.*.npy, {} sweeps of {} logs, {:.1f}MiB of log -> {:.1f}KiB, {:.3f} seconds\n",
+		output_prefix, records, logfile_names.size(), bytes_read / 1048576.0, bytes_written / 1024.0, elapsed);
+}
+catch(const StringException &e)
+{
+	cerr << e.what() << endl;
+	return EXIT_FAILURE;
+}
+
+	return EXIT_SUCCESS;
+}
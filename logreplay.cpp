@@ -0,0 +1,570 @@
+/*
+ *   logreplay - replay log files into spsave's live outputs or a fake tinySA
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "baseline.hpp"
+#include "alert.hpp"
+#include "logwriter.hpp"
+#include <algorithm>
+#include <csignal>
+#include <fcntl.h>
+#include <termios.h>
+#include <getopt.h>
+
+static vector<string> logfile_names;
+static double speed = 1; // 0 means as fast as possible
+static bool rewrite_time = false;
+static bool loop = false;
+static bool streaming = false; // parse while replaying instead of before
+static string filename_prefix = ""; // empty means no log output
+static size_t max_records = 1440;
+static deadband_t db = {0, 60, 0, {}, {}, {}, 0, 0, 0};
+static string baseline_file = "";
+static float baseline_alpha = BASELINE_DEFAULT_ALPHA;
+static string mask_file = "";
+static string alert_target = "";
+static bool pty_mode = false;
+static string model = "tinySA4";
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop_replay(int)
+{
+	stopping = 1;
+}
+
+bool parse_args(int argc, char *argv[])
+{
+	int opt;
+	while((opt = getopt(argc, argv, "f:S:Rlsp:x:d:K:b:a:M:A:Pm:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'f':
+				logfile_names.emplace_back(optarg);
+				break;
+			case 'S':
+				speed = atof(optarg);
+				if_error(!(speed >= 0), "Error: invalid replay speed for -S");
+				break;
+			case 'R':
+				rewrite_time = true;
+				break;
+			case 'l':
+				loop = true;
+				break;
+			case 's':
+				streaming = true;
+				break;
+			case 'p':
+				filename_prefix = optarg;
+				break;
+			case 'x':
+				max_records = atoll(optarg);
+				break;
+			case 'd':
+				db.deadband = atof(optarg);
+				if_error(db.deadband < 0, "Error: deadband must not be negative");
+				break;
+			case 'K':
+				db.keyframe_interval = atoll(optarg);
+				if_error(db.keyframe_interval == 0, "Error: keyframe interval must be at least 1");
+				break;
+			case 'b':
+				baseline_file = optarg;
+				break;
+			case 'a':
+				baseline_alpha = atof(optarg);
+				if_error(!(baseline_alpha > 0 && baseline_alpha <= 1), "Error: baseline alpha must be in (0, 1]");
+				break;
+			case 'M':
+				mask_file = optarg;
+				break;
+			case 'A':
+				alert_target = optarg;
+				break;
+			case 'P':
+				pty_mode = true;
+				break;
+			case 'm':
+				model = optarg;
+				if_error(model != "tinySA" && model != "tinySA4", "Error: unknown model " + model);
+				break;
+			case 'h':
+			default:
+				cerr << "Usage: " << argv[0] <<
+					" [-f <log file>] [-S <speed>] [-R] [-l] [-s] [outputs] [more log files...]\n"
+					"\t-S replay speed, 1 is real time (default), 60 is a minute per second, 0 is as fast as possible\n"
+					"\t-R rewrite timestamps to replay time, default: keep the logged ones\n"
+					"\t-l start over after the last log, until interrupted\n"
+					"\t-s parse logs while replaying, memory usage doesn't depend on their length, but\n"
+					"\t   parsing limits speed, by default all logs are parsed before replay starts\n"
+					"outputs, same as spsave:\n"
+					"\t-p <filename prefix> [-x <max records>] [-d <deadband dB>] [-K <keyframe interval>]\n"
+					"\t-b <baseline file> [-a <alpha>]\n"
+					"\t-M <mask file> [-A <alert target>], minimum durations are in log time\n"
+					"or act as a tinySA for spsave & other clients:\n"
+					"\t-P [-m <tinySA|tinySA4>]	answer scanraw on a pseudo terminal with one record each" << endl;
+				return false;
+		}
+	}
+
+	for(int i = optind; i < argc; i++)
+		logfile_names.emplace_back(argv[i]);
+
+	if_error(logfile_names.empty(), "Error: no log file specified (-f).");
+	if_error(pty_mode && !(filename_prefix.empty() && baseline_file.empty() && mask_file.empty()),
+		"Error: -P can't be used with other outputs, run spsave on the pseudo terminal instead");
+	if_error(loop && streaming && std::count(logfile_names.begin(), logfile_names.end(), "-") > 0,
+		"Error: can't loop over standard input with -s");
+
+	return true;
+}
+
+// maps log time onto replay time
+typedef struct
+{
+	bool started;
+	int64_t first; // log time of first record, UNIX seconds
+	time_point<steady_clock> steady_start;
+	time_point<system_clock> system_start;
+} replayclock_t;
+
+// a whole log, parsed before replay
+typedef struct
+{
+	vector<float> power_data;
+	vector<logheader_t> headers;
+	vector<int64_t> start_times;
+	vector<int64_t> end_times;
+} loadedlog_t;
+
+static size_t load_log(loadedlog_t &log, const string &name)
+{
+	size_t bytes_read;
+	if(name == "-")
+	{
+		bytes_read = parse_logfile(log.power_data, log.headers, cin);
+	}
+	else
+	{
+		fstream logfile(name, ios::in);
+		if_error(!logfile.is_open(), "Error: could not open file " + name);
+		bytes_read = parse_logfile(log.power_data, log.headers, logfile);
+	}
+
+	log.start_times.resize(log.headers.size());
+	log.end_times.resize(log.headers.size());
+	for(size_t i = 0; i < log.headers.size(); i++)
+	{
+		log.start_times[i] = epoch_seconds(log.headers[i].start_time);
+		log.end_times[i] = epoch_seconds(log.headers[i].end_time);
+	}
+	return bytes_read;
+}
+
+// wait until record is due, returns its log time on steady clock for debouncing
+static time_point<steady_clock> replay_wait(replayclock_t &c, int64_t start)
+{
+	if(!c.started)
+	{
+		c.started = true;
+		c.first = start;
+		c.steady_start = steady_clock::now();
+		c.system_start = now();
+	}
+	const std::chrono::duration<double> log_offset(start - c.first);
+	if(speed > 0)
+		std::this_thread::sleep_until(c.steady_start + duration_cast<steady_clock::duration>(log_offset / speed));
+	return c.steady_start + duration_cast<steady_clock::duration>(log_offset);
+}
+
+// start & end time of record as replayed, a sweep takes 1 / speed of its logged time
+static void rewrite_times(const replayclock_t &c, logheader_t &h, int64_t start, int64_t end)
+{
+	const std::chrono::duration<double> log_offset(start - c.first);
+	const std::chrono::duration<double> length(end - start);
+	const auto replay_start = speed > 0 ?
+		c.system_start + duration_cast<system_clock::duration>(log_offset / speed) : now();
+	const auto replay_end = replay_start + duration_cast<system_clock::duration>(speed > 0 ? length / speed : length * 0);
+	h.start_time = time_str(replay_start);
+	h.end_time = time_str(replay_end);
+}
+
+// log files, baseline & alerts, the way spsave drives them
+typedef struct
+{
+	fstream output;
+	size_t record_count; // in current log file
+	baseline_t baseline;
+	bool baseline_ready;
+	alertengine_t alerts;
+	logheader_t alert_h; // frequency plan alerts were planned for
+	vector<float> sweep;
+	size_t anomalies;
+	size_t events;
+} sinks_t;
+
+static bool same_plan(const logheader_t &a, const logheader_t &b)
+{
+	return a.start_freq == b.start_freq && a.stop_freq == b.stop_freq && a.steps == b.steps;
+}
+
+static void sinks_record(sinks_t &s, logheader_t &h, const float *samples, time_point<steady_clock> log_time)
+{
+	s.sweep.assign(samples, samples + h.steps);
+
+	if(!mask_file.empty())
+	{
+		// logs of a different frequency plan may follow each other
+		if(!same_plan(s.alert_h, h))
+		{
+			alert_plan(s.alerts, h);
+			s.alert_h = h;
+		}
+		s.events += alert_evaluate(s.alerts, s.sweep, steady_clock::now(), log_time, h.end_time);
+	}
+
+	if(!filename_prefix.empty())
+	{
+		if(!s.output.is_open() || (max_records != 0 && s.record_count >= max_records))
+		{
+			const string filename = new_logfile(s.output, filename_prefix, h.start_time, db);
+			print("\nNew log file: {}\n", filename);
+			s.record_count = 0;
+		}
+		if(db.deadband > 0)
+			write_deadband_record(s.output, h, s.sweep, db);
+		else
+			write_record(s.output, h, s.sweep);
+		if_error(!s.output.good(), "Error: failed to write log file");
+		s.record_count++;
+	}
+
+	if(!baseline_file.empty())
+	{
+		if(!s.baseline_ready)
+		{
+			if(baseline_load(s.baseline, baseline_file, h))
+			{
+				print("Loaded baseline: {}, {} sweeps\n", baseline_file, s.baseline.sweeps);
+			}
+			else
+			{
+				print("Starting new baseline: {}\n", baseline_file);
+				baseline_init(s.baseline, h, baseline_alpha);
+			}
+			s.baseline.alpha = baseline_alpha;
+			s.baseline_ready = true;
+		}
+		if(baseline_matches(s.baseline, h))
+		{
+			if(s.baseline.sweeps > 0)
+			{
+				vector<float> z(h.steps);
+				s.anomalies += baseline_score(s.baseline, samples, z.data(), ZSCORE_DEFAULT_THRESHOLD);
+			}
+			baseline_update(s.baseline, samples);
+		}
+	}
+}
+
+// pseudo terminal that talks like a tinySA, one record per scanraw
+typedef struct
+{
+	int master;
+	int slave; // kept open, so master never sees a hangup between clients
+	string path;
+	int zero_level;
+	string pending; // received, not yet a full command
+	string response;
+	bool warned_steps;
+} fakedevice_t;
+
+static void fake_open(fakedevice_t &d)
+{
+	d.master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if_error(d.master < 0 || grantpt(d.master) != 0 || unlockpt(d.master) != 0, "Error: cannot create pseudo terminal");
+	const char *name = ptsname(d.master);
+	if_error(name == nullptr, "Error: cannot create pseudo terminal");
+	d.path = name;
+	d.slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if_error(d.slave < 0, "Error: cannot open " + d.path);
+
+	// raw like the USB CDC of a real device, a client may still set its own termios
+	struct termios tty;
+	tcgetattr(d.slave, &tty);
+	cfmakeraw(&tty);
+	tcsetattr(d.slave, TCSANOW, &tty);
+
+	d.zero_level = model == "tinySA" ? ZERO_LEVEL : ZERO_LEVEL_ULTRA;
+	d.warned_steps = false;
+}
+
+static void fake_close(fakedevice_t &d)
+{
+	close(d.slave);
+	close(d.master);
+}
+
+// next command from client, without "\r", false when interrupted
+static bool fake_read_command(fakedevice_t &d, string &command)
+{
+	while(true)
+	{
+		const size_t end = d.pending.find_first_of("\r\n");
+		if(end != string::npos)
+		{
+			command = d.pending.substr(0, end);
+			d.pending.erase(0, end + 1);
+			return true;
+		}
+
+		char buffer[256];
+		const ssize_t n = read(d.master, buffer, sizeof(buffer));
+		if(n < 0 && errno == EINTR && !stopping)
+			continue;
+		if(n <= 0)
+			return false;
+		d.pending.append(buffer, n);
+	}
+}
+
+static void fake_write(fakedevice_t &d, const string &data)
+{
+	for(size_t done = 0; done < data.size(); )
+	{
+		const ssize_t n = write(d.master, data.data() + done, data.size() - done);
+		if(n < 0 && errno == EINTR && !stopping)
+			continue;
+		if_error(n <= 0, "Error: failed to write to " + d.path);
+		done += n;
+	}
+}
+
+// inverse of spsave's decode, "x<low byte><high byte>" per point
+static void encode_scanraw(const float *samples, size_t points, int zero_level, string &out)
+{
+	const size_t first = out.size();
+	out.resize(first + points * 3);
+	char *raw = &out[first];
+	for(size_t i = 0; i < points; i++)
+	{
+		const long data = std::clamp<long>(std::lrint((samples[i] + zero_level) * 32.0f), 0, UINT16_MAX);
+		raw[i * 3] = 'x';
+		raw[i * 3 + 1] = data & 0xff;
+		raw[i * 3 + 2] = data >> 8;
+	}
+}
+
+// answers everything until a scanraw comes, which gets the record, false when client is gone
+static bool fake_serve(fakedevice_t &d, const logheader_t &h, const float *samples, replayclock_t &clock, int64_t start)
+{
+	string command;
+	while(fake_read_command(d, command))
+	{
+		// what a client didn't read, like spsave's answer to "resume", would be taken by
+		// the next one as its answer, unlike USB there's no disconnect to drop it
+		tcflush(d.slave, TCIFLUSH);
+		// the shell echoes every command
+		d.response = command + "\r\n";
+		size_t points = 0;
+		if(sscanf(command.c_str(), "scanraw %*f %*f %zu", &points) != 1)
+		{
+			d.response += "ch> ";
+			fake_write(d, d.response);
+			continue;
+		}
+
+		if(points != h.steps && !d.warned_steps)
+		{
+			cerr << format("\nWarning: client asked for {} points, log has {}, sending what's logged\n", points, h.steps);
+			d.warned_steps = true;
+		}
+		replay_wait(clock, start);
+		d.response += '{';
+		encode_scanraw(samples, h.steps, d.zero_level, d.response);
+		d.response += "}ch> ";
+		fake_write(d, d.response);
+		return true;
+	}
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+try
+{
+	if(parse_args(argc, argv) == false)
+		return EXIT_FAILURE;
+
+	// interrupting ends replay, so outputs are closed & statistics printed
+	struct sigaction action = {};
+	action.sa_handler = stop_replay;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	sinks_t sinks;
+	sinks.record_count = 0;
+	sinks.baseline_ready = false;
+	sinks.alert_h = {0, 0, 0, 0, "", "", false};
+	sinks.anomalies = 0;
+	sinks.events = 0;
+	if(!mask_file.empty())
+	{
+		alert_load_mask(sinks.alerts, mask_file);
+		alert_start(sinks.alerts, alert_target);
+		print("Loaded mask: {}, {} ranges\n", mask_file, sinks.alerts.ranges.size());
+	}
+
+	fakedevice_t device;
+	if(pty_mode)
+	{
+		fake_open(device);
+		print("Replaying as {} on {}\n", model, device.path);
+		fflush(stdout); // client is usually started by a script reading this
+
+	}
+
+	// parsing is much slower than replaying, so logs are parsed once before replay starts
+	vector<loadedlog_t> logs;
+	size_t bytes_read = 0;
+	if(!streaming)
+	{
+		for(const auto &name : logfile_names)
+		{
+			logs.emplace_back();
+			bytes_read += load_log(logs.back(), name);
+			print("Loaded {}, {} records\n", name, logs.back().headers.size());
+		}
+	}
+
+	replayclock_t clock = {false, 0, {}, {}};
+	size_t records = 0;
+	const auto start_time = steady_clock::now();
+	auto report_time = start_time;
+	size_t report_records = 0;
+	logheader_t h;
+
+	auto replay_record = [&](const logheader_t &header, const float *samples, int64_t start, int64_t end)
+	{
+		if(pty_mode)
+		{
+			if(!fake_serve(device, header, samples, clock, start))
+			{
+				stopping = 1;
+				return false;
+			}
+		}
+		else
+		{
+			const auto log_time = replay_wait(clock, start) + seconds(end - start);
+			h = header;
+			if(rewrite_time)
+				rewrite_times(clock, h, start, end);
+			sinks_record(sinks, h, samples, log_time);
+		}
+		records++;
+
+		// progress once a second, printing every record would be the bottleneck
+		const auto t = steady_clock::now();
+		if(t - report_time >= seconds(1))
+		{
+			const double rate = (records - report_records) / std::chrono::duration<double>(t - report_time).count();
+			cout << format("\r[{:8d}] {} {:.0f} sweeps/s   ", records, header.start_time, rate) << flush;
+			report_time = t;
+			report_records = records;
+		}
+		return !stopping;
+	};
+
+	auto stream_callback = [&](const logheader_t &header, const float *samples)
+	{
+		return replay_record(header, samples, epoch_seconds(header.start_time), epoch_seconds(header.end_time));
+	};
+
+	do
+	{
+		if(streaming)
+		{
+			for(const auto &name : logfile_names)
+			{
+				logreader_t reader;
+				logreader_init(reader);
+				if(name == "-")
+				{
+					stream_records(reader, cin, stream_callback);
+				}
+				else
+				{
+					fstream logfile(name, ios::in);
+					if_error(!logfile.is_open(), "Error: could not open file " + name);
+					stream_records(reader, logfile, stream_callback);
+				}
+				bytes_read += reader.bytes_read;
+				if(stopping)
+					break;
+			}
+		}
+		else
+		{
+			for(const auto &log : logs)
+			{
+				const size_t steps = log.headers.front().steps;
+				for(size_t i = 0; i < log.headers.size() && !stopping; i++)
+					if(!replay_record(log.headers[i], &log.power_data[i * steps], log.start_times[i], log.end_times[i]))
+						break;
+				if(stopping)
+					break;
+			}
+		}
+		// next round starts again from now
+		clock.started = false;
+	} while(loop && !stopping && records > 0);
+
+	const double elapsed = std::chrono::duration<double>(steady_clock::now() - start_time).count();
+	print("\nReplayed {} records in {:.3f} seconds, {:.0f} sweeps/s, {:.1f}MiB of log read\n",
+		records, elapsed, records / elapsed, bytes_read / 1048576.0);
+
+	if(pty_mode)
+		fake_close(device);
+	if(sinks.output.is_open())
+		sinks.output.close();
+	if(db.deadband > 0 && db.bytes_full > 0)
+		print("Deadband: {:.1f}% smaller than full records ({:.1f}MiB instead of {:.1f}MiB)\n",
+			100.0 - 100.0 * db.bytes_written / db.bytes_full, db.bytes_written / 1048576.0, db.bytes_full / 1048576.0);
+	if(sinks.baseline_ready)
+	{
+		baseline_save(sinks.baseline, baseline_file);
+		print("Baseline: {} sweeps, {} anomalous bins during replay\n", sinks.baseline.sweeps, sinks.anomalies);
+	}
+	if(!mask_file.empty())
+	{
+		print("{} alert events\n", sinks.events);
+		alert_stop(sinks.alerts);
+	}
+}
+catch(const StringException &e)
+{
+	cerr << e.what() << endl;
+	return EXIT_FAILURE;
+}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,315 @@
+/*
+ *   logwriter: log file output shared by spsave & logreplay
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "logwriter.hpp"
+#include "trace.hpp"
+#include "probes.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// semaphores of probes fired from here & spsave.cpp
+PROBE_SEMAPHORE(write__done);
+PROBE_SEMAPHORE(rotate);
+
+using std::chrono::steady_clock;
+
+// append_power() takes a shortcut for these, others are formatted by fmt
+static inline bool fast_power(float power)
+{
+	return isfinite(power) && std::fabs(power) < 1e14f;
+}
+
+// power * 10 is exact in double, so rounding it half to even gives the same digits as {:.1f}
+// adding & taking away 1.5 * 2^52 rounds like nearbyint() below 2^51, without a libm call
+static inline int64_t power_tenths(float power)
+{
+	const double tenths = power * 10.0;
+	return (tenths + 0x1.8p52) - 0x1.8p52;
+}
+
+static inline size_t decimal_digits(uint64_t value)
+{
+	size_t digits = 1;
+	for(; value >= 10000; value /= 10000)
+		digits += 4;
+	return digits + (value >= 10) + (value >= 100) + (value >= 1000);
+}
+
+// length of what append_power() appends for a fast_power(), newline included
+static inline size_t power_length(float power, int64_t tenths)
+{
+	// tenths digit, '.' & '\n', at least one digit before '.'
+	return std::signbit(power) + std::max<size_t>(decimal_digits(std::abs(tenths)), 2) + 2;
+}
+
+// same as format("{},", bin)
+static inline void append_bin(fmt::memory_buffer &buffer, size_t bin)
+{
+	char digits[24];
+	char *p = digits + sizeof(digits);
+	*--p = ',';
+	do
+	{
+		*--p = '0' + bin % 10;
+		bin /= 10;
+	} while(bin != 0);
+	buffer.append(p, digits + sizeof(digits));
+}
+
+// power as rounded by power_tenths(), negative keeps the sign of -0.0
+static inline void append_tenths(fmt::memory_buffer &buffer, int64_t power_tenths, bool negative)
+{
+	char digits[24];
+	char *p = digits + sizeof(digits);
+	uint64_t tenths = std::abs(power_tenths);
+	*--p = '\n';
+	*--p = '0' + tenths % 10;
+	*--p = '.';
+	tenths /= 10;
+	do
+	{
+		*--p = '0' + tenths % 10;
+		tenths /= 10;
+	} while(tenths != 0);
+	if(negative)
+		*--p = '-';
+	buffer.append(p, digits + sizeof(digits));
+}
+
+// same as format("{:.1f}\n", power), which is most of the time spent writing a record
+static inline void append_power(fmt::memory_buffer &buffer, float power)
+{
+	if(!fast_power(power))
+		fmt::format_to(std::back_inserter(buffer), "{:.1f}\n", power);
+	else
+		append_tenths(buffer, power_tenths(power), std::signbit(power));
+}
+
+static void append_header(fmt::memory_buffer &buffer, const logheader_t &h)
+{
+	// # <start_freq>,<stop_freq>,<steps>,<RBW>,<start_time>,<end_time>[,calibrated]
+	fmt::format_to(std::back_inserter(buffer), "$ {:.06f},{:.06f},{},{:.03f},{},{}{}\n",
+		h.start_freq, h.stop_freq, h.steps, h.rbw, h.start_time, h.end_time, h.calibrated ? LOG_CALIBRATED_FIELD : "");
+}
+
+void format_record(fmt::memory_buffer &buffer, const logheader_t &h, const vector<float> &sweep)
+{
+	append_header(buffer, h);
+	for(const float power : sweep)
+		append_power(buffer, power);
+	buffer.push_back('\n'); // one empty line between each scan
+}
+
+// whole record is formatted into one buffer, so it's a single write & flush
+void write_record(fstream &output, const logheader_t &h, const vector<float> &sweep)
+{
+	trace_begin("write record");
+	const auto write_start = PROBE_START(write__done);
+	fmt::memory_buffer buffer;
+	format_record(buffer, h, sweep);
+	output.write(buffer.data(), buffer.size());
+	output.flush();
+	trace_end("write record");
+	PROBE2(write__done, sweep.size(), probe_elapsed_ns(write_start));
+}
+
+// a full keyframe every keyframe_interval sweeps, otherwise only the points
+// that moved more than deadband away from what reader already has, so every
+// reconstructed point is within deadband of the full log
+// values are compared as the integer tenths of a dB they're logged with
+size_t format_deadband_record(fmt::memory_buffer &buffer, const logheader_t &h, const vector<float> &sweep, deadband_t &db)
+{
+	const size_t buffer_start = buffer.size();
+	const size_t steps = sweep.size();
+	const int64_t deadband = std::floor(db.deadband * 10 + 1e-3);
+	bool keyframe = db.since_keyframe == 0 || db.since_keyframe >= db.keyframe_interval ||
+		steps != db.stored.size();
+
+	// one pass for what both kinds of record would take, "<dBm>\n" & "<bin>,<dBm>\n" per point
+	db.current.resize(steps);
+	db.changed.resize(steps);
+	size_t changed = 0;
+	size_t full_bytes = 0;
+	size_t delta_bytes = 0;
+	for(size_t i = 0; i < steps; i++)
+	{
+		const float power = sweep[i];
+		if(!fast_power(power))
+		{
+			// points fmt has to format are rare enough to just send a keyframe,
+			// & compare as changed against anything after it
+			full_bytes += fmt::formatted_size("{:.1f}\n", power);
+			db.current[i] = std::numeric_limits<int64_t>::min() / 2;
+			keyframe = true;
+			continue;
+		}
+		const int64_t tenths = power_tenths(power);
+		const size_t length = power_length(power, tenths);
+		db.current[i] = tenths;
+		full_bytes += length;
+		if(keyframe)
+			continue;
+		// noise moves points at random, so it's counted without a branch to mispredict
+		const bool moved = std::abs(tenths - db.stored[i]) > deadband;
+		db.changed[changed] = i;
+		changed += moved;
+		delta_bytes += moved * (decimal_digits(i) + 1 + length);
+	}
+	db.changed.resize(changed);
+	// count of changed points is the only thing a delta header has over a keyframe's
+	if(delta_bytes + decimal_digits(changed) + 1 >= full_bytes)
+		keyframe = true;
+
+	size_t written = 0;
+	if(keyframe)
+	{
+		append_header(buffer, h);
+		for(size_t i = 0; i < steps; i++)
+		{
+			if(fast_power(sweep[i]))
+				append_tenths(buffer, db.current[i], std::signbit(sweep[i]));
+			else
+				append_power(buffer, sweep[i]);
+		}
+		db.stored.swap(db.current);
+		written = steps;
+		db.since_keyframe = 1;
+	}
+	else
+	{
+		fmt::format_to(std::back_inserter(buffer), "% {:.06f},{:.06f},{},{:.03f},{},{},{}{}\n",
+			h.start_freq, h.stop_freq, h.steps, h.rbw, h.start_time, h.end_time, db.changed.size(),
+			h.calibrated ? LOG_CALIBRATED_FIELD : "");
+		for(const size_t i : db.changed)
+		{
+			append_bin(buffer, i);
+			append_tenths(buffer, db.current[i], std::signbit(sweep[i]));
+			db.stored[i] = db.current[i];
+		}
+		written = db.changed.size();
+		db.since_keyframe++;
+	}
+	buffer.push_back('\n'); // one empty line between each scan
+
+	db.points_written += written;
+	db.bytes_written += buffer.size() - buffer_start;
+	db.bytes_full += fmt::formatted_size("$ {:.06f},{:.06f},{},{:.03f},{},{}\n",
+		h.start_freq, h.stop_freq, h.steps, h.rbw, h.start_time, h.end_time) + full_bytes + 1;
+	return written;
+}
+
+size_t write_deadband_record(fstream &output, const logheader_t &h, const vector<float> &sweep, deadband_t &db)
+{
+	trace_begin("write deadband record");
+	const auto write_start = PROBE_START(write__done);
+	fmt::memory_buffer buffer;
+	const size_t written = format_deadband_record(buffer, h, sweep, db);
+	output.write(buffer.data(), buffer.size());
+	output.flush();
+	trace_end("write deadband record");
+	PROBE2(write__done, written, probe_elapsed_ns(write_start));
+	return written;
+}
+
+// every log file starts with a keyframe, so it can be read on its own
+const string new_logfile(fstream &output, const string &filename_prefix, const string &start_time, deadband_t &db)
+{
+	const auto rotate_start = PROBE_START(rotate);
+	db.since_keyframe = 0;
+	const string filename = {filename_prefix + '.' + start_time + ".log"};
+	if(output.is_open())
+		output.close();
+	output.open(filename, std::ios::out);
+	if_error(!output.is_open(), "Error: cannot open output file");
+	PROBE2(rotate, filename.c_str(), probe_elapsed_ns(rotate_start));
+
+	return filename;
+}
+
+// same, for writing through raw fd, appends only
+const string new_logfile(int &fd, const string &filename_prefix, const string &start_time, deadband_t &db)
+{
+	const auto rotate_start = PROBE_START(rotate);
+	db.since_keyframe = 0;
+	const string filename = {filename_prefix + '.' + start_time + ".log"};
+	close_logfile(fd);
+	fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if_error(fd < 0, "Error: cannot open output file");
+	PROBE2(rotate, filename.c_str(), probe_elapsed_ns(rotate_start));
+
+	return filename;
+}
+
+void close_logfile(int &fd)
+{
+	if(fd < 0)
+		return;
+	// only costs disk space if it fails
+	struct stat st;
+	if(fstat(fd, &st) != 0 || ftruncate(fd, st.st_size) != 0)
+		cerr << "Warning: cannot release preallocated space of log file: " << strerror(errno) << endl;
+	close(fd);
+	fd = -1;
+}
+
+bool preallocate_logfile(int fd, size_t offset, size_t bytes)
+{
+	// EOPNOTSUPP on filesystems without extents, appending still works
+	return fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, bytes) == 0;
+}
+
+bool parse_rotation(const string &str, rotation_t &rotation)
+{
+	if(str == "hour")
+		rotation = rotation_t::hour;
+	else if(str == "day")
+		rotation = rotation_t::day;
+	else if(str == "week")
+		rotation = rotation_t::week;
+	else
+		return false;
+	return true;
+}
+
+std::chrono::seconds rotation_period(rotation_t rotation)
+{
+	switch(rotation)
+	{
+		case rotation_t::hour:
+			return std::chrono::hours(1);
+		case rotation_t::day:
+			return std::chrono::hours(24);
+		case rotation_t::week:
+			return std::chrono::hours(24 * 7);
+		default:
+			return std::chrono::seconds(0);
+	}
+}
+
+const time_point<system_clock> next_rotation(const time_point<system_clock> &time, rotation_t rotation)
+{
+	if(rotation == rotation_t::none)
+		return time_point<system_clock>::max();
+	const auto period = rotation_period(rotation);
+	// 1970-01-01 is a Thursday, first Monday is 4 days later
+	const auto origin = time_point<system_clock>(rotation == rotation_t::week ? std::chrono::hours(24 * 4) : std::chrono::hours(0));
+	const auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(time - origin);
+	return origin + (elapsed / period + 1) * period;
+}
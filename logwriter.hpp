@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common.hpp"
+
+/* logwriter.hpp: log file output shared by spsave & logreplay */
+
+// deadband (change-only) logging state
+typedef struct
+{
+	float deadband; // dB, 0 means disabled
+	size_t keyframe_interval; // write a full record every N sweeps
+	size_t since_keyframe;
+	vector<int64_t> stored; // what a reader reconstructs for every bin, in tenths of a dB as logged
+	vector<int64_t> current; // this sweep in tenths of a dB, kept to avoid an allocation per sweep
+	vector<size_t> changed;
+
+	// for reporting data reduction
+	size_t points_written;
+	size_t bytes_written;
+	size_t bytes_full; // what full records of the same sweeps take
+} deadband_t;
+
+// log rotation aligned to UTC, weeks start on Monday
+enum class rotation_t { none, hour, day, week };
+
+// h.start_time & h.end_time are written as they are, a record is appended to buffer
+void format_record(fmt::memory_buffer &buffer, const logheader_t &h, const vector<float> &sweep);
+// a delta record that wouldn't be smaller than a keyframe is written as one
+// returns number of points written
+size_t format_deadband_record(fmt::memory_buffer &buffer, const logheader_t &h, const vector<float> &sweep, deadband_t &db);
+// same, written & flushed as one write
+void write_record(fstream &output, const logheader_t &h, const vector<float> &sweep);
+// returns number of points written
+size_t write_deadband_record(fstream &output, const logheader_t &h, const vector<float> &sweep, deadband_t &db);
+// <prefix>.<start time>.log, closes the previous one
+const string new_logfile(fstream &output, const string &filename_prefix, const string &start_time, deadband_t &db);
+const string new_logfile(int &fd, const string &filename_prefix, const string &start_time, deadband_t &db);
+// releases blocks preallocated beyond what's written, then closes
+void close_logfile(int &fd);
+// reserves bytes from offset on disk without changing file size, so appends don't fragment the file
+// false if filesystem can't do it
+bool preallocate_logfile(int fd, size_t offset, size_t bytes);
+bool parse_rotation(const string &str, rotation_t &rotation);
+std::chrono::seconds rotation_period(rotation_t rotation);
+// first boundary after time, never for rotation_t::none
+const time_point<system_clock> next_rotation(const time_point<system_clock> &time, rotation_t rotation);
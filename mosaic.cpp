@@ -0,0 +1,117 @@
+/*
+ *   mosaic - align logs of several bands on a common time grid
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "mosaic.hpp"
+#include "trace.hpp"
+#include <algorithm>
+
+static void load_band(band_t &band, const string &logfile_name)
+{
+	band.name = logfile_name;
+	if(logfile_name == "-")
+	{
+		band.bytes_read = parse_logfile(band.power_data, band.headers, cin);
+	}
+	else
+	{
+		fstream logfile(logfile_name, ios::in);
+		if_error(!logfile.is_open(), "Error: could not open file " + logfile_name);
+		band.bytes_read = parse_logfile(band.power_data, band.headers, logfile);
+	}
+
+	band.start_times.resize(band.headers.size());
+	for(size_t i = 0; i < band.headers.size(); i++)
+		band.start_times[i] = epoch_seconds(band.headers[i].start_time);
+
+	// median is robust against gaps & jitter of a few seconds
+	if(band.start_times.size() > 1)
+	{
+		vector<int64_t> intervals(band.start_times.size() - 1);
+		for(size_t i = 0; i < intervals.size(); i++)
+			intervals[i] = band.start_times[i + 1] - band.start_times[i];
+		std::nth_element(intervals.begin(), intervals.begin() + intervals.size() / 2, intervals.end());
+		band.interval = intervals[intervals.size() / 2];
+	}
+	else
+	{
+		band.interval = epoch_seconds(band.headers.front().end_time) - band.start_times.front();
+	}
+	band.interval = std::max<int64_t>(band.interval, 1);
+}
+
+void mosaic_load(vector<band_t> &bands, const vector<string> &logfile_names)
+{
+	bands.resize(logfile_names.size());
+	string error;
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(size_t i = 0; i < logfile_names.size(); i++)
+	{
+		try
+		{
+			trace_begin("parse band");
+			load_band(bands[i], logfile_names[i]);
+			trace_end("parse band");
+		}
+		catch(const std::exception &e)
+		{
+			// exceptions can't leave an OpenMP region
+			#pragma omp critical(mosaic_error)
+			error = format("{}: {}", logfile_names[i], e.what());
+		}
+	}
+
+	if_error(!error.empty(), error);
+}
+
+timegrid_t mosaic_grid(const vector<band_t> &bands)
+{
+	int64_t first = INT64_MAX;
+	int64_t last = INT64_MIN;
+	int64_t step = INT64_MAX;
+	for(const auto &band : bands)
+	{
+		first = std::min(first, *std::min_element(band.start_times.begin(), band.start_times.end()));
+		last = std::max(last, *std::max_element(band.start_times.begin(), band.start_times.end()));
+		step = std::min(step, band.interval);
+	}
+
+	const timegrid_t grid = {first, step, static_cast<size_t>((last - first) / step + 1)};
+	if_error(grid.rows > MOSAIC_MAX_ROWS, format("Error: bands span {} rows of {} seconds, more than {}, do their logs overlap in time?",
+		grid.rows, grid.step, MOSAIC_MAX_ROWS));
+	return grid;
+}
+
+// latest record started by row time, it lasts until next one, but at most 2 intervals,
+// so jitter doesn't leave holes while real gaps stay black
+void mosaic_rows(const band_t &band, const timegrid_t &grid, vector<size_t> &records)
+{
+	records.assign(grid.rows, SIZE_MAX);
+	const size_t count = band.start_times.size();
+	size_t i = 0;
+	for(size_t row = 0; row < grid.rows; row++)
+	{
+		const int64_t t = grid.start + (int64_t)row * grid.step;
+		while(i + 1 < count && band.start_times[i + 1] <= t)
+			i++;
+		if(band.start_times[i] <= t && t < band.start_times[i] + 2 * band.interval)
+			records[row] = i;
+	}
+}
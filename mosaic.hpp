@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.hpp"
+
+/* mosaic.hpp: several bands (one log each) aligned on a common time grid */
+
+enum class mosaiclayout_t { side, stack };
+
+typedef struct
+{
+	string name; // log file
+	vector<float> power_data;
+	vector<logheader_t> headers;
+	vector<int64_t> start_times; // UNIX seconds
+	int64_t interval; // median seconds between records
+	size_t bytes_read;
+} band_t;
+
+// row r of every panel shows what was logged at start + r * step
+typedef struct
+{
+	int64_t start;
+	int64_t step;
+	size_t rows;
+} timegrid_t;
+
+// parse every log in parallel, one band each
+void mosaic_load(vector<band_t> &bands, const vector<string> &logfile_names);
+// from first record of any band to last record of any band, in steps of the finest interval
+timegrid_t mosaic_grid(const vector<band_t> &bands);
+// record shown on every row of grid, SIZE_MAX where band has nothing logged
+void mosaic_rows(const band_t &band, const timegrid_t &grid, vector<size_t> &records);
@@ -0,0 +1,234 @@
+/*
+ *   patches - cut spectrum logs into fixed-size patches for training datasets
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "patches.hpp"
+#include "trace.hpp"
+#include <algorithm>
+
+constexpr static char PATCH_SHARD_MAGIC[8] = {'S', 'P', 'P', 'A', 'T', 'C', 'H', '1'};
+constexpr static char PATCH_INDEX_MAGIC[8] = {'S', 'P', 'P', 'I', 'D', 'X', '1', '\0'};
+
+static inline int16_t quantize(float power)
+{
+	if(!isfinite(power))
+		return INT16_MIN;
+	const long q = std::lrint(power / PATCH_SCALE_DB);
+	return std::clamp<long>(q, INT16_MIN + 1, INT16_MAX);
+}
+
+// cut patches whose first record is window_first + row for every row in rows
+static void cut_patches(
+	const patchplan_t &plan,
+	const logheader_t &h,
+	const vector<float> &window,
+	const vector<int64_t> &start_times,
+	const vector<int64_t> &end_times,
+	size_t window_first,
+	const vector<size_t> &rows,
+	uint32_t file,
+	patchblock_t &block
+)
+{
+	const size_t steps = h.steps;
+	const size_t columns = (steps - plan.width) / plan.bin_stride + 1;
+	const size_t patch_size = (size_t)plan.height * plan.width;
+	const size_t first_patch = block.meta.size();
+	const size_t count = rows.size() * columns;
+	block.meta.resize(first_patch + count);
+	block.data.resize((first_patch + count) * patch_size);
+
+	// every patch is independent, a single log still uses every core
+	#pragma omp parallel for schedule(static) if(!omp_in_parallel())
+	for(size_t p = 0; p < count; p++)
+	{
+		const size_t row = rows[p / columns];
+		const size_t bin = (p % columns) * plan.bin_stride;
+		int16_t *out = &block.data[(first_patch + p) * patch_size];
+		for(size_t y = 0; y < plan.height; y++)
+		{
+			const float *in = &window[(row + y) * steps + bin];
+			for(size_t x = 0; x < plan.width; x++)
+				out[y * plan.width + x] = quantize(in[x]);
+		}
+
+		patchmeta_t &m = block.meta[first_patch + p];
+		m.shard = 0;
+		m.slot = 0;
+		m.file = file;
+		m.record = window_first + row;
+		m.bin = bin;
+		m.start_time = start_times[row];
+		m.end_time = end_times[row + plan.height - 1];
+		m.start_freq = bin_frequency(h, bin);
+		m.stop_freq = bin_frequency(h, bin + plan.width - 1);
+	}
+}
+
+// records are read in chunks, only rows still needed by a future patch are kept
+bool patch_logfile(const patchplan_t &plan, const string &logfile_name, uint32_t file, BoundedQueue<patchblock_t> &queue)
+{
+	fstream logfile_stream;
+	istream *logfile = &cin;
+	if(logfile_name != "-")
+	{
+		logfile_stream.open(logfile_name, ios::in);
+		if_error(!logfile_stream.is_open(), "Error: could not open file " + logfile_name);
+		logfile = &logfile_stream;
+	}
+
+	logreader_t reader;
+	logreader_init(reader);
+	vector<float> window; // rows [window_first, window_first + window_rows)
+	vector<int64_t> start_times;
+	vector<int64_t> end_times;
+	vector<logheader_t> headers;
+	size_t window_first = 0;
+	size_t next_patch_row = 0; // first record of next row of patches
+
+	while(true)
+	{
+		headers.clear();
+		const size_t count = read_records(reader, *logfile, window, headers, PATCH_CHUNK_RECORDS);
+		if(count == 0)
+			break;
+
+		const logheader_t &h = reader.first_header;
+		if_error(h.steps < plan.width, format("Error: {} has {} steps, fewer than patch width {}", logfile_name, h.steps, plan.width));
+		for(const auto &header : headers)
+		{
+			start_times.emplace_back(epoch_seconds(header.start_time));
+			end_times.emplace_back(epoch_seconds(header.end_time));
+		}
+
+		// rows of patches that are complete by now
+		const size_t window_end = window_first + start_times.size();
+		vector<size_t> rows;
+		for(; next_patch_row + plan.height <= window_end; next_patch_row += plan.time_stride)
+			rows.emplace_back(next_patch_row - window_first);
+		if(rows.empty())
+			continue;
+
+		trace_begin("cut patches");
+		patchblock_t block;
+		cut_patches(plan, h, window, start_times, end_times, window_first, rows, file, block);
+		trace_end("cut patches");
+		if(!queue.push(std::move(block)))
+			return false;
+
+		// drop rows no patch needs anymore
+		const size_t drop = std::min(next_patch_row, window_end) - window_first;
+		window.erase(window.begin(), window.begin() + drop * h.steps);
+		start_times.erase(start_times.begin(), start_times.begin() + drop);
+		end_times.erase(end_times.begin(), end_times.begin() + drop);
+		window_first += drop;
+	}
+
+	if_error(reader.first_header.steps == 0, "Error: no valid record found in " + logfile_name);
+	return true;
+}
+
+static void write_header(fstream &f, const char (&magic)[8], const patchplan_t &plan)
+{
+	f.write(magic, sizeof(magic));
+	write_pod(f, plan.height);
+	write_pod(f, plan.width);
+	write_pod(f, PATCH_SCALE_DB);
+}
+
+static void open_shard(patchwriter_t &w)
+{
+	if(w.shard.is_open())
+	{
+		w.shard.close();
+		if_error(w.shard.fail(), "Error: failed to write patch shard");
+	}
+	const string filename = format("{}.{:05d}.patches", w.prefix, w.shards);
+	w.shard.open(filename, ios::out | ios::binary | ios::trunc);
+	if_error(!w.shard.is_open(), "Error: cannot open patch shard " + filename);
+	write_header(w.shard, PATCH_SHARD_MAGIC, w.plan);
+	w.shards++;
+	w.slot = 0;
+}
+
+void patch_writer_begin(patchwriter_t &w, const string &prefix, const patchplan_t &plan, size_t shard_patches, const vector<string> &logfile_names)
+{
+	w.plan = plan;
+	w.prefix = prefix;
+	w.shard_patches = shard_patches;
+	w.shards = 0;
+	w.slot = 0;
+	w.patches = 0;
+
+	const string index_name = prefix + ".index";
+	w.index.open(index_name, ios::out | ios::binary | ios::trunc);
+	if_error(!w.index.is_open(), "Error: cannot open patch index " + index_name);
+	write_header(w.index, PATCH_INDEX_MAGIC, plan);
+	write_pod(w.index, static_cast<uint32_t>(logfile_names.size()));
+	for(const auto &name : logfile_names)
+	{
+		write_pod(w.index, static_cast<uint32_t>(name.size()));
+		w.index.write(name.data(), name.size());
+	}
+	w.count_offset = w.index.tellp();
+	write_pod(w.index, w.patches); // patched by patch_writer_end()
+
+	open_shard(w);
+}
+
+void patch_writer_add(patchwriter_t &w, patchblock_t &block)
+{
+	const size_t patch_size = (size_t)w.plan.height * w.plan.width;
+	for(size_t i = 0; i < block.meta.size(); )
+	{
+		if(w.slot == w.shard_patches)
+			open_shard(w);
+
+		// as many patches as fit in current shard, in one write
+		const size_t n = std::min(block.meta.size() - i, w.shard_patches - w.slot);
+		w.shard.write(reinterpret_cast<const char *>(&block.data[i * patch_size]), n * patch_size * sizeof(int16_t));
+		for(size_t j = i; j < i + n; j++)
+		{
+			patchmeta_t &m = block.meta[j];
+			m.shard = w.shards - 1;
+			m.slot = w.slot++;
+			write_pod(w.index, m.shard);
+			write_pod(w.index, m.slot);
+			write_pod(w.index, m.file);
+			write_pod(w.index, m.record);
+			write_pod(w.index, m.bin);
+			write_pod(w.index, m.start_time);
+			write_pod(w.index, m.end_time);
+			write_pod(w.index, m.start_freq);
+			write_pod(w.index, m.stop_freq);
+		}
+		w.patches += n;
+		i += n;
+	}
+	if_error(!w.shard.good() || !w.index.good(), "Error: failed to write patches");
+}
+
+void patch_writer_end(patchwriter_t &w)
+{
+	w.shard.close();
+	w.index.seekp(w.count_offset);
+	write_pod(w.index, w.patches);
+	w.index.close();
+	if_error(w.shard.fail() || w.index.fail(), "Error: failed to write patches");
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "common.hpp"
+#include "pipeline.hpp"
+
+/* patches.hpp: cut (record, bin) matrix into overlapping fixed-size patches for training datasets */
+
+// dataset layout (native endianness, like every other binary file here):
+//	<prefix>.<shard>.patches: magic, height, width, scale, then patches of int16 [height][width] back to back
+//	<prefix>.index: magic, height, width, scale, file count, (name length, name)[],
+//		patch count, (shard, slot, file, record, bin, start_time, end_time, start_freq, stop_freq)[]
+// values are dB / scale, NaN is INT16_MIN
+typedef struct
+{
+	uint32_t height; // records
+	uint32_t width; // bins
+	uint32_t time_stride;
+	uint32_t bin_stride;
+} patchplan_t;
+
+typedef struct
+{
+	uint32_t shard;
+	uint32_t slot; // patch number in shard
+	uint32_t file; // index into list of log files
+	uint32_t record; // first record in its log
+	uint32_t bin; // first bin
+	int64_t start_time; // UNIX seconds, start of first record
+	int64_t end_time; // end of last record
+	double start_freq; // MHz, first bin
+	double stop_freq; // MHz, last bin
+} patchmeta_t;
+
+// patches cut from one chunk of records, shard & slot are filled in by writer
+typedef struct
+{
+	vector<int16_t> data;
+	vector<patchmeta_t> meta;
+} patchblock_t;
+
+// cut every patch of one log and push them in blocks, returns false if queue was aborted
+bool patch_logfile(const patchplan_t &plan, const string &logfile_name, uint32_t file, BoundedQueue<patchblock_t> &queue);
+
+typedef struct
+{
+	patchplan_t plan;
+	string prefix;
+	size_t shard_patches; // patches per shard
+	fstream shard;
+	fstream index;
+	uint32_t shards;
+	uint32_t slot; // patches in current shard
+	uint64_t patches;
+	size_t count_offset; // where patch count is in index
+} patchwriter_t;
+
+void patch_writer_begin(patchwriter_t &w, const string &prefix, const patchplan_t &plan, size_t shard_patches, const vector<string> &logfile_names);
+void patch_writer_add(patchwriter_t &w, patchblock_t &block);
+void patch_writer_end(patchwriter_t &w);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+/* pipeline.hpp: bounded queue between pipeline stages */
+
+// producer blocks when queue is full, so a slow stage limits memory usage
+// instead of letting chunks pile up
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+	// returns false if pipeline was aborted
+	bool push(T &&item)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		not_full.wait(guard, [this] { return aborted || items.size() < capacity; });
+		if(aborted)
+			return false;
+		items.emplace_back(std::move(item));
+		not_empty.notify_one();
+		return true;
+	}
+
+	// returns false if there's nothing more to come
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		not_empty.wait(guard, [this] { return aborted || closed || !items.empty(); });
+		if(aborted || items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	// producer is done
+	void close()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closed = true;
+		not_empty.notify_all();
+	}
+
+	// some stage failed, wake everyone up
+	void abort()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		aborted = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+
+	bool failed()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return aborted;
+	}
+
+private:
+	const size_t capacity;
+	std::mutex lock;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::deque<T> items;
+	bool closed = false;
+	bool aborted = false;
+};
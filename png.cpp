@@ -0,0 +1,149 @@
+/*
+ *   png - streaming PNG writer
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "png.hpp"
+
+constexpr static uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+// offset of height & CRC of IHDR, which are patched when finished
+constexpr static size_t IHDR_DATA_OFFSET = 8 + 8;
+constexpr static size_t IHDR_SIZE = 13;
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void write_chunk(pngwriter_t &png, const char type[4], const uint8_t *data, size_t size)
+{
+	uint8_t be[4];
+	put_be32(be, size);
+	png.file.write(reinterpret_cast<const char *>(be), 4);
+	png.file.write(type, 4);
+	if(size > 0)
+		png.file.write(reinterpret_cast<const char *>(data), size);
+
+	uLong crc = crc32(0, reinterpret_cast<const Bytef *>(type), 4);
+	if(size > 0)
+		crc = crc32(crc, data, size); // crc32() resets on NULL data
+	put_be32(be, crc);
+	png.file.write(reinterpret_cast<const char *>(be), 4);
+}
+
+// run deflate over input, an IDAT chunk is written whenever buffer is full
+static void deflate_rows(pngwriter_t &png, const uint8_t *data, size_t size, int flush)
+{
+	png.z.next_in = const_cast<Bytef *>(data);
+	png.z.avail_in = size;
+	int ret;
+	do
+	{
+		png.z.next_out = png.idat.data() + png.idat_used;
+		png.z.avail_out = png.idat.size() - png.idat_used;
+
+		ret = deflate(&png.z, flush);
+		if_error(ret == Z_STREAM_ERROR, "Error: deflate failed");
+		png.idat_used = png.idat.size() - png.z.avail_out;
+
+		if(png.idat_used == png.idat.size() || (ret == Z_STREAM_END && png.idat_used > 0))
+		{
+			write_chunk(png, "IDAT", png.idat.data(), png.idat_used);
+			png.idat_used = 0;
+		}
+	} while(png.z.avail_in > 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+}
+
+void png_begin(pngwriter_t &png, const string &filename, size_t width, const string &comment)
+{
+	png.filename = filename;
+	png.width = width;
+	png.rows = 0;
+	png.previous_row.assign(width * 3, 0);
+	png.filtered_row.assign(width * 3 + 1, 0);
+	png.idat.resize(PNG_IDAT_SIZE);
+	png.idat_used = 0;
+
+	png.file.open(filename, ios::out | ios::binary | ios::trunc);
+	if_error(!png.file.is_open(), "Error: cannot open output file " + filename);
+	png.file.write(reinterpret_cast<const char *>(PNG_SIGNATURE), sizeof(PNG_SIGNATURE));
+
+	// 8-bit RGB, height is filled in by png_end()
+	uint8_t ihdr[IHDR_SIZE] = {};
+	put_be32(ihdr, width);
+	put_be32(ihdr + 4, 0);
+	ihdr[8] = 8; // bit depth
+	ihdr[9] = 2; // colour type: RGB
+	write_chunk(png, "IHDR", ihdr, sizeof(ihdr));
+
+	if(!comment.empty())
+	{
+		string text = "Comment";
+		text += '\0';
+		text += comment;
+		write_chunk(png, "tEXt", reinterpret_cast<const uint8_t *>(text.data()), text.size());
+	}
+
+	png.z = {};
+	if_error(deflateInit(&png.z, PNG_COMPRESSION_LEVEL) != Z_OK, "Error: deflateInit failed");
+}
+
+// rgb: rows * width * 3 bytes
+void png_write_rows(pngwriter_t &png, const uint8_t *rgb, size_t rows)
+{
+	const size_t stride = png.width * 3;
+	for(size_t y = 0; y < rows; y++)
+	{
+		// "Up" filter, spectrogram rows are alike from one record to the next
+		const uint8_t *row = rgb + y * stride;
+		png.filtered_row[0] = 2;
+		for(size_t i = 0; i < stride; i++)
+			png.filtered_row[i + 1] = row[i] - png.previous_row[i];
+		std::copy(row, row + stride, png.previous_row.begin());
+
+		deflate_rows(png, png.filtered_row.data(), png.filtered_row.size(), Z_NO_FLUSH);
+	}
+	png.rows += rows;
+}
+
+void png_end(pngwriter_t &png)
+{
+	deflate_rows(png, nullptr, 0, Z_FINISH);
+	deflateEnd(&png.z);
+	write_chunk(png, "IEND", nullptr, 0);
+
+	// now that we know the height, patch it into IHDR
+	uint8_t ihdr[IHDR_SIZE] = {};
+	put_be32(ihdr, png.width);
+	put_be32(ihdr + 4, png.rows);
+	ihdr[8] = 8;
+	ihdr[9] = 2;
+	uLong crc = crc32(0, reinterpret_cast<const Bytef *>("IHDR"), 4);
+	crc = crc32(crc, ihdr, sizeof(ihdr));
+	uint8_t be[4];
+	put_be32(be, crc);
+
+	png.file.seekp(IHDR_DATA_OFFSET);
+	png.file.write(reinterpret_cast<const char *>(ihdr), sizeof(ihdr));
+	png.file.write(reinterpret_cast<const char *>(be), 4);
+	png.file.close();
+	if_error(png.file.fail(), "Error: failed to write " + png.filename);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.hpp"
+#include <zlib.h>
+
+/* png.hpp: streaming 8-bit RGB PNG writer, rows can be added as they come */
+
+// height isn't needed up front, it's patched into IHDR when finished,
+// so output has to be a seekable file
+typedef struct
+{
+	fstream file;
+	string filename;
+	size_t width;
+	size_t rows;
+	z_stream z;
+	vector<uint8_t> previous_row; // for "Up" filter
+	vector<uint8_t> filtered_row;
+	vector<uint8_t> idat; // compressed data waiting to be written as IDAT chunk
+	size_t idat_used;
+} pngwriter_t;
+
+void png_begin(pngwriter_t &png, const string &filename, size_t width, const string &comment);
+void png_write_rows(pngwriter_t &png, const uint8_t *rgb, size_t rows);
+void png_end(pngwriter_t &png);
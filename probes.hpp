@@ -0,0 +1,61 @@
+#pragma once
+
+/* probes.hpp: USDT probes for bpftrace / perf, provider "spsaver" */
+
+// every probe has a semaphore the tracer raises while attached, so a detached probe
+// costs one load & a not taken branch, its arguments & timestamps aren't even computed
+// list them with:
+//	bpftrace -l 'usdt:./spsave:*'
+// without <sys/sdt.h> (systemtap-sdt-dev) or with -DNO_USDT they compile to nothing
+#if defined(__has_include) && !defined(NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define HAVE_USDT 1
+#endif
+#endif
+
+#include <chrono>
+#include <cstdint>
+
+#ifdef HAVE_USDT
+// defined by PROBE_SEMAPHORE() in one object each, an inline variable would lose its section with LTO
+#define PROBE_SEMAPHORE_DECL(name) \
+	extern unsigned short spsaver_##name##_semaphore __attribute__((unused)) __attribute__((section(".probes")))
+#define PROBE_SEMAPHORE(name) \
+	unsigned short spsaver_##name##_semaphore __attribute__((unused)) __attribute__((section(".probes"))) = 0
+PROBE_SEMAPHORE_DECL(sweep__start); // spsave.cpp
+PROBE_SEMAPHORE_DECL(sweep__end);
+PROBE_SEMAPHORE_DECL(read__done);
+PROBE_SEMAPHORE_DECL(decode__done);
+PROBE_SEMAPHORE_DECL(write__done); // logwriter.cpp
+PROBE_SEMAPHORE_DECL(rotate);
+PROBE_SEMAPHORE_DECL(parse__records); // common.cpp
+PROBE_SEMAPHORE_DECL(phase__start); // stats.cpp
+PROBE_SEMAPHORE_DECL(phase__end);
+
+#define PROBE_ENABLED(name) __builtin_expect(spsaver_##name##_semaphore != 0, 0)
+#define PROBE0(name) do { if(PROBE_ENABLED(name)) DTRACE_PROBE(spsaver, name); } while(0)
+#define PROBE1(name, a) do { if(PROBE_ENABLED(name)) DTRACE_PROBE1(spsaver, name, a); } while(0)
+#define PROBE2(name, a, b) do { if(PROBE_ENABLED(name)) DTRACE_PROBE2(spsaver, name, a, b); } while(0)
+#define PROBE3(name, a, b, c) do { if(PROBE_ENABLED(name)) DTRACE_PROBE3(spsaver, name, a, b, c); } while(0)
+#else
+#define PROBE_SEMAPHORE(name) static_assert(true, "")
+#define PROBE_ENABLED(name) false
+#define PROBE0(name) do {} while(0)
+// arguments are never evaluated, but still count as used
+#define PROBE1(name, a) do { if(false) { (void)(a); } } while(0)
+#define PROBE2(name, a, b) do { if(false) { (void)(a); (void)(b); } } while(0)
+#define PROBE3(name, a, b, c) do { if(false) { (void)(a); (void)(b); (void)(c); } } while(0)
+#endif
+
+// start of a latency, clock is only read while its probe is enabled
+#define PROBE_START(name) (PROBE_ENABLED(name) ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+
+// latency arguments are in nanoseconds, 0 if probe was attached after start
+static inline uint64_t probe_elapsed_ns(std::chrono::steady_clock::time_point since)
+{
+	if(since == std::chrono::steady_clock::time_point())
+		return 0;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
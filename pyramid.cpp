@@ -0,0 +1,118 @@
+/*
+ *   pyramid - max-pooled multi-resolution spectrogram data
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "pyramid.hpp"
+#include "trace.hpp"
+#include <algorithm>
+
+// NaN (no data) only wins if everything is NaN
+static inline float pool(float a, float b)
+{
+	return std::fmax(a, b);
+}
+
+void pyramid_init(pyramid_t &p, vector<float> &&power_data, size_t rows, size_t columns)
+{
+	p.levels.clear();
+	p.rows.clear();
+	p.columns.clear();
+	p.levels.emplace_back(std::move(power_data));
+	p.rows.emplace_back(rows);
+	p.columns.emplace_back(columns);
+}
+
+static void build_level(pyramid_t &p)
+{
+	const vector<float> &in = p.levels.back();
+	const size_t in_rows = p.rows.back();
+	const size_t in_columns = p.columns.back();
+	const size_t rows = (in_rows + 1) / 2;
+	const size_t columns = (in_columns + 1) / 2;
+	vector<float> out(rows * columns);
+
+	trace_begin("pyramid level");
+	#pragma omp parallel for schedule(static)
+	for(size_t y = 0; y < rows; y++)
+	{
+		// odd last row / column pools with itself
+		const float *a = &in[(y * 2) * in_columns];
+		const float *b = &in[std::min(y * 2 + 1, in_rows - 1) * in_columns];
+		for(size_t x = 0; x < columns; x++)
+		{
+			const size_t x0 = x * 2;
+			const size_t x1 = std::min(x0 + 1, in_columns - 1);
+			out[y * columns + x] = pool(pool(a[x0], a[x1]), pool(b[x0], b[x1]));
+		}
+	}
+	trace_end("pyramid level");
+
+	p.levels.emplace_back(std::move(out));
+	p.rows.emplace_back(rows);
+	p.columns.emplace_back(columns);
+}
+
+size_t pyramid_level(pyramid_t &p, size_t width, size_t height)
+{
+	size_t level = 0;
+	while(true)
+	{
+		const size_t next_rows = (p.rows[level] + 1) / 2;
+		const size_t next_columns = (p.columns[level] + 1) / 2;
+		if(next_rows < height || next_columns < width || (next_rows == p.rows[level] && next_columns == p.columns[level]))
+			return level;
+		if(level + 1 == p.levels.size())
+			build_level(p);
+		level++;
+	}
+}
+
+void pyramid_sample(const pyramid_t &p, size_t level, size_t width, size_t height, vector<float> &output)
+{
+	const vector<float> &in = p.levels[level];
+	const size_t in_rows = p.rows[level];
+	const size_t in_columns = p.columns[level];
+	output.resize(width * height);
+
+	// output point covers [first, last) of input on both axes, at least one
+	auto span = [](size_t i, size_t out_size, size_t in_size, size_t &first, size_t &last)
+	{
+		first = i * in_size / out_size;
+		last = std::max((i + 1) * in_size / out_size, first + 1);
+	};
+
+	vector<size_t> x_first(width);
+	vector<size_t> x_last(width);
+	for(size_t x = 0; x < width; x++)
+		span(x, width, in_columns, x_first[x], x_last[x]);
+
+	#pragma omp parallel for schedule(static)
+	for(size_t y = 0; y < height; y++)
+	{
+		size_t y_first, y_last;
+		span(y, height, in_rows, y_first, y_last);
+		for(size_t x = 0; x < width; x++)
+		{
+			float value = NAN;
+			for(size_t r = y_first; r < y_last; r++)
+				for(size_t c = x_first[x]; c < x_last[x]; c++)
+					value = pool(value, in[r * in_columns + c]);
+			output[y * width + x] = value;
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common.hpp"
+
+/* pyramid.hpp: max-pooled (record, bin) matrix at halving resolutions, for smaller outputs */
+
+// level 0 is full resolution, every level halves both axes, rounding up
+// max pooling keeps narrow carriers & short bursts visible in thumbnails
+typedef struct
+{
+	vector<vector<float>> levels;
+	vector<size_t> rows;
+	vector<size_t> columns;
+} pyramid_t;
+
+void pyramid_init(pyramid_t &p, vector<float> &&power_data, size_t rows, size_t columns);
+// smallest level still at least width x height, built on first use, so it's not thread safe
+size_t pyramid_level(pyramid_t &p, size_t width, size_t height);
+// width x height from given level, every output point is the max of what it covers
+void pyramid_sample(const pyramid_t &p, size_t level, size_t width, size_t height, vector<float> &output);
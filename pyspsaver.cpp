@@ -0,0 +1,224 @@
+/*
+ *   pyspsaver - Python module for reading spsave logs into NumPy
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "common.hpp"
+
+// parsed data is exported through the buffer protocol, so numpy.asarray()
+// views the vectors filled by the C++ parser instead of copying them, and
+// the module doesn't need NumPy headers to build
+typedef struct
+{
+	PyObject_HEAD
+	void *owner; // vector<T> holding the data
+	void (*release)(void *owner);
+	void *data;
+	const char *format; // struct module format of one item
+	Py_ssize_t itemsize;
+	int ndim;
+	Py_ssize_t shape[2];
+	Py_ssize_t strides[2];
+} ArrayObject;
+
+template <typename T>
+static void release_vector(void *owner)
+{
+	delete static_cast<vector<T> *>(owner);
+}
+
+static void array_dealloc(ArrayObject *self)
+{
+	PyTypeObject *type = Py_TYPE(self);
+	if(self->owner != nullptr)
+		self->release(self->owner);
+	PyObject_Free(self);
+	Py_DECREF(type); // heap type
+}
+
+static int array_getbuffer(ArrayObject *self, Py_buffer *view, int flags)
+{
+	view->obj = reinterpret_cast<PyObject *>(self);
+	Py_INCREF(self);
+	view->buf = self->data;
+	view->len = self->itemsize;
+	for(int i = 0; i < self->ndim; i++)
+		view->len *= self->shape[i];
+	view->readonly = 0;
+	view->itemsize = self->itemsize;
+	view->format = (flags & PyBUF_FORMAT) ? const_cast<char *>(self->format) : nullptr;
+	view->ndim = self->ndim;
+	view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : nullptr;
+	view->suboffsets = nullptr;
+	view->internal = nullptr;
+	return 0;
+}
+
+static PyType_Slot array_slots[] =
+{
+	{Py_tp_dealloc, reinterpret_cast<void *>(array_dealloc)},
+	{Py_bf_getbuffer, reinterpret_cast<void *>(array_getbuffer)},
+	{Py_tp_doc, const_cast<char *>("Parsed data, exported through the buffer protocol")},
+	{0, nullptr}
+};
+
+static PyType_Spec array_spec =
+{
+	"spsaver.Array",
+	sizeof(ArrayObject),
+	0,
+	Py_TPFLAGS_DEFAULT,
+	array_slots
+};
+
+static PyTypeObject *ArrayType = nullptr;
+
+// take over a vector, rows * columns of it
+template <typename T>
+static PyObject *array_from_vector(vector<T> &&v, const char *format, size_t rows, size_t columns)
+{
+	ArrayObject *self = PyObject_New(ArrayObject, ArrayType);
+	if(self == nullptr)
+		return nullptr;
+
+	auto *owner = new vector<T>(std::move(v));
+	self->owner = owner;
+	self->release = release_vector<T>;
+	self->data = owner->data();
+	self->format = format;
+	self->itemsize = sizeof(T);
+	self->ndim = columns == 0 ? 1 : 2;
+	self->shape[0] = rows;
+	self->shape[1] = columns;
+	self->strides[0] = columns == 0 ? sizeof(T) : columns * sizeof(T);
+	self->strides[1] = sizeof(T);
+	return reinterpret_cast<PyObject *>(self);
+}
+
+// numpy.asarray(array) if NumPy is there, a memoryview otherwise, both without copying
+static PyObject *export_array(PyObject *array)
+{
+	if(array == nullptr)
+		return nullptr;
+
+	PyObject *result = nullptr;
+	PyObject *numpy = PyImport_ImportModule("numpy");
+	if(numpy != nullptr)
+	{
+		result = PyObject_CallMethod(numpy, "asarray", "O", array);
+		Py_DECREF(numpy);
+	}
+	else
+	{
+		PyErr_Clear();
+		result = PyMemoryView_FromObject(array);
+	}
+	Py_DECREF(array);
+	return result;
+}
+
+static PyObject *spsaver_load(PyObject *, PyObject *args)
+{
+	const char *filename;
+	if(!PyArg_ParseTuple(args, "s", &filename))
+		return nullptr;
+
+	vector<float> power_data;
+	vector<logheader_t> headers;
+	vector<int64_t> start_times;
+	vector<int64_t> end_times;
+	vector<double> freqs;
+	string error;
+
+	// nothing in here touches Python objects
+	Py_BEGIN_ALLOW_THREADS
+	try
+	{
+		fstream logfile_stream(filename, ios::in);
+		if_error(!logfile_stream.is_open(), format("Error: could not open file {}", filename));
+		parse_logfile(power_data, headers, logfile_stream);
+
+		start_times.reserve(headers.size());
+		end_times.reserve(headers.size());
+		for(const auto &h : headers)
+		{
+			start_times.emplace_back(epoch_seconds(h.start_time));
+			end_times.emplace_back(epoch_seconds(h.end_time));
+		}
+
+		const logheader_t &h = headers.front();
+		freqs.resize(h.steps);
+		for(size_t i = 0; i < h.steps; i++)
+			freqs[i] = bin_frequency(h, i);
+	}
+	catch(const std::exception &e)
+	{
+		error = e.what();
+	}
+	Py_END_ALLOW_THREADS
+
+	if(!error.empty())
+	{
+		PyErr_SetString(PyExc_ValueError, error.c_str());
+		return nullptr;
+	}
+
+	const logheader_t h = headers.front();
+	const size_t records = headers.size();
+	PyObject *result = Py_BuildValue("{s:N,s:N,s:N,s:N,s:f}",
+		"power", export_array(array_from_vector(std::move(power_data), "f", records, h.steps)),
+		"start_time", export_array(array_from_vector(std::move(start_times), "q", records, 0)),
+		"end_time", export_array(array_from_vector(std::move(end_times), "q", records, 0)),
+		"freq", export_array(array_from_vector(std::move(freqs), "d", h.steps, 0)),
+		"rbw", (double)h.rbw);
+	return result;
+}
+
+static PyMethodDef spsaver_methods[] =
+{
+	{"load", spsaver_load, METH_VARARGS,
+		"load(filename) -> dict\n\n"
+		"Parse a spsave log. Returns power (records x steps, float32 dBm),\n"
+		"start_time & end_time (int64 UNIX seconds), freq (float64 MHz) and rbw (kHz).\n"
+		"Arrays are NumPy arrays viewing the parsed data (memoryviews without NumPy).\n"
+		"The GIL is released while parsing."},
+	{nullptr, nullptr, 0, nullptr}
+};
+
+static PyModuleDef spsaver_module =
+{
+	PyModuleDef_HEAD_INIT,
+	"spsaver",
+	"Reader of spectrum logs written by spsave",
+	-1,
+	spsaver_methods,
+	nullptr,
+	nullptr,
+	nullptr,
+	nullptr
+};
+
+PyMODINIT_FUNC PyInit_spsaver(void)
+{
+	ArrayType = reinterpret_cast<PyTypeObject *>(PyType_FromSpec(&array_spec));
+	if(ArrayType == nullptr)
+		return nullptr;
+
+	return PyModule_Create(&spsaver_module);
+}
@@ -18,33 +18,42 @@
 
 #include "common.hpp"
 #include "config.hpp"
+#include "baseline.hpp"
+#include "alert.hpp"
+#include "calibration.hpp"
+#include "waterfall.hpp"
+#include "logwriter.hpp"
+#include "sweepio.hpp"
+#include "trace.hpp"
+#include "probes.hpp"
+#include "cpu.hpp"
+#include <csignal>
 #include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
 #include <termios.h>
 
-int send_cmd(int fd, string cmd)
+// semaphores of probes only spsave fires, write__done & rotate are in logwriter.cpp
+PROBE_SEMAPHORE(sweep__start);
+PROBE_SEMAPHORE(sweep__end);
+PROBE_SEMAPHORE(read__done);
+PROBE_SEMAPHORE(decode__done);
+
+int send_cmd(sweepio_t &io, string cmd)
 {
-	// Send commands though fd
+	// Send commands though tty
 	//cerr << "<< " << cmd << endl;
 	cmd += "\r";
 
-	write(fd, cmd.c_str(), cmd.length());
+	sweepio_send(io, cmd);
 	return 0;
 }
 
-const string read_response(int fd)
+const string read_response(sweepio_t &io)
 {
-	// Read response from fd
-
+	// Read response up to & including 'ch> ' prompt
 	string response;
-	char c;
-	while(read(fd, &c, 1) > 0)
-	{
-		response += c;
-		// If we get a 'ch> ' prompt, we're done
-		//fprintf(stderr, "response (%hhx) = %s\n", c, response.c_str());
-		if(response.length() >= 4 && response.substr(response.length() - 4) == "ch> ")
-			break;
-	}
+	sweepio_read_prompt(io, response);
 	// remove the last 4 characters
 	response.erase(response.length() - 4);
 
@@ -52,49 +61,196 @@ const string read_response(int fd)
 	return response;
 }
 
-// TODO: the argument list is becoming too long, consider using a struct
-const string read_scanraw(
-	int fd, int zero_level, logheader_t &h, fstream &output)
+// "x<low byte><high byte>" per point, fixed stride, so it's vectorized
+// calibration is added in the same pass, nullptr means raw levels
+SIMD_CLONES
+static void decode_scanraw(const uint8_t *raw, size_t points, int zero_level, const float *correction, float *sweep)
 {
-	string response;
-	uint8_t c;
-	
-	cout << format("[{}] Reading... ", time_str()) << flush;
-	while(read(fd, &c, 1) > 0)
+	if(correction == nullptr)
 	{
-		response += c;
-		// If we get a 'ch> ' prompt, we're done
-		if(response.length() >= 4 && response.substr(response.length() - 4) == "ch> ")
-			break;
+		#pragma omp simd
+		for(size_t i = 0; i < points; i++)
+		{
+			const uint16_t data = raw[i * 3 + 1] | raw[i * 3 + 2] << 8;
+			// data in dBm
+			sweep[i] = data / 32.0f - zero_level;
+		}
+		return;
+	}
+
+	#pragma omp simd
+	for(size_t i = 0; i < points; i++)
+	{
+		const uint16_t data = raw[i * 3 + 1] | raw[i * 3 + 2] << 8;
+		sweep[i] = data / 32.0f - zero_level + correction[i];
 	}
+}
 
-	// count x & print out CSV
-	int x_count = 0;
-	// make data header
-	// # <start_freq>,<stop_freq>,<steps>,<RBW>,<start_time>,<end_time>
-	output << format("$ {:.06f},{:.06f},{},{:.03f},{},{}\n",
-		h.start_freq, h.stop_freq, h.steps, h.rbw, h.start_time, time_str());
+// read scanraw output & decode it into dBm, corrected by calibration unless it's nullptr
+// correction is planned for h, a tinySA answering with a different number of points gets it replanned
+const string read_scanraw(sweepio_t &io, int zero_level, calibration_t *calibration, const logheader_t &h, vector<float> &sweep)
+{
+	string response;
+
+	waterfall_status(format("[{}] Reading... ", time_str()));
+	trace_begin("scanraw read");
+	const auto read_start = PROBE_START(read__done);
+	sweepio_read_prompt(io, response);
+	trace_end("scanraw read");
+	PROBE2(read__done, response.size(), probe_elapsed_ns(read_start));
+
+	trace_begin("scanraw decode");
+	const auto decode_start = PROBE_START(decode__done);
 	// first '{' + 1 is x
-	for(unsigned int i = response.find_first_of('{') + 1; i < response.length(); i += 3)
+	const size_t first = response.find_first_of('{') + 1;
+	size_t points = 0;
+	while(first + points * 3 + 2 < response.length() && response[first + points * 3] == 'x')
+		points++;
+	sweep.resize(points);
+	const float *correction = nullptr;
+	if(calibration != nullptr)
+	{
+		logheader_t plan = h;
+		plan.steps = points;
+		correction = calibration_plan(*calibration, plan).data();
+	}
+	decode_scanraw(reinterpret_cast<const uint8_t *>(response.data()) + first, points, zero_level, correction, sweep.data());
+	trace_end("scanraw decode");
+	PROBE2(decode__done, sweep.size(), probe_elapsed_ns(decode_start));
+	waterfall_status(format("Done. {} points read.\t", sweep.size())); // don't do newline here
+	return response;
+}
+
+// end of sweep is when it's written, returns size of record
+size_t log_sweep(sweepio_t &io, logheader_t &h, const vector<float> &sweep, deadband_t &db)
+{
+	h.end_time = time_str();
+	trace_begin("write record");
+	const auto write_start = PROBE_START(write__done);
+	fmt::memory_buffer buffer;
+	size_t written = sweep.size();
+	if(db.deadband > 0)
+		written = format_deadband_record(buffer, h, sweep, db);
+	else
+		format_record(buffer, h, sweep);
+	sweepio_append(io, buffer.data(), buffer.size());
+	trace_end("write record");
+	PROBE2(write__done, written, probe_elapsed_ns(write_start));
+
+	if(db.deadband > 0)
 	{
-		if(response[i] == 'x')
+		waterfall_status(format("{} points logged, {:.1f}% smaller than full records so far.\t", written,
+			100.0 - 100.0 * db.bytes_written / db.bytes_full));
+	}
+	return buffer.size();
+}
+
+// keeps space for the next records of a file reserved ahead, so it's laid out in big pieces on SD cards
+// records left is a guess, deadband records are smaller than a keyframe
+typedef struct
+{
+	bool supported;
+	size_t written; // bytes of current file
+	size_t reserved; // up to this offset
+} prealloc_t;
+
+void preallocate(prealloc_t &p, int output, size_t record_bytes, size_t records_left)
+{
+	p.written += record_bytes;
+	if(!p.supported || p.written + record_bytes <= p.reserved || records_left == 0)
+		return;
+	const size_t bytes = std::min(record_bytes * records_left, LOG_PREALLOC_CHUNK);
+	p.supported = preallocate_logfile(output, p.written, bytes);
+	p.reserved = p.written + bytes;
+	if(p.supported)
+		waterfall_status(format("Preallocated {}KiB.\t", bytes / 1024));
+}
+
+// sweeps in the rolling baseline that aren't in its file yet, guarded with the baseline
+// by baseline_lock, as the signal thread saves them on exit
+static std::mutex baseline_lock;
+static size_t baseline_unsaved = 0;
+
+static void save_baseline(const baseline_t &baseline, const string &baseline_file)
+{
+	trace_begin("baseline save");
+	baseline_save(baseline, baseline_file);
+	baseline_unsaved = 0;
+	trace_end("baseline save");
+}
+
+// feed a decoded sweep into the rolling baseline & report how unusual it is
+void update_baseline(baseline_t &baseline, const string &baseline_file, const vector<float> &sweep)
+{
+	if(sweep.size() != baseline.steps)
+	{
+		waterfall_status(format("Baseline skipped ({} points, expected {}).\t", sweep.size(), baseline.steps));
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(baseline_lock);
+	trace_begin("baseline update");
+	if(baseline.sweeps > 0)
+	{
+		vector<float> z(sweep.size());
+		const size_t anomalies = baseline_score(baseline, sweep.data(), z.data(), ZSCORE_DEFAULT_THRESHOLD);
+		waterfall_status(format("{} anomalous bins.\t", anomalies));
+	}
+	baseline_update(baseline, sweep.data());
+	trace_end("baseline update");
+	if(++baseline_unsaved >= BASELINE_SAVE_SWEEPS)
+		save_baseline(baseline, baseline_file);
+}
+
+void flush_baseline(const baseline_t &baseline, const string &baseline_file)
+{
+	std::lock_guard<std::mutex> guard(baseline_lock);
+	if(baseline_unsaved > 0)
+		save_baseline(baseline, baseline_file);
+}
+
+// spsave normally only ends by a signal, so a thread waits for it to dump the trace &
+// save the baseline first, must be called before any other thread is started, so they all inherit the mask
+void finish_on_signal(const string &trace_file, const baseline_t &baseline, const string &baseline_file)
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	if(!trace_file.empty())
+	{
+		trace_start(trace_file);
+		trace_thread_name("main");
+	}
+	std::thread([signals, &baseline, baseline_file]
+	{
+		int sig = SIGTERM;
+		sigwait(&signals, &sig);
+		try
 		{
-			uint16_t data;
-			// x_count starts from 0
-			x_count++;
-			data = response[i+1] & 0xff; // avoid sign extension
-			data |= response[i+2] << 8;
-			// freq in MHz, data in dBm
-			output << format("{:.1f}\n", data / 32.0 - zero_level);
+			if(!baseline_file.empty())
+				flush_baseline(baseline, baseline_file);
 		}
-		else
+		catch(const StringException &e)
 		{
-			break;
+			cerr << e.what() << endl;
 		}
-	}
-	output << endl; // one empty line between each scan
-	cout << format("Done. {} points read.\t", x_count) << flush; // don't do newline here
-	return response;
+		try
+		{
+			trace_stop();
+		}
+		catch(const StringException &e)
+		{
+			cerr << e.what() << endl;
+		}
+		fflush(stdout);
+		// die of the same signal as without this thread
+		signal(sig, SIG_DFL);
+		pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+		raise(sig);
+	}).detach();
 }
 
 // Credits: https://stackoverflow.com/questions/54591636/ceiling-time-point-to-runtime-defined-duration/54634050#54634050
@@ -125,18 +281,21 @@ void help_msg(char *argv[])
 		"\t-p <filename prefix>	default \"sp\"\n"
 		"\t-l <loop?>		0 is false (default), any other value is true\n"
 		"\t-x <max records>	default: 1440, 0 means no log rotation\n"
-		"\t-i <interval>\t	sweep interval in seconds (default: 60)" << endl << endl;
-}
-
-const string new_logfile(fstream &output, const string &filename_prefix, const string &start_time)
-{
-	const string filename = {filename_prefix + '.' + start_time + ".log"};
-	if(output.is_open())
-		output.close();
-	output.open(filename, std::ios::out);
-	if_error(!output.is_open(), "Error: cannot open output file");
-
-	return filename;
+		"\t-R <hour|day|week>	rotate log at UTC boundaries instead of every -x records, weeks start on Monday\n"
+		"\t-S <sweeps>[,<sec>]	fdatasync log every N sweeps or T seconds, whichever comes first, default: only when a file is closed\n"
+		"\t\t\t\tevery fdatasync is a flash write, small N wears SD cards & stalls sweeps, large N loses more on power loss\n"
+		"\t-i <interval>\t	sweep interval in seconds (default: 60)\n"
+		"\t-b <baseline file>	keep a rolling per-bin baseline, loaded if it exists\n"
+		"\t-a <alpha>\t	baseline weight of newest sweep (default: " << BASELINE_DEFAULT_ALPHA << ")\n"
+		"\t-L <calibration file>	log corrected levels, one \"<freq MHz>,<offset dB>[,<RBW kHz>]\" per line, default: raw levels\n"
+		"\t-M <mask file>\t	alert when a sweep exceeds limits, one \"<start MHz>,<stop MHz>,<limit dBm>[,<min duration sec>[,<hysteresis dB>]]\" per line\n"
+		"\t-A <alert target>	\"unix:<socket>\", \"fifo:<path>\" or \"exec:<program>\", default: only print alerts\n"
+		"\t-d <deadband dB>	only log points that changed more than this, default: 0 (disabled)\n"
+		"\t-K <keyframe interval>	full record every N sweeps in deadband mode, default: 60\n"
+		"\t-w <256|truecolor|auto>	draw a live waterfall in terminal, one line per sweep\n"
+		"\t-U\t\t	do tty & log I/O through io_uring, falls back to epoll & write if unavailable\n"
+		"\t-T <trace file>\t	record Chrome trace JSON, written on exit (including SIGINT / SIGTERM)\n"
+		"\t-C\t\t	print which SIMD kernels this CPU runs & exit" << endl << endl;
 }
 
 int main(int argc, char *argv[])
@@ -151,17 +310,30 @@ int main(int argc, char *argv[])
 		/* steps */ 2901,
 		/* rbw */ 10,
 		/* start time */ "",
-		/* end time */ ""
+		/* end time */ "",
+		/* calibrated */ false
 	};
 	string filename_prefix = "sp";
 	bool loop = 0; // whether to run in a loop or not
 	int interval = 60; // interval in seconds
 	string model = "tinySA4"; // tinySA or tinySA4 (Ultra)
 	size_t max_records = 1440; // 1 day of 1-minute records
+	string baseline_file = ""; // empty means no baseline
+	float baseline_alpha = BASELINE_DEFAULT_ALPHA;
+	string calibration_file = ""; // empty means raw levels
+	string mask_file = ""; // empty means no alerts
+	string alert_target = "";
+	deadband_t db = {0, 60, 0, {}, {}, {}, 0, 0, 0};
+	string trace_file = ""; // empty means no tracing
+	string waterfall_mode = ""; // empty means no waterfall
+	bool want_uring = false;
+	rotation_t rotation = rotation_t::none;
+	size_t commit_sweeps = 0; // 0 & 0: no group commit, kernel writes back on its own
+	double commit_seconds = 0;
 
 	// Parse arguments
 	int opt;
-	while((opt = getopt(argc, argv, "t:s:e:k:r:p:l:i:m:x:h")) != -1)
+	while((opt = getopt(argc, argv, "t:s:e:k:r:p:l:i:m:x:R:S:b:a:L:M:A:d:K:T:w:UCh")) != -1)
 	{
 		switch(opt)
 		{
@@ -202,6 +374,46 @@ int main(int argc, char *argv[])
 			case 'x':
 				max_records = atoll(optarg);
 				break;
+			case 'R':
+				if_error(!parse_rotation(optarg, rotation), "Error: invalid rotation " + string(optarg));
+				break;
+			case 'S':
+				if_error(sscanf(optarg, "%zu,%lf", &commit_sweeps, &commit_seconds) < 1 || commit_seconds < 0 ||
+					(commit_sweeps == 0 && commit_seconds == 0), "Error: invalid commit policy " + string(optarg));
+				break;
+			case 'b':
+				baseline_file = optarg;
+				break;
+			case 'a':
+				baseline_alpha = atof(optarg);
+				break;
+			case 'L':
+				calibration_file = optarg;
+				break;
+			case 'M':
+				mask_file = optarg;
+				break;
+			case 'A':
+				alert_target = optarg;
+				break;
+			case 'd':
+				db.deadband = atof(optarg);
+				break;
+			case 'K':
+				db.keyframe_interval = atoll(optarg);
+				break;
+			case 'T':
+				trace_file = optarg;
+				break;
+			case 'w':
+				waterfall_mode = optarg;
+				break;
+			case 'U':
+				want_uring = true;
+				break;
+			case 'C':
+				print("SIMD path: {}\n", simd_path());
+				return 0;
 			case 'h':
 				help_msg(argv);
 				return 0;
@@ -214,6 +426,18 @@ int main(int argc, char *argv[])
 	// Sanity check
 	if_error(h.start_freq >= h.stop_freq, "Error: start freq > stop freq");
 	if_error(ttydev.empty(), "Error: no tty device specified");
+	if_error(!(baseline_alpha > 0 && baseline_alpha <= 1), "Error: baseline alpha must be in (0, 1]");
+	if_error(db.deadband < 0, "Error: deadband must not be negative");
+	if_error(db.keyframe_interval == 0, "Error: keyframe interval must be at least 1");
+	if(rotation != rotation_t::none)
+		max_records = 0;
+	waterfallmode_t waterfall_colours = waterfallmode_t::palette256;
+	if_error(!waterfall_mode.empty() && !parse_waterfall_mode(waterfall_mode, waterfall_colours),
+		"Error: invalid waterfall mode " + waterfall_mode);
+	// loaded once the frequency plan is known, but the signal thread needs it from the start
+	baseline_t baseline;
+	if(!trace_file.empty() || !baseline_file.empty())
+		finish_on_signal(trace_file, baseline, baseline_file);
 
 	// Open the serial port
 	int fd = open(ttydev.c_str(), O_RDWR | O_NOCTTY);
@@ -242,18 +466,23 @@ int main(int argc, char *argv[])
 	tty.c_cc[VMIN] = 1; // no minimum number of bytes to read
 	tcsetattr(fd, TCSANOW, &tty);
 
+	sweepio_t io;
+	sweepio_init(io, fd, want_uring);
+
 	cerr << format("tty = {}, start = {:.6f}MHz, stop = {:.6f}MHz, step = {:.3f}kHz, rbw = {:.3f}kHz, filename prefix = \"{}\"\n",
 		ttydev, h.start_freq, h.stop_freq, step_freq_kHz, h.rbw, filename_prefix);
 
+	sweepio_set_commit(io, commit_sweeps, commit_seconds);
+	print("I/O: {}\n", sweepio_backend_name(io));
 	print("Initializing...\n\n");
 	// Send init command
-	send_cmd(fd, "");
-	read_response(fd);
-	send_cmd(fd, "pause");
-	read_response(fd);
-	//send_cmd(fd, "rbw "+ to_string(h.rbw));
-	send_cmd(fd, format("rbw {:.1f}", h.rbw));
-	read_response(fd);
+	send_cmd(io, "");
+	read_response(io);
+	send_cmd(io, "pause");
+	read_response(io);
+	//send_cmd(io, "rbw "+ to_string(h.rbw));
+	send_cmd(io, format("rbw {:.1f}", h.rbw));
+	read_response(io);
 
 	print("Sweeping...\n\n");
 	// Calculate the number of steps
@@ -264,10 +493,11 @@ int main(int argc, char *argv[])
 	// construct the sweep command
 	const string scanraw_cmd = format("scanraw {:.0f} {:.0f} {}", h.start_freq * 1e6, h.stop_freq * 1e6, h.steps);
 	
-	fstream output;
+	int output = -1;
 	string start_time = time_str();
 	h.start_time = start_time;
-	string filename = new_logfile(output, filename_prefix, start_time);
+	string filename = new_logfile(output, filename_prefix, start_time, db);
+	sweepio_set_log(io, output);
 
 	int zero_level = ZERO_LEVEL_ULTRA;
 	if(model == "tinySA")
@@ -279,40 +509,140 @@ int main(int argc, char *argv[])
 
 	print("\nOpened log file: {}\n", filename);
 
+	// interpolated once per frequency plan, decoding only adds it
+	calibration_t calibration;
+	if(!calibration_file.empty())
+	{
+		calibration_load(calibration, calibration_file);
+		calibration_plan(calibration, h);
+		h.calibrated = true;
+		print("Loaded calibration: {}, {} points\n", calibration_file, calibration.points.size());
+	}
+	calibration_t *levels_calibration = calibration_file.empty() ? nullptr : &calibration;
+
+	if(!baseline_file.empty())
+	{
+		if(baseline_load(baseline, baseline_file, h))
+		{
+			print("Loaded baseline: {}, {} sweeps\n", baseline_file, baseline.sweeps);
+		}
+		else
+		{
+			print("Starting new baseline: {}\n", baseline_file);
+			baseline_init(baseline, h, baseline_alpha);
+		}
+		// alpha given on command line always wins
+		baseline.alpha = baseline_alpha;
+	}
+	alertengine_t alerts;
+	if(!mask_file.empty())
+	{
+		alert_load_mask(alerts, mask_file);
+		alert_plan(alerts, h);
+		alert_start(alerts, alert_target);
+		print("Loaded mask: {}, {} ranges\n", mask_file, alerts.ranges.size());
+	}
+
+	waterfall_t waterfall;
+	if(!waterfall_mode.empty())
+		waterfall_start(waterfall, waterfall_colours);
+
+	vector<float> sweep;
+
 	// initiate sweep
 	if(loop)
 	{
 		// number of records written to file, will rotate file when it reaches MAX_RECORDS
 		size_t record_count = 0;
+		prealloc_t prealloc = {max_records != 0 || rotation != rotation_t::none, 0, 0};
+		auto rotation_time = time_point<system_clock>::max();
+		if(rotation != rotation_t::none)
+			rotation_time = next_rotation(now(), rotation);
+		auto rotate = [&](const string &file_start_time)
+		{
+			record_count = 0;
+			prealloc.written = prealloc.reserved = 0;
+			// old log file will be closed in new_logfile(), once its last record is on disk
+			sweepio_drain(io);
+			waterfall_status("\n\n");
+			sweepio_report(io);
+			filename = new_logfile(output, filename_prefix, file_start_time, db);
+			sweepio_set_log(io, output);
+			waterfall_status(format("New log file: {}\n", filename));
+		};
 
 		while(1)
 		{
-			cout << format("\r[{:8d}] ", record_count + 1) << flush; // Displayed value is 1-based
-			std::this_thread::sleep_until(awake_time(interval));
-			start_time = time_str();
+			waterfall_status(format("\r[{:8d}] ", record_count + 1)); // Displayed value is 1-based
+			sweepio_sleep_until(io, awake_time(interval));
+			const auto sweep_time = now();
+			start_time = time_str(sweep_time);
 			h.start_time = start_time;
-			send_cmd(fd, scanraw_cmd);
-			read_scanraw(fd, zero_level, h, output);
+			// first sweep past a UTC boundary goes to a new file
+			if(rotation != rotation_t::none && sweep_time >= rotation_time)
+			{
+				rotate(start_time);
+				rotation_time = next_rotation(sweep_time, rotation);
+				waterfall_status(format("\r[{:8d}] ", record_count + 1));
+			}
+			trace_begin("sweep");
+			const auto sweep_start = PROBE_START(sweep__end);
+			const size_t syscalls_before = io.syscalls;
+			PROBE1(sweep__start, h.steps);
+			send_cmd(io, scanraw_cmd);
+			read_scanraw(io, zero_level, levels_calibration, h, sweep);
+			if(!mask_file.empty())
+				alert_evaluate(alerts, sweep, steady_clock::now());
+			const size_t record_bytes = log_sweep(io, h, sweep, db);
+			waterfall_status(format("{} syscalls{}.\t", io.syscalls - syscalls_before, io.unsynced_records == 0 ? ", synced" : ""));
+			if(rotation != rotation_t::none)
+				preallocate(prealloc, output, record_bytes, std::chrono::duration_cast<std::chrono::seconds>(rotation_time - sweep_time).count() / interval);
+			else if(max_records != 0)
+				preallocate(prealloc, output, record_bytes, max_records - record_count - 1);
+			if(!waterfall_mode.empty())
+				waterfall_push(waterfall, sweep, h.start_time);
+			if(!baseline_file.empty())
+				update_baseline(baseline, baseline_file, sweep);
+			trace_end("sweep");
+			PROBE2(sweep__end, sweep.size(), probe_elapsed_ns(sweep_start));
 			record_count++;
 
 			// rotate file
 			if(max_records != 0 && record_count >= max_records)
-			{
-				record_count = 0;
-				// old log file will be closed in new_logfile()
-				filename = new_logfile(output, filename_prefix, time_str());
-				print("\n\nNew log file: {}\n", filename);
-			}
+				rotate(time_str());
 		}
 	}
 	else
 	{
-		send_cmd(fd, scanraw_cmd);
-		read_scanraw(fd, zero_level, h, output);
-		send_cmd(fd, "resume");
+		trace_begin("sweep");
+		const auto sweep_start = PROBE_START(sweep__end);
+		const size_t syscalls_before = io.syscalls;
+		PROBE1(sweep__start, h.steps);
+		send_cmd(io, scanraw_cmd);
+		read_scanraw(io, zero_level, levels_calibration, h, sweep);
+		if(!mask_file.empty())
+			alert_evaluate(alerts, sweep, steady_clock::now());
+		log_sweep(io, h, sweep, db);
+		waterfall_status(format("{} syscalls{}.\t", io.syscalls - syscalls_before, io.unsynced_records == 0 ? ", synced" : ""));
+		if(!waterfall_mode.empty())
+			waterfall_push(waterfall, sweep, h.start_time);
+		if(!baseline_file.empty())
+			update_baseline(baseline, baseline_file, sweep);
+		trace_end("sweep");
+		PROBE2(sweep__end, sweep.size(), probe_elapsed_ns(sweep_start));
+		send_cmd(io, "resume");
 	}
-	output.close();
+	sweepio_close(io);
+	close_logfile(output);
 	cout << endl;
+	if(!baseline_file.empty())
+		flush_baseline(baseline, baseline_file);
+	sweepio_report(io);
+	if(!mask_file.empty())
+		alert_stop(alerts);
+	if(!waterfall_mode.empty())
+		waterfall_stop(waterfall);
+	trace_stop();
 
 	return 0;
 }
@@ -0,0 +1,86 @@
+/*
+ *   libspsaver - C interface of the streaming log reader
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "spsaver.h"
+#include <cstring>
+#include <streambuf>
+
+// read-only view of a memory buffer as a stream, nothing is copied
+class MemoryBuffer : public std::streambuf
+{
+public:
+	MemoryBuffer(const char *data, size_t size)
+	{
+		char *p = const_cast<char *>(data);
+		setg(p, p, p + size);
+	}
+};
+
+static void set_error(char *error, size_t error_size, const char *message)
+{
+	if(error == nullptr || error_size == 0)
+		return;
+	strncpy(error, message, error_size - 1);
+	error[error_size - 1] = '\0';
+}
+
+// exceptions must not cross the C interface
+static long long stream_c(istream &logfile_stream, spsaver_record_fn fn, void *user, char *error, size_t error_size)
+{
+	try
+	{
+		logreader_t reader;
+		logreader_init(reader);
+		const size_t records = stream_records(reader, logfile_stream,
+			[&](const logheader_t &h, const float *samples)
+			{
+				const spsaver_header_t header =
+				{
+					h.start_freq, h.stop_freq, h.steps, h.rbw,
+					h.start_time.c_str(), h.end_time.c_str()
+				};
+				return fn(&header, samples, user) == 0;
+			});
+		set_error(error, error_size, "");
+		return records;
+	}
+	catch(const std::exception &e)
+	{
+		set_error(error, error_size, e.what());
+		return -1;
+	}
+}
+
+long long spsaver_stream_file(const char *filename, spsaver_record_fn fn, void *user, char *error, size_t error_size)
+{
+	fstream logfile_stream(filename, ios::in);
+	if(!logfile_stream.is_open())
+	{
+		set_error(error, error_size, format("Error: could not open file {}", filename).c_str());
+		return -1;
+	}
+	return stream_c(logfile_stream, fn, user, error, error_size);
+}
+
+long long spsaver_stream_buffer(const char *data, size_t size, spsaver_record_fn fn, void *user, char *error, size_t error_size)
+{
+	MemoryBuffer buffer(data, size);
+	istream logfile_stream(&buffer);
+	return stream_c(logfile_stream, fn, user, error, error_size);
+}
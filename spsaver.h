@@ -0,0 +1,37 @@
+#ifndef SPSAVER_H
+#define SPSAVER_H
+
+/* spsaver.h: C interface of libspsaver, streaming reader of spsave logs */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// header of a record, strings are "YYYYMMDDTHHMMSS"
+typedef struct
+{
+	double start_freq; // MHz
+	double stop_freq; // MHz
+	size_t steps;
+	float rbw; // kHz
+	const char *start_time;
+	const char *end_time;
+} spsaver_header_t;
+
+// called for every full record (deadband records are already reconstructed),
+// header & samples (steps of them, in dBm) are only valid during the call
+// return 0 to go on, anything else stops reading
+typedef int (*spsaver_record_fn)(const spsaver_header_t *header, const float *samples, void *user);
+
+// all return number of records passed to fn, or -1 on error
+// if error isn't NULL, a message is written into it, truncated to error_size
+long long spsaver_stream_file(const char *filename, spsaver_record_fn fn, void *user, char *error, size_t error_size);
+long long spsaver_stream_buffer(const char *data, size_t size, spsaver_record_fn fn, void *user, char *error, size_t error_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
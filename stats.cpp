@@ -0,0 +1,195 @@
+/*
+ *   stats - per-phase time & memory accounting
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "probes.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <sys/resource.h>
+
+// semaphores of probes fired from here
+PROBE_SEMAPHORE(phase__start);
+PROBE_SEMAPHORE(phase__end);
+
+constexpr static const char *PHASE_NAMES[] =
+{
+	"parse", "consistency", "filter", "colour", "gridlines", "text", "encode"
+};
+static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) == (size_t)phase_t::count);
+
+// every C++ allocation of the program is counted, per thread for phases & in total
+// (ImageMagick allocates with malloc(), so it's not included)
+static std::atomic<size_t> total_allocations(0);
+static std::atomic<size_t> total_allocated_bytes(0);
+static thread_local size_t thread_allocations = 0;
+static thread_local size_t thread_allocated_bytes = 0;
+
+void *operator new(size_t size)
+{
+	thread_allocations++;
+	thread_allocated_bytes += size;
+	total_allocations.fetch_add(1, std::memory_order_relaxed);
+	total_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+
+	void *p = std::malloc(size != 0 ? size : 1);
+	if(p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+static double cpu_seconds(clockid_t clock)
+{
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// CPU time of a parallel phase is sampled from the whole process, one clock read per boundary,
+// rather than from every team thread, which would open an OpenMP region of its own each time
+// team size is the one its regions would get, threads are never woken to count them
+static double team_cpu_seconds(int &threads)
+{
+	threads = omp_get_max_threads();
+	return cpu_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void stats_init(stats_t &stats, bool enabled, bool json)
+{
+	stats.enabled = enabled;
+	stats.json = json;
+	for(auto &p : stats.phases)
+		p = {0, 0, 0, 0, 0, 0};
+	stats.bytes_read = 0;
+	stats.samples = 0;
+	stats.start = steady_clock::now();
+	stats.start_cpu = cpu_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+phasetimer_t stats_begin(stats_t &stats, phase_t phase, bool parallel)
+{
+	trace_begin(PHASE_NAMES[(size_t)phase]);
+	PROBE1(phase__start, PHASE_NAMES[(size_t)phase]);
+	phasetimer_t timer = {};
+	timer.phase = phase;
+	timer.parallel = parallel;
+	timer.wall = PROBE_START(phase__end); // needed by probes even without stats
+	if(!stats.enabled)
+		return timer;
+
+	timer.threads = 1;
+	timer.cpu = parallel ? team_cpu_seconds(timer.threads) : cpu_seconds(CLOCK_THREAD_CPUTIME_ID);
+	timer.allocations = thread_allocations;
+	timer.allocated_bytes = thread_allocated_bytes;
+	timer.wall = steady_clock::now();
+	return timer;
+}
+
+void stats_end(stats_t &stats, const phasetimer_t &timer)
+{
+	trace_end(PHASE_NAMES[(size_t)timer.phase]);
+	PROBE2(phase__end, PHASE_NAMES[(size_t)timer.phase], probe_elapsed_ns(timer.wall));
+	if(!stats.enabled)
+		return;
+
+	const double wall = std::chrono::duration<double>(steady_clock::now() - timer.wall).count();
+	int threads = 1;
+	const double cpu = timer.parallel ? team_cpu_seconds(threads) : cpu_seconds(CLOCK_THREAD_CPUTIME_ID);
+
+	// phases of different pipeline stages end concurrently
+	std::lock_guard<std::mutex> guard(stats.lock);
+	phasestats_t &p = stats.phases[(size_t)timer.phase];
+	p.wall += wall;
+	p.cpu += cpu - timer.cpu;
+	p.calls++;
+	p.threads = std::max({p.threads, threads, timer.threads});
+	p.allocations += thread_allocations - timer.allocations;
+	p.allocated_bytes += thread_allocated_bytes - timer.allocated_bytes;
+}
+
+void stats_report(stats_t &stats)
+{
+	if(!stats.enabled)
+		return;
+
+	const double wall = std::chrono::duration<double>(steady_clock::now() - stats.start).count();
+	const double cpu = cpu_seconds(CLOCK_PROCESS_CPUTIME_ID) - stats.start_cpu;
+	rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
+	const size_t peak_rss = usage.ru_maxrss * 1024ULL; // in KiB on Linux
+	const size_t allocations = total_allocations.load();
+	const size_t allocated_bytes = total_allocated_bytes.load();
+
+	if(stats.json)
+	{
+		// one line on stderr, so it doesn't mix with progress messages
+		string out = format("{{\"wall\":{:.6f},\"cpu\":{:.6f},\"peak_rss\":{},\"allocations\":{},\"allocated_bytes\":{},"
+			"\"bytes_read\":{},\"samples\":{},\"simd\":\"{}\",\"phases\":{{",
+			wall, cpu, peak_rss, allocations, allocated_bytes, stats.bytes_read, stats.samples, simd_path());
+		for(size_t i = 0; i < (size_t)phase_t::count; i++)
+		{
+			const phasestats_t &p = stats.phases[i];
+			out += format("{}\"{}\":{{\"wall\":{:.6f},\"cpu\":{:.6f},\"calls\":{},\"threads\":{},\"allocations\":{},\"allocated_bytes\":{}}}",
+				i ? "," : "", PHASE_NAMES[i], p.wall, p.cpu, p.calls, p.threads, p.allocations, p.allocated_bytes);
+		}
+		out += "}}\n";
+		cerr << out;
+		return;
+	}
+
+	print("Stats: wall {:.3f}s, CPU {:.3f}s, peak RSS {:.1f}MiB, {} allocations ({:.1f}MiB), read {:.1f}MiB, {} samples, SIMD {}\n",
+		wall, cpu, peak_rss / 1048576.0, allocations, allocated_bytes / 1048576.0, stats.bytes_read / 1048576.0, stats.samples, simd_path());
+	print("{:<12}{:>10}{:>10}{:>9}{:>8}{:>13}{:>12}\n", "phase", "wall(s)", "cpu(s)", "threads", "calls", "allocations", "alloc(MiB)");
+	for(size_t i = 0; i < (size_t)phase_t::count; i++)
+	{
+		const phasestats_t &p = stats.phases[i];
+		if(p.calls == 0)
+			continue;
+		print("{:<12}{:>10.3f}{:>10.3f}{:>9}{:>8}{:>13}{:>12.1f}\n",
+			PHASE_NAMES[i], p.wall, p.cpu, p.threads, p.calls, p.allocations, p.allocated_bytes / 1048576.0);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.hpp"
+#include <mutex>
+
+/* stats.hpp: per-phase time & memory accounting */
+
+using std::chrono::steady_clock;
+
+enum class phase_t { parse, consistency, filter, colour, gridlines, text, encode, count };
+
+typedef struct
+{
+	double wall; // busy time, summed over calls
+	double cpu; // of the thread running it, or of the process while a parallel one runs
+	size_t calls;
+	int threads; // most threads seen working on it at once
+	size_t allocations; // only those made by the thread running the phase
+	size_t allocated_bytes;
+} phasestats_t;
+
+typedef struct
+{
+	bool enabled;
+	bool json;
+	std::mutex lock;
+	phasestats_t phases[(size_t)phase_t::count];
+	size_t bytes_read;
+	size_t samples;
+	time_point<steady_clock> start;
+	double start_cpu;
+} stats_t;
+
+// a phase in progress, lives on the stack of the thread running it
+typedef struct
+{
+	phase_t phase;
+	bool parallel; // runs OpenMP regions, so CPU time of whole process is counted
+	time_point<steady_clock> wall;
+	double cpu;
+	int threads;
+	size_t allocations;
+	size_t allocated_bytes;
+} phasetimer_t;
+
+void stats_init(stats_t &stats, bool enabled, bool json);
+phasetimer_t stats_begin(stats_t &stats, phase_t phase, bool parallel);
+void stats_end(stats_t &stats, const phasetimer_t &timer);
+void stats_report(stats_t &stats);
@@ -0,0 +1,500 @@
+/*
+ *   sweepio - tty & log I/O of spsave through io_uring or epoll
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "sweepio.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// what a completion belongs to
+enum : uint64_t { TAG_READ = 1, TAG_COMMAND, TAG_APPEND, TAG_SYNC };
+
+static const string PROMPT = "ch> ";
+
+static void uring_unmap(uring_t &ring)
+{
+	if(ring.sqes != nullptr)
+		munmap(ring.sqes, ring.sqes_size);
+	if(ring.cq_map != nullptr && ring.cq_map != ring.sq_map)
+		munmap(ring.cq_map, ring.cq_map_size);
+	if(ring.sq_map != nullptr)
+		munmap(ring.sq_map, ring.sq_map_size);
+	if(ring.fd >= 0)
+		close(ring.fd);
+	ring = {};
+	ring.fd = -1;
+}
+
+// returns false if kernel doesn't have io_uring, or it's forbidden (ex. by seccomp in containers)
+static bool uring_setup(sweepio_t &io)
+{
+	uring_t &ring = io.ring;
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ring.fd = syscall(__NR_io_uring_setup, SWEEPIO_RING_ENTRIES, &p);
+	io.syscalls++;
+	if(ring.fd < 0)
+		return false;
+	// reads & writes at current position (5.6) & one mapping for both queues (5.4)
+	if(!(p.features & IORING_FEAT_RW_CUR_POS) || !(p.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		uring_unmap(ring);
+		return false;
+	}
+
+	ring.entries = p.sq_entries;
+	ring.sq_map_size = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned), p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+	ring.sq_map = mmap(nullptr, ring.sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	ring.sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+	ring.sqes = static_cast<io_uring_sqe *>(mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES));
+	io.syscalls += 2;
+	if(ring.sq_map == MAP_FAILED || ring.sqes == MAP_FAILED)
+	{
+		ring.sq_map = ring.sq_map == MAP_FAILED ? nullptr : ring.sq_map;
+		ring.sqes = ring.sqes == MAP_FAILED ? nullptr : ring.sqes;
+		uring_unmap(ring);
+		return false;
+	}
+	ring.cq_map = ring.sq_map;
+	ring.cq_map_size = ring.sq_map_size;
+
+	uint8_t *sq = static_cast<uint8_t *>(ring.sq_map);
+	ring.sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+	ring.sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+	ring.sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+	ring.sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+	ring.cq_head = reinterpret_cast<unsigned *>(sq + p.cq_off.head);
+	ring.cq_tail = reinterpret_cast<unsigned *>(sq + p.cq_off.tail);
+	ring.cq_mask = reinterpret_cast<unsigned *>(sq + p.cq_off.ring_mask);
+	ring.cqes = reinterpret_cast<io_uring_cqe *>(sq + p.cq_off.cqes);
+	ring.queued = 0;
+
+	// registering pins buffers, it may exceed RLIMIT_MEMLOCK, unregistered I/O still works
+	iovec buffers[2] =
+	{
+		{io.read_buffer.data(), io.read_buffer.size()},
+		{io.write_buffer.data(), io.write_buffer.size()}
+	};
+	ring.fixed = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, buffers, 2) == 0;
+	io.syscalls++;
+	return true;
+}
+
+// submit everything queued & wait for at least wait completions
+static void uring_enter(sweepio_t &io, unsigned wait)
+{
+	uring_t &ring = io.ring;
+	while(true)
+	{
+		const int ret = syscall(__NR_io_uring_enter, ring.fd, ring.queued, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		io.syscalls++;
+		// kernel consumed SQEs up to its head, even if waiting was interrupted
+		ring.queued = *ring.sq_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		if(ret >= 0)
+			return;
+		if_error(errno != EINTR && errno != EAGAIN && errno != EBUSY, format("Error: io_uring_enter failed: {}", strerror(errno)));
+		// interrupted: completions may already be there, so reap before waiting again
+		if(__atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) != *ring.cq_head)
+			return;
+	}
+}
+
+// next free SQE, submitted by next uring_enter()
+static io_uring_sqe *uring_sqe(sweepio_t &io)
+{
+	uring_t &ring = io.ring;
+	if(*ring.sq_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.entries)
+		uring_enter(io, 0);
+
+	const unsigned tail = *ring.sq_tail;
+	const unsigned index = tail & *ring.sq_mask;
+	io_uring_sqe *sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring.sq_array[index] = index;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring.queued++;
+	return sqe;
+}
+
+static void uring_rw(io_uring_sqe *sqe, uint8_t opcode, int fd, const void *data, size_t size, uint64_t tag)
+{
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->off = static_cast<uint64_t>(-1); // current position, log is O_APPEND anyway
+	sqe->addr = reinterpret_cast<uint64_t>(data);
+	sqe->len = size;
+	sqe->user_data = tag;
+}
+
+static void commit_done(sweepio_t &io)
+{
+	const double latency = std::chrono::duration<double, std::micro>(steady_clock::now() - io.sync_start).count();
+	io.commits++;
+	io.total_commit_us += latency;
+	io.max_commit_us = std::max(io.max_commit_us, latency);
+}
+
+// handle every completion there is, never blocks
+static void uring_reap(sweepio_t &io, ssize_t &read_result)
+{
+	uring_t &ring = io.ring;
+	unsigned head = *ring.cq_head;
+	const unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	for(; head != tail; head++)
+	{
+		const io_uring_cqe &cqe = ring.cqes[head & *ring.cq_mask];
+		switch(cqe.user_data)
+		{
+			case TAG_READ:
+				io.reading = false;
+				read_result = cqe.res;
+				break;
+			case TAG_COMMAND:
+				io.command_pending = false;
+				if(cqe.res != (ssize_t)io.command.size() && io.error.empty())
+					io.error = format("Error: write to tty failed: {}", cqe.res < 0 ? strerror(-cqe.res) : "short write");
+				break;
+			case TAG_APPEND:
+				if(!io.append_synced)
+					io.appending = false;
+				if(cqe.res != (ssize_t)io.append_size && io.error.empty())
+					io.error = format("Error: write to log failed: {}", cqe.res < 0 ? strerror(-cqe.res) : "short write");
+				break;
+			case TAG_SYNC:
+				// linked to append, so it's cancelled if append failed or was short
+				io.appending = false;
+				if(cqe.res < 0 && cqe.res != -ECANCELED && io.error.empty())
+					io.error = format("Error: log fdatasync failed: {}", strerror(-cqe.res));
+				if(cqe.res >= 0)
+					commit_done(io);
+				break;
+		}
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void raise_error(sweepio_t &io)
+{
+	if(!io.error.empty())
+	{
+		const string error = io.error;
+		io.error.clear();
+		if_error(true, error);
+	}
+}
+
+static void write_all(sweepio_t &io, int fd, const char *data, size_t size, const string &what)
+{
+	while(size > 0)
+	{
+		const ssize_t n = write(fd, data, size);
+		io.syscalls++;
+		if(n < 0 && errno == EINTR)
+			continue;
+		if_error(n <= 0, format("Error: write to {} failed: {}", what, strerror(errno)));
+		data += n;
+		size -= n;
+	}
+}
+
+void sweepio_init(sweepio_t &io, int tty, bool want_uring)
+{
+	io.tty = tty;
+	io.log = -1;
+	io.epoll_fd = -1;
+	io.ring = {};
+	io.ring.fd = -1;
+	io.read_buffer.assign(SWEEPIO_READ_SIZE, 0);
+	io.write_buffer.assign(SWEEPIO_WRITE_SIZE, 0);
+	io.reading = io.appending = io.append_synced = io.command_pending = false;
+	io.syscalls = 0;
+	io.commit_sweeps = 0;
+	io.commit_seconds = 0;
+	io.unsynced_records = io.unsynced_bytes = 0;
+	io.last_commit = io.sync_start = steady_clock::now();
+	io.records = io.commits = 0;
+	io.max_unsynced_records = io.max_unsynced_bytes = 0;
+	io.total_commit_us = io.max_commit_us = 0;
+
+	if(want_uring && uring_setup(io))
+	{
+		io.backend = iobackend_t::uring;
+		return;
+	}
+	if(want_uring)
+		cerr << "Warning: io_uring is unavailable, falling back to epoll" << endl;
+
+	io.backend = iobackend_t::epoll;
+	io.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if_error(io.epoll_fd < 0, "Error: cannot create epoll instance");
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = tty;
+	if_error(epoll_ctl(io.epoll_fd, EPOLL_CTL_ADD, tty, &event) != 0, "Error: cannot watch tty with epoll");
+	io.syscalls += 2;
+}
+
+void sweepio_set_log(sweepio_t &io, int log)
+{
+	io.log = log;
+}
+
+void sweepio_send(sweepio_t &io, const string &cmd)
+{
+	raise_error(io);
+	if(io.backend == iobackend_t::epoll)
+	{
+		write_all(io, io.tty, cmd.data(), cmd.size(), "tty");
+		return;
+	}
+
+	// buffer of previous command must not change under the kernel
+	ssize_t read_result = 0;
+	while(io.command_pending)
+	{
+		uring_enter(io, 1);
+		uring_reap(io, read_result);
+	}
+	io.command = cmd;
+	uring_rw(uring_sqe(io), IORING_OP_WRITE, io.tty, io.command.data(), io.command.size(), TAG_COMMAND);
+	io.command_pending = true;
+}
+
+void sweepio_read_prompt(sweepio_t &io, string &response)
+{
+	response.swap(io.leftover);
+	io.leftover.clear();
+	size_t search_from = 0;
+	size_t prompt;
+	while((prompt = response.find(PROMPT, search_from)) == string::npos)
+	{
+		search_from = response.size() >= PROMPT.size() ? response.size() - PROMPT.size() + 1 : 0;
+		ssize_t n = 0;
+		if(io.backend == iobackend_t::uring)
+		{
+			// command queued by sweepio_send() goes out in the same syscall
+			io_uring_sqe *sqe = uring_sqe(io);
+			uring_rw(sqe, io.ring.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ,
+				io.tty, io.read_buffer.data(), io.read_buffer.size(), TAG_READ);
+			sqe->buf_index = 0;
+			io.reading = true;
+			while(io.reading)
+			{
+				uring_enter(io, 1);
+				uring_reap(io, n);
+			}
+			raise_error(io);
+			if(n < 0)
+				errno = -n;
+		}
+		else
+		{
+			epoll_event event;
+			io.syscalls++;
+			if(epoll_wait(io.epoll_fd, &event, 1, -1) < 0)
+			{
+				if_error(errno != EINTR, "Error: epoll_wait failed");
+				continue;
+			}
+			n = read(io.tty, io.read_buffer.data(), io.read_buffer.size());
+			io.syscalls++;
+		}
+		if(n < 0 && errno == EINTR)
+			continue;
+		if_error(n < 0, format("Error: read from tty failed: {}", strerror(errno)));
+		if_error(n == 0, "Error: tty closed");
+		response.append(reinterpret_cast<const char *>(io.read_buffer.data()), n);
+	}
+
+	const size_t end = prompt + PROMPT.size();
+	io.leftover.assign(response, end, string::npos);
+	response.resize(end);
+}
+
+void sweepio_set_commit(sweepio_t &io, size_t sweeps, double seconds)
+{
+	io.commit_sweeps = sweeps;
+	io.commit_seconds = seconds;
+}
+
+// group commit: once commit_sweeps records or commit_seconds are unsynced, whichever comes first
+static bool commit_due(const sweepio_t &io)
+{
+	if(io.unsynced_records == 0)
+		return false;
+	if(io.commit_sweeps != 0 && io.unsynced_records >= io.commit_sweeps)
+		return true;
+	return io.commit_seconds > 0 &&
+		std::chrono::duration<double>(steady_clock::now() - io.last_commit).count() >= io.commit_seconds;
+}
+
+static void commit_started(sweepio_t &io)
+{
+	io.max_unsynced_records = std::max(io.max_unsynced_records, io.unsynced_records);
+	io.max_unsynced_bytes = std::max(io.max_unsynced_bytes, io.unsynced_bytes);
+	io.unsynced_records = 0;
+	io.unsynced_bytes = 0;
+	io.last_commit = io.sync_start = steady_clock::now();
+}
+
+static void uring_sync(sweepio_t &io, io_uring_sqe *sqe)
+{
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fd = io.log;
+	sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	sqe->user_data = TAG_SYNC;
+	commit_started(io);
+	io.appending = true;
+}
+
+static void epoll_sync(sweepio_t &io)
+{
+	commit_started(io);
+	if_error(fdatasync(io.log) != 0, format("Error: log fdatasync failed: {}", strerror(errno)));
+	io.syscalls++;
+	commit_done(io);
+}
+
+// previous record is done long ago, unless disk is stuck
+static void uring_wait_append(sweepio_t &io)
+{
+	ssize_t read_result = 0;
+	while(io.appending)
+	{
+		uring_enter(io, 1);
+		uring_reap(io, read_result);
+	}
+	raise_error(io);
+}
+
+bool sweepio_append(sweepio_t &io, const char *data, size_t size)
+{
+	raise_error(io);
+	io.records++;
+	io.unsynced_records++;
+	io.unsynced_bytes += size;
+	const bool sync = commit_due(io);
+
+	if(io.backend == iobackend_t::epoll)
+	{
+		write_all(io, io.log, data, size, "log");
+		if(sync)
+			epoll_sync(io);
+		return sync;
+	}
+
+	uring_wait_append(io);
+	io_uring_sqe *sqe = uring_sqe(io);
+	io.append_size = size;
+	io.append_synced = sync;
+	if(size <= io.write_buffer.size())
+	{
+		std::copy_n(data, size, io.write_buffer.data());
+		uring_rw(sqe, io.ring.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, io.log, io.write_buffer.data(), size, TAG_APPEND);
+		sqe->buf_index = 1;
+	}
+	else
+	{
+		io.big_write.assign(data, data + size);
+		uring_rw(sqe, IORING_OP_WRITE, io.log, io.big_write.data(), size, TAG_APPEND);
+	}
+	io.appending = true;
+	if(sync)
+	{
+		sqe->flags |= IOSQE_IO_LINK; // fdatasync only starts once write is done
+		uring_sync(io, uring_sqe(io));
+	}
+
+	// submitted now, so a crash doesn't lose a whole interval, but not waited for
+	uring_enter(io, 0);
+	return sync;
+}
+
+void sweepio_drain(sweepio_t &io)
+{
+	if(io.backend == iobackend_t::uring)
+	{
+		uring_wait_append(io);
+		if(io.unsynced_records > 0 && io.log >= 0)
+			uring_sync(io, uring_sqe(io));
+		ssize_t read_result = 0;
+		while(io.ring.queued > 0 || io.appending || io.command_pending)
+		{
+			uring_enter(io, io.appending || io.command_pending ? 1 : 0);
+			uring_reap(io, read_result);
+		}
+	}
+	else if(io.unsynced_records > 0 && io.log >= 0)
+	{
+		epoll_sync(io);
+	}
+	raise_error(io);
+}
+
+void sweepio_sleep_until(sweepio_t &io, const time_point<system_clock> &deadline)
+{
+	ssize_t read_result = 0;
+	while(io.backend == iobackend_t::uring && io.appending && system_clock::now() < deadline)
+	{
+		const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - system_clock::now()).count();
+		__kernel_timespec ts = {left / 1000000000, left % 1000000000};
+		io_uring_getevents_arg arg = {0, 0, 0, reinterpret_cast<uint64_t>(&ts)};
+		const int ret = syscall(__NR_io_uring_enter, io.ring.fd, io.ring.queued, 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		io.syscalls++;
+		io.ring.queued = *io.ring.sq_tail - __atomic_load_n(io.ring.sq_head, __ATOMIC_ACQUIRE);
+		// kernel older than 5.11 can't wait with a timeout, so just sleep
+		if(ret < 0 && errno != ETIME && errno != EINTR)
+			break;
+		uring_reap(io, read_result);
+	}
+	std::this_thread::sleep_until(deadline);
+}
+
+void sweepio_report(const sweepio_t &io)
+{
+	const size_t max_records = std::max(io.max_unsynced_records, io.unsynced_records);
+	const size_t max_bytes = std::max(io.max_unsynced_bytes, io.unsynced_bytes);
+	print("Durability: {} records in {} commits ({:.1f} records each), commit latency avg {:.0f}us, max {:.0f}us, "
+		"at most {} records ({:.1f}KiB) unsynced\n",
+		io.records, io.commits, io.commits ? (double)io.records / io.commits : 0,
+		io.commits ? io.total_commit_us / io.commits : 0, io.max_commit_us, max_records, max_bytes / 1024.0);
+}
+
+void sweepio_close(sweepio_t &io)
+{
+	sweepio_drain(io);
+	if(io.backend == iobackend_t::uring)
+		uring_unmap(io.ring);
+	if(io.epoll_fd >= 0)
+		close(io.epoll_fd);
+	io.epoll_fd = -1;
+}
+
+const char *sweepio_backend_name(const sweepio_t &io)
+{
+	if(io.backend == iobackend_t::uring)
+		return io.ring.fixed ? "io_uring, registered buffers" : "io_uring";
+	return "epoll & write";
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common.hpp"
+#include <linux/io_uring.h>
+
+using std::chrono::steady_clock;
+
+/* sweepio.hpp: tty & log I/O of spsave, through io_uring or epoll & write */
+
+enum class iobackend_t { uring, epoll };
+
+// mapped io_uring, set up with raw syscalls, liburing isn't needed
+typedef struct
+{
+	int fd;
+	unsigned entries;
+	// submission queue
+	void *sq_map;
+	size_t sq_map_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned queued; // SQEs filled in but not submitted yet
+	// completion queue
+	void *cq_map;
+	size_t cq_map_size;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	io_uring_cqe *cqes;
+	bool fixed; // buffers are registered, so kernel doesn't map them on every read & write
+} uring_t;
+
+typedef struct
+{
+	iobackend_t backend;
+	int tty;
+	int log; // -1 until sweepio_set_log()
+	int epoll_fd;
+	uring_t ring;
+
+	vector<uint8_t> read_buffer; // registered buffer 0
+	vector<uint8_t> write_buffer; // registered buffer 1, records bigger than it go unregistered
+	vector<uint8_t> big_write; // record that didn't fit into write_buffer
+	string leftover; // read after the prompt, belongs to next response
+	string command; // kept alive until its write completes
+	bool reading; // tty read in flight
+	bool appending; // log write or fdatasync in flight
+	size_t append_size; // of record in flight
+	bool append_synced; // record in flight is followed by fdatasync
+	bool command_pending; // tty write in flight
+	string error; // of a write completing in background, raised by next call
+
+	size_t syscalls;
+
+	// group commit policy, 0 disables either limit, both 0 only syncs on drain
+	size_t commit_sweeps;
+	double commit_seconds;
+	size_t unsynced_records;
+	size_t unsynced_bytes;
+	time_point<steady_clock> last_commit;
+	time_point<steady_clock> sync_start;
+
+	// commit metrics, "unsynced" is what power loss could take away
+	size_t records;
+	size_t commits;
+	size_t max_unsynced_records;
+	size_t max_unsynced_bytes;
+	double total_commit_us;
+	double max_commit_us;
+} sweepio_t;
+
+// io_uring if asked & kernel allows it, otherwise epoll & write
+void sweepio_init(sweepio_t &io, int tty, bool want_uring);
+void sweepio_set_log(sweepio_t &io, int log);
+// with io_uring, command goes out together with first read of response
+void sweepio_send(sweepio_t &io, const string &cmd);
+// everything up to & including next "ch> " prompt
+void sweepio_read_prompt(sweepio_t &io, string &response);
+// fdatasync() every sweeps records or seconds, whichever comes first, default: only on drain
+void sweepio_set_commit(sweepio_t &io, size_t sweeps, double seconds);
+// appended & fdatasync()ed if a commit is due, returns whether it was
+// with io_uring it returns once submitted
+bool sweepio_append(sweepio_t &io, const char *data, size_t size);
+// wait for appends in flight & commit what's unsynced, before log is closed
+void sweepio_drain(sweepio_t &io);
+// sleeps in the ring with io_uring, so a commit in flight is timed when it completes
+void sweepio_sleep_until(sweepio_t &io, const time_point<system_clock> &deadline);
+void sweepio_report(const sweepio_t &io);
+void sweepio_close(sweepio_t &io);
+const char *sweepio_backend_name(const sweepio_t &io);
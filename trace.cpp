@@ -0,0 +1,166 @@
+/*
+ *   trace - per-thread event recording in Chrome trace format
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "trace.hpp"
+#include <memory>
+#include <mutex>
+
+using std::chrono::steady_clock;
+
+typedef struct
+{
+	const char *name;
+	uint64_t timestamp; // ns since trace_start()
+	char phase; // 'B' or 'E'
+} traceevent_t;
+
+// only its own thread writes to a buffer, size is published after the event,
+// so it can be dumped while the thread is still running
+typedef struct
+{
+	uint32_t tid;
+	std::atomic<const char *> name;
+	std::atomic<size_t> size;
+	std::atomic<size_t> dropped;
+	// only touched by its own thread: slots held back for 'E' of recorded 'B' events still open,
+	// & 'B' events dropped whose 'E' is dropped as well, so every recorded slice is closed
+	size_t open;
+	size_t skipped;
+	traceevent_t events[TRACE_BUFFER_EVENTS];
+} tracebuffer_t;
+
+std::atomic<bool> trace_enabled(false);
+static string trace_filename;
+static time_point<steady_clock> trace_epoch;
+
+// buffers outlive their threads, so short-lived threads show up as well
+static std::mutex registry_lock;
+static vector<std::unique_ptr<tracebuffer_t>> buffers;
+static thread_local tracebuffer_t *buffer = nullptr;
+
+void trace_start(const string &filename)
+{
+	trace_filename = filename;
+	trace_epoch = steady_clock::now();
+	trace_enabled = true;
+}
+
+// taken once per thread, on its first event
+static tracebuffer_t *thread_buffer(void)
+{
+	if(buffer != nullptr)
+		return buffer;
+
+	auto b = std::make_unique<tracebuffer_t>();
+	b->name = nullptr;
+	b->size = 0;
+	b->dropped = 0;
+	b->open = 0;
+	b->skipped = 0;
+
+	std::lock_guard<std::mutex> guard(registry_lock);
+	b->tid = buffers.size() + 1;
+	buffer = b.get();
+	buffers.emplace_back(std::move(b));
+	return buffer;
+}
+
+void trace_event(const char *name, char phase)
+{
+	tracebuffer_t *b = thread_buffer();
+	const size_t n = b->size.load(std::memory_order_relaxed);
+	// slices nest, so an 'E' always belongs to the innermost 'B' still open
+	bool drop;
+	if(phase == 'B')
+	{
+		// room for this event & its 'E', on top of what open slices hold back
+		drop = b->skipped > 0 || n + b->open + 2 > TRACE_BUFFER_EVENTS;
+		if(drop)
+			b->skipped++;
+		else
+			b->open++;
+	}
+	else
+	{
+		drop = b->skipped > 0;
+		if(drop)
+			b->skipped--;
+		else if(b->open > 0)
+			b->open--;
+		else
+			drop = n >= TRACE_BUFFER_EVENTS; // 'E' without a 'B', from before trace_start()
+	}
+	if(drop)
+	{
+		b->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(steady_clock::now() - trace_epoch);
+	b->events[n] = {name, (uint64_t)elapsed.count(), phase};
+	b->size.store(n + 1, std::memory_order_release);
+}
+
+void trace_thread_name(const char *name)
+{
+	if(trace_enabled)
+		thread_buffer()->name = name;
+}
+
+// write every buffer out, load in chrome://tracing or ui.perfetto.dev
+void trace_stop(void)
+{
+	if(!trace_enabled.exchange(false))
+		return;
+
+	fstream f(trace_filename, ios::out | ios::trunc);
+	if_error(!f.is_open(), "Error: cannot open trace file " + trace_filename);
+
+	const pid_t pid = getpid();
+	size_t events = 0;
+	size_t dropped = 0;
+	bool first = true;
+	f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	std::lock_guard<std::mutex> guard(registry_lock);
+	for(const auto &b : buffers)
+	{
+		const char *name = b->name.load();
+		const string thread_name = name != nullptr ? name : format("thread {}", b->tid);
+		f << format("{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+			first ? "" : ",\n", pid, b->tid, thread_name);
+		first = false;
+
+		const size_t size = b->size.load(std::memory_order_acquire);
+		for(size_t i = 0; i < size; i++)
+		{
+			const traceevent_t &e = b->events[i];
+			f << format(",\n{{\"name\":\"{}\",\"ph\":\"{}\",\"ts\":{:.3f},\"pid\":{},\"tid\":{}}}",
+				e.name, e.phase, e.timestamp / 1e3, pid, b->tid);
+		}
+		events += size;
+		dropped += b->dropped;
+	}
+	f << "\n]}\n";
+	f.close();
+	if_error(f.fail(), "Error: failed to write trace file " + trace_filename);
+
+	print("Trace: {} events of {} threads written to {}, {} dropped\n", events, buffers.size(), trace_filename, dropped);
+}
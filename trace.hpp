@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.hpp"
+#include <atomic>
+
+/* trace.hpp: begin / end events per thread, dumped as Chrome trace JSON */
+
+extern std::atomic<bool> trace_enabled;
+
+void trace_start(const string &filename);
+void trace_stop(void);
+void trace_event(const char *name, char phase);
+void trace_thread_name(const char *name);
+
+// name must be a string literal, only its pointer is stored
+static inline void trace_begin(const char *name)
+{
+	if(trace_enabled.load(std::memory_order_relaxed))
+		trace_event(name, 'B');
+}
+
+static inline void trace_end(const char *name)
+{
+	if(trace_enabled.load(std::memory_order_relaxed))
+		trace_event(name, 'E');
+}
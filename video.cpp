@@ -0,0 +1,197 @@
+/*
+ *   video - scrolling waterfall as raw Y4M video
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "video.hpp"
+#include "trace.hpp"
+#include <fcntl.h>
+#include <sys/uio.h>
+
+// black in full range YUV
+constexpr static uint8_t BLACK_Y = 0;
+constexpr static uint8_t BLACK_C = 128;
+
+void video_ring_init(videoring_t &ring, size_t steps, size_t window_rows)
+{
+	ring.width = steps + steps % 2;
+	ring.window_rows = window_rows + window_rows % 2;
+	ring.pushed = 0;
+	ring.y.assign(ring.window_rows * ring.width, BLACK_Y);
+	ring.u.assign(ring.window_rows * ring.width / 2, BLACK_C);
+	ring.v.assign(ring.window_rows * ring.width / 2, BLACK_C);
+}
+
+// JPEG (full range BT.601) in 16.16 fixed point
+static inline uint8_t rgb_y(int r, int g, int b)
+{
+	return (19595 * r + 38470 * g + 7471 * b + 32768) >> 16;
+}
+
+static inline uint8_t rgb_u(int r, int g, int b)
+{
+	return (-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16;
+}
+
+static inline uint8_t rgb_v(int r, int g, int b)
+{
+	return (32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32768) >> 16;
+}
+
+void video_ring_push(videoring_t &ring, const uint8_t *rgb, size_t steps, size_t rows)
+{
+	if_error(rows > ring.window_rows, "Error: more rows pushed than video window holds");
+	const size_t half = ring.width / 2;
+
+	// rows land in distinct slots, so they're converted in parallel
+	#pragma omp parallel for schedule(static)
+	for(size_t r = 0; r < rows; r++)
+	{
+		const size_t slot = (ring.pushed + r) % ring.window_rows;
+		const uint8_t *in = rgb + r * steps * 3;
+		uint8_t *y = &ring.y[slot * ring.width];
+		uint8_t *u = &ring.u[slot * half];
+		uint8_t *v = &ring.v[slot * half];
+		for(size_t x = 0; x < steps; x++)
+			y[x] = rgb_y(in[x * 3], in[x * 3 + 1], in[x * 3 + 2]);
+		if(steps % 2)
+			y[steps] = BLACK_Y;
+		for(size_t x = 0; x < half; x++)
+		{
+			// odd last column pairs with black padding
+			const size_t x1 = std::min(x * 2 + 1, steps);
+			const int r0 = in[x * 2 * 3], g0 = in[x * 2 * 3 + 1], b0 = in[x * 2 * 3 + 2];
+			const int r1 = x1 < steps ? in[x1 * 3] : 0;
+			const int g1 = x1 < steps ? in[x1 * 3 + 1] : 0;
+			const int b1 = x1 < steps ? in[x1 * 3 + 2] : 0;
+			u[x] = (rgb_u(r0, g0, b0) + rgb_u(r1, g1, b1) + 1) / 2;
+			v[x] = (rgb_v(r0, g0, b0) + rgb_v(r1, g1, b1) + 1) / 2;
+		}
+	}
+	ring.pushed += rows;
+}
+
+static void write_all(y4mwriter_t &y4m, const iovec *iov, int count)
+{
+	size_t total = 0;
+	for(int i = 0; i < count; i++)
+		total += iov[i].iov_len;
+
+	// short writes are common on pipes, so restart from where it stopped
+	vector<iovec> rest(iov, iov + count);
+	size_t first = 0;
+	while(total > 0)
+	{
+		const ssize_t n = writev(y4m.fd, &rest[first], rest.size() - first);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if_error(n <= 0, "Error: failed to write video to " + y4m.filename);
+		total -= n;
+		size_t done = n;
+		while(first < rest.size() && done >= rest[first].iov_len)
+			done -= rest[first++].iov_len;
+		if(first < rest.size())
+		{
+			rest[first].iov_base = static_cast<uint8_t *>(rest[first].iov_base) + done;
+			rest[first].iov_len -= done;
+		}
+	}
+}
+
+void y4m_begin(y4mwriter_t &y4m, const string &filename, const videoring_t &ring, int fps)
+{
+	y4m.filename = filename;
+	y4m.width = ring.width;
+	y4m.height = ring.window_rows;
+	y4m.frames = 0;
+	y4m.frame.resize(y4m.width * y4m.height * 3 / 2);
+
+	if(filename == "-")
+	{
+		// video keeps stdout to itself, progress messages go to stderr
+		fflush(stdout);
+		y4m.fd = dup(STDOUT_FILENO);
+		if_error(y4m.fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0, "Error: cannot take over stdout for video");
+	}
+	else
+	{
+		y4m.fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if_error(y4m.fd < 0, "Error: cannot open video file " + filename);
+	}
+
+	const string header = format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", y4m.width, y4m.height, fps);
+	const iovec iov = {const_cast<char *>(header.data()), header.size()};
+	write_all(y4m, &iov, 1);
+}
+
+void y4m_write_frame(y4mwriter_t &y4m, const videoring_t &ring, size_t first)
+{
+	trace_begin("video frame");
+	const size_t width = y4m.width;
+	const size_t half = width / 2;
+	uint8_t *y_plane = y4m.frame.data();
+	uint8_t *u_plane = y_plane + width * y4m.height;
+	uint8_t *v_plane = u_plane + half * y4m.height / 2;
+
+	// only copies & averages, every record was coloured when pushed
+	#pragma omp parallel for schedule(static)
+	for(size_t row = 0; row < y4m.height / 2; row++)
+	{
+		size_t slots[2];
+		bool valid[2];
+		for(size_t i = 0; i < 2; i++)
+		{
+			const size_t record = first + row * 2 + i;
+			// ring only has the last window of records pushed
+			valid[i] = record < ring.pushed && record + ring.window_rows >= ring.pushed;
+			slots[i] = record % ring.window_rows;
+			uint8_t *y = y_plane + (row * 2 + i) * width;
+			if(valid[i])
+				std::copy_n(&ring.y[slots[i] * width], width, y);
+			else
+				std::fill_n(y, width, BLACK_Y);
+		}
+
+		uint8_t *u = u_plane + row * half;
+		uint8_t *v = v_plane + row * half;
+		for(size_t x = 0; x < half; x++)
+		{
+			const int u0 = valid[0] ? ring.u[slots[0] * half + x] : BLACK_C;
+			const int u1 = valid[1] ? ring.u[slots[1] * half + x] : BLACK_C;
+			const int v0 = valid[0] ? ring.v[slots[0] * half + x] : BLACK_C;
+			const int v1 = valid[1] ? ring.v[slots[1] * half + x] : BLACK_C;
+			u[x] = (u0 + u1 + 1) / 2;
+			v[x] = (v0 + v1 + 1) / 2;
+		}
+	}
+
+	static const char frame_header[] = "FRAME\n";
+	const iovec iov[2] =
+	{
+		{const_cast<char *>(frame_header), sizeof(frame_header) - 1},
+		{y4m.frame.data(), y4m.frame.size()}
+	};
+	write_all(y4m, iov, 2);
+	y4m.frames++;
+	trace_end("video frame");
+}
+
+void y4m_end(y4mwriter_t &y4m)
+{
+	if_error(close(y4m.fd) != 0, "Error: failed to write video to " + y4m.filename);
+	y4m.fd = -1;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.hpp"
+
+/* video.hpp: scrolling waterfall as raw Y4M (YUV 4:2:0, full range BT.601) frames */
+
+// ring of the last window_rows coloured records, already converted to YUV,
+// so every record is coloured & converted once, however many frames show it
+// chroma is only halved horizontally here, rows are paired when a frame is cut,
+// as a frame may start on an odd record
+typedef struct
+{
+	size_t width; // even, odd widths get a black column
+	size_t window_rows; // even, odd windows show one more record
+	size_t pushed; // records seen so far
+	vector<uint8_t> y; // [slot][width]
+	vector<uint8_t> u; // [slot][width / 2]
+	vector<uint8_t> v;
+} videoring_t;
+
+typedef struct
+{
+	int fd;
+	string filename; // "-" is stdout
+	size_t width;
+	size_t height;
+	size_t frames;
+	vector<uint8_t> frame; // Y, U & V planes of frame being cut
+} y4mwriter_t;
+
+void video_ring_init(videoring_t &ring, size_t steps, size_t window_rows);
+// rgb: rows * steps * 3, rows must not be more than window
+void video_ring_push(videoring_t &ring, const uint8_t *rgb, size_t steps, size_t rows);
+
+// stdout is taken over for video, everything printed goes to stderr instead
+void y4m_begin(y4mwriter_t &y4m, const string &filename, const videoring_t &ring, int fps);
+// frame of records [first, first + window), those not pushed (yet) are black
+void y4m_write_frame(y4mwriter_t &y4m, const videoring_t &ring, size_t first);
+void y4m_end(y4mwriter_t &y4m);
@@ -0,0 +1,217 @@
+/*
+ *   waterfall - live spectrum waterfall in the terminal
+ *   Copyright (C) 2023 Kelei Chen
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.hpp"
+#include "config.hpp"
+#include "waterfall.hpp"
+#include "trace.hpp"
+#include <tinycolormap.hpp>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// status & waterfall lines share the terminal, whoever writes to it holds console_lock
+// status_line is what's on screen of the current status line
+static std::mutex console_lock;
+static string status_line;
+
+bool parse_waterfall_mode(const string &mode, waterfallmode_t &result)
+{
+	if(mode == "256")
+	{
+		result = waterfallmode_t::palette256;
+	}
+	else if(mode == "truecolor")
+	{
+		result = waterfallmode_t::truecolour;
+	}
+	else if(mode == "auto")
+	{
+		const char *colorterm = getenv("COLORTERM");
+		const string value = colorterm == nullptr ? "" : colorterm;
+		result = value == "truecolor" || value == "24bit" ? waterfallmode_t::truecolour : waterfallmode_t::palette256;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+// nearest of 6x6x6 colour cube in xterm's 256 colour palette
+static int xterm_index(uint8_t r, uint8_t g, uint8_t b)
+{
+	auto level = [](uint8_t v) { return v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40; };
+	return 16 + 36 * level(r) + 6 * level(g) + level(b);
+}
+
+static void make_palette(waterfall_t &wf)
+{
+	wf.palette.resize(WATERFALL_LEVELS);
+	for(size_t i = 0; i < WATERFALL_LEVELS; i++)
+	{
+		const auto color = tinycolormap::GetColor((double)i / (WATERFALL_LEVELS - 1), tinycolormap::ColormapType::Cubehelix);
+		const uint8_t r = color.r() * 255, g = color.g() * 255, b = color.b() * 255;
+		if(wf.mode == waterfallmode_t::truecolour)
+			wf.palette[i] = format("\x1b[48;2;{};{};{}m", r, g, b);
+		else
+			wf.palette[i] = format("\x1b[48;5;{}m", xterm_index(r, g, b));
+	}
+}
+
+static size_t terminal_columns(int fd)
+{
+	struct winsize ws;
+	if(ioctl(fd, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+		return ws.ws_col;
+	const char *columns = getenv("COLUMNS");
+	return columns != nullptr && atoi(columns) > 0 ? atoi(columns) : WATERFALL_DEFAULT_COLUMNS;
+}
+
+// max of every bin falling into a column, so a narrow carrier never disappears
+static void max_pool(const vector<float> &sweep, vector<float> &columns)
+{
+	const size_t width = columns.size();
+	for(size_t c = 0; c < width; c++)
+	{
+		const size_t first = c * sweep.size() / width;
+		const size_t last = std::max((c + 1) * sweep.size() / width, first + 1);
+		float peak = NAN;
+		for(size_t i = first; i < last; i++)
+			peak = fmax(peak, sweep[i]);
+		columns[c] = peak;
+	}
+}
+
+// whole line in one write, followed by what was already written of spsave's status line
+static void draw_line(waterfall_t &wf, const string &time)
+{
+	// width is asked every line, so resizing terminal just works
+	const size_t label = WATERFALL_LABEL_WIDTH;
+	const size_t terminal = terminal_columns(wf.fd);
+	const size_t width = std::min(terminal > label ? terminal - label : 1, wf.sweep.size());
+	wf.columns.resize(width);
+	max_pool(wf.sweep, wf.columns);
+
+	// "YYYYMMDDTHHMMSS" -> "HH:MM:SS "
+	wf.line = "\r\x1b[2K";
+	if(time.size() >= 15)
+		wf.line += format("{}:{}:{} ", time.substr(9, 2), time.substr(11, 2), time.substr(13, 2));
+	else
+		wf.line.append(label, ' ');
+
+	static const string no_colour = "\x1b[49m"; // NaN & Inf: default background
+	const string *previous = nullptr;
+	for(const float power : wf.columns)
+	{
+		const string *colour = &no_colour;
+		if(isfinite(power))
+		{
+			const float value = (power - SPECTROGRAM_MIN_DBM) / (SPECTROGRAM_MAX_DBM - SPECTROGRAM_MIN_DBM);
+			colour = &wf.palette[std::clamp<int>(value * (WATERFALL_LEVELS - 1) + 0.5f, 0, WATERFALL_LEVELS - 1)];
+		}
+		// runs of same colour only need one escape sequence, levels may share a colour in 256 colour mode
+		if(previous == nullptr || *colour != *previous)
+			wf.line += *colour;
+		wf.line += ' ';
+		previous = colour;
+	}
+	wf.line += "\x1b[0m\n";
+
+	std::lock_guard<std::mutex> guard(console_lock);
+	cout << flush;
+	wf.line += status_line;
+	for(size_t written = 0; written < wf.line.size(); )
+	{
+		const ssize_t n = write(wf.fd, wf.line.data() + written, wf.line.size() - written);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return; // terminal went away, sweeping goes on
+		written += n;
+	}
+}
+
+// runs on its own thread, so a slow terminal or SSH link never delays sweeping
+static void drawer(waterfall_t &wf)
+{
+	trace_thread_name("waterfall");
+	std::unique_lock<std::mutex> guard(wf.lock);
+	while(true)
+	{
+		wf.wakeup.wait(guard, [&wf] { return wf.stopping || wf.has_pending; });
+		if(!wf.has_pending)
+			break; // stopping
+
+		wf.sweep.swap(wf.pending);
+		const string time = wf.pending_time;
+		wf.has_pending = false;
+
+		guard.unlock();
+		trace_begin("waterfall draw");
+		draw_line(wf, time);
+		trace_end("waterfall draw");
+		guard.lock();
+		wf.drawn++;
+	}
+}
+
+void waterfall_start(waterfall_t &wf, waterfallmode_t mode)
+{
+	wf.mode = mode;
+	wf.fd = STDOUT_FILENO;
+	wf.has_pending = false;
+	wf.stopping = false;
+	wf.drawn = 0;
+	wf.dropped = 0;
+	make_palette(wf);
+	wf.drawer = std::thread(drawer, std::ref(wf));
+}
+
+void waterfall_push(waterfall_t &wf, const vector<float> &sweep, const string &time)
+{
+	std::lock_guard<std::mutex> guard(wf.lock);
+	if(wf.has_pending)
+		wf.dropped++;
+	wf.pending.assign(sweep.begin(), sweep.end());
+	wf.pending_time = time;
+	wf.has_pending = true;
+	wf.wakeup.notify_one();
+}
+
+// draw what's left & print how many sweeps didn't make it to screen
+void waterfall_stop(waterfall_t &wf)
+{
+	{
+		std::lock_guard<std::mutex> guard(wf.lock);
+		wf.stopping = true;
+		wf.wakeup.notify_one();
+	}
+	wf.drawer.join();
+	print("Waterfall: {} lines drawn, {} sweeps skipped by a slow terminal\n", wf.drawn, wf.dropped);
+}
+
+void waterfall_status(const string &text)
+{
+	std::lock_guard<std::mutex> guard(console_lock);
+	cout << text << flush;
+	const size_t line_start = text.find_last_of("\r\n");
+	if(line_start == string::npos)
+		status_line += text;
+	else
+		status_line = text.substr(line_start + 1);
+}
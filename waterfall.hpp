@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common.hpp"
+#include <mutex>
+#include <condition_variable>
+
+/* waterfall.hpp: live spectrum waterfall in the terminal, one line per sweep */
+
+enum class waterfallmode_t { palette256, truecolour };
+
+typedef struct
+{
+	waterfallmode_t mode;
+	int fd;
+	// escape sequence setting background of each level, precomputed for both modes
+	vector<string> palette;
+
+	// newest sweep not drawn yet, an older one is replaced instead of queued
+	std::thread drawer;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	vector<float> pending;
+	string pending_time;
+	bool has_pending;
+	bool stopping;
+
+	// drawer's own buffers
+	vector<float> sweep;
+	vector<float> columns;
+	string line;
+
+	size_t drawn;
+	size_t dropped;
+} waterfall_t;
+
+// mode: "256", "truecolor" or "auto" (truecolour if $COLORTERM says so)
+bool parse_waterfall_mode(const string &mode, waterfallmode_t &result);
+void waterfall_start(waterfall_t &wf, waterfallmode_t mode);
+// never blocks on terminal, a sweep arriving while previous one is still being drawn replaces it
+void waterfall_push(waterfall_t &wf, const vector<float> &sweep, const string &time);
+void waterfall_stop(waterfall_t &wf);
+// spsave's status line goes through here, with or without a waterfall, so a waterfall line
+// never lands in the middle of it, the part already written is put back below the waterfall line
+void waterfall_status(const string &text);